@@ -53,6 +53,7 @@
 #include <iostream>         // cout
 #include <iomanip>          // setprecision
 #include "helper.h"         //
+#include <math.h>           // sqrt
 
 #ifdef WIN32
 #include <conio.h>          // _getch()
@@ -63,6 +64,11 @@
 #include <limits.h>         // HOST_NAME_MAX
 #include <sys/utsname.h>    //
 #include <fcntl.h>          // O_RDWR
+#include <sys/stat.h>       // fstat
+#include <sys/ioctl.h>      // ioctl
+#include <sys/resource.h>   // getrusage
+#include <sys/syscall.h>    // syscall
+#include <linux/perf_event.h>   // perf_event_open
 #endif
 
 using namespace std;        // cout. ...
@@ -422,6 +428,23 @@ UINT64 getWallClockMS()
 #endif
 }
 
+//
+// getWallClockUS
+//
+UINT64 getWallClockUS()
+{
+#ifdef WIN32
+    LARGE_INTEGER t, f;
+    QueryPerformanceCounter(&t);
+    QueryPerformanceFrequency(&f);
+    return t.QuadPart * 1000000 / f.QuadPart;
+#elif __linux__
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return (UINT64) t.tv_sec*1000000 + t.tv_nsec / 1000;
+#endif
+}
+
 //
 // setThreadCPU
 //
@@ -913,6 +936,586 @@ UINT rand(UINT &r)
 
 #endif
 
+//
+// splitmix64
+//
+// Steele, Lea & Flood, "Fast Splittable Pseudorandom Number Generators", OOPSLA 2014
+//
+UINT64 splitmix64(UINT64 &x)
+{
+    UINT64 z = (x += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+//
+// seedRng
+//
+// fill xoshiro256** state from splitmix64(seed) then jump 2^128 steps per stream so
+// streams from the same master seed never overlap
+//
+void seedRng(Rng &r, UINT64 seed, UINT stream)
+{
+    static const UINT64 jump[] = { 0x180ec6d33cfd0abaULL, 0xd5a61266f0c9392cULL, 0xa9582618e03fc9aaULL, 0x39abdc4529b1661cULL };
+
+    for (int i = 0; i < 4; i++)
+        r.s[i] = splitmix64(seed);
+
+    while (stream--) {
+        UINT64 s[4] = {0, 0, 0, 0};
+        for (int i = 0; i < 4; i++) {
+            for (int b = 0; b < 64; b++) {
+                if (jump[i] & (1ULL << b)) {
+                    for (int j = 0; j < 4; j++)
+                        s[j] ^= r.s[j];
+                }
+                nextRng(r);
+            }
+        }
+        for (int j = 0; j < 4; j++)
+            r.s[j] = s[j];
+    }
+}
+
+//
+// mapTrace
+//
+// map the whole trace read only and tell the kernel it will be read sequentially
+// NB: a trailing partial record is ignored
+//
+TraceOp* mapTrace(const char *fn, size_t &n)
+{
+    n = 0;
+#ifdef WIN32
+    HANDLE f = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+    if (f == INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER sz;
+    GetFileSizeEx(f, &sz);
+    n = (size_t) sz.QuadPart / sizeof(TraceOp);
+    if (n == 0) {
+        CloseHandle(f);
+        return NULL;
+    }
+    HANDLE m = CreateFileMapping(f, NULL, PAGE_READONLY, 0, 0, NULL);
+    TraceOp *t = m ? (TraceOp*) MapViewOfFile(m, FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (m)
+        CloseHandle(m);
+    CloseHandle(f);
+    if (t == NULL)
+        n = 0;
+    return t;
+#elif __linux__
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < (off_t) sizeof(TraceOp)) {
+        close(fd);
+        return NULL;
+    }
+    void *t = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (t == MAP_FAILED)
+        return NULL;
+    madvise(t, st.st_size, MADV_SEQUENTIAL);
+    n = st.st_size / sizeof(TraceOp);
+    return (TraceOp*) t;
+#endif
+}
+
+//
+// unmapTrace
+//
+void unmapTrace(TraceOp *t, size_t n)
+{
+#ifdef WIN32
+    UnmapViewOfFile(t);
+#elif __linux__
+    munmap(t, n*sizeof(TraceOp));
+#endif
+}
+
+//
+// openTrace
+//
+int openTrace(TraceWriter &w, const char *fn)
+{
+    w.n = 0;
+    w.f = fopen(fn, "wb");
+    return w.f != NULL;
+}
+
+//
+// flushTrace
+//
+void flushTrace(TraceWriter &w)
+{
+    if (w.f && w.n)
+        fwrite(w.buf, sizeof(TraceOp), w.n, w.f);
+    w.n = 0;
+}
+
+//
+// closeTrace
+//
+void closeTrace(TraceWriter &w)
+{
+    flushTrace(w);
+    if (w.f)
+        fclose(w.f);
+    w.f = NULL;
+}
+
+//
+// createImage
+//
+// the file is sized up front so threads can write their parts in any order
+//
+INT64 createImage(const char *fn, size_t sz)
+{
+#ifdef WIN32
+    HANDLE f = CreateFileA(fn, GENERIC_READ | GENERIC_WRITE, 0, NULL, CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE)
+        return -1;
+    LARGE_INTEGER li;
+    li.QuadPart = sz;
+    if (!SetFilePointerEx(f, li, NULL, FILE_BEGIN) || !SetEndOfFile(f)) {
+        CloseHandle(f);
+        return -1;
+    }
+    return (INT64) f;
+#elif __linux__
+    int fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0)
+        return -1;
+    if (ftruncate(fd, sz) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+#endif
+}
+
+//
+// writeImage
+//
+int writeImage(INT64 h, const void *p, size_t sz, size_t off)
+{
+    const char *q = (const char*) p;
+    while (sz) {
+#ifdef WIN32
+        OVERLAPPED o;
+        memset(&o, 0, sizeof(o));
+        o.Offset = (DWORD) off;
+        o.OffsetHigh = (DWORD) (off >> 32);
+        DWORD n = 0;
+        if (!WriteFile((HANDLE) h, q, (DWORD) min(sz, (size_t) 1 << 30), &n, &o) || n == 0)
+            return 0;
+#elif __linux__
+        ssize_t n = pwrite((int) h, q, sz, off);
+        if (n <= 0)
+            return 0;
+#endif
+        q += n;
+        off += n;
+        sz -= n;
+    }
+    return 1;
+}
+
+//
+// closeImage
+//
+void closeImage(INT64 h)
+{
+#ifdef WIN32
+    CloseHandle((HANDLE) h);
+#elif __linux__
+    close((int) h);
+#endif
+}
+
+//
+// mapImage
+//
+// a read only map shares the page cache, a copy on write map gets a private copy of each
+// page written to; neither writes back to the file
+//
+void* mapImage(const char *fn, int cow, size_t &sz)
+{
+    sz = 0;
+#ifdef WIN32
+    HANDLE f = CreateFileA(fn, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+    if (f == INVALID_HANDLE_VALUE)
+        return NULL;
+    LARGE_INTEGER li;
+    GetFileSizeEx(f, &li);
+    HANDLE m = li.QuadPart ? CreateFileMapping(f, NULL, cow ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL) : NULL;
+    void *p = m ? MapViewOfFile(m, cow ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0) : NULL;
+    if (m)
+        CloseHandle(m);
+    CloseHandle(f);
+    if (p)
+        sz = (size_t) li.QuadPart;
+    return p;
+#elif __linux__
+    int fd = open(fn, O_RDONLY);
+    if (fd < 0)
+        return NULL;
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *p = mmap(NULL, st.st_size, cow ? PROT_READ | PROT_WRITE : PROT_READ, cow ? MAP_PRIVATE : MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED)
+        return NULL;
+    sz = st.st_size;
+    return p;
+#endif
+}
+
+//
+// unmapImage
+//
+void unmapImage(void *p, size_t sz)
+{
+#ifdef WIN32
+    UnmapViewOfFile(p);
+#elif __linux__
+    munmap(p, sz);
+#endif
+}
+
+const char *pagesName[] = {"4K", "THP", "HUGETLB"};
+
+char *poolBase = NULL;                          // node pool region
+size_t poolSz = 0;                              // region bytes
+size_t poolObjSz = 0;                           // object size, a power of 2 so objects don't straddle cache lines
+volatile UINT64 poolUsed = 0;                   // bytes handed out as chunks
+
+#define POOLCHUNK   (64*1024)                   // bytes a thread takes from the region at a time
+
+thread_local char *poolNext;                    // thread's current chunk
+thread_local char *poolEnd;
+thread_local void *poolFreeList;                // objects freed by this thread
+
+//
+// poolInit
+//
+// map the region and fault every page in now so no run (or transaction) takes a first touch fault
+// THP is requested with madvise and then touched, as MAP_POPULATE would fault in 4K pages before
+// the madvise; 4K pages are forced with MADV_NOHUGEPAGE so they can be compared with THP
+// a failed HUGETLB mapping falls back to THP and a failed THP mapping or madvise to 4K pages
+//
+int poolInit(size_t objSz, size_t sz, int pages)
+{
+    poolObjSz = 8;
+    while (poolObjSz < objSz)
+        poolObjSz *= 2;
+    poolSz = sz;
+#ifdef WIN32
+    poolBase = (char*) VirtualAlloc(NULL, sz, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+    for (size_t i = 0; i < sz; i += 4096)
+        poolBase[i] = 0;
+    return PAGES4K;
+#elif __linux__
+    void *p = MAP_FAILED;
+    if (pages == PAGESHUGE) {
+        p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | MAP_POPULATE, -1, 0);
+        if (p == MAP_FAILED)
+            pages = PAGESTHP;   // no huge pages reserved
+    }
+    if (pages == PAGESTHP) {
+        size_t huge = 2*1024*1024;
+        char *q = (char*) mmap(NULL, sz + huge, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (q == MAP_FAILED) {
+            pages = PAGES4K;
+        } else {
+            p = (void*) (((size_t) q + huge - 1) & ~(huge - 1)); // huge page aligned
+            if (madvise(p, sz, MADV_HUGEPAGE) < 0) {
+                munmap(q, sz + huge);   // no THP, fall back to 4K pages
+                p = MAP_FAILED;
+                pages = PAGES4K;
+            } else {
+                for (size_t i = 0; i < sz; i += 4096)
+                    ((volatile char*) p)[i] = 0;
+            }
+        }
+    }
+    if (pages == PAGES4K) {
+        p = mmap(NULL, sz, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, sz, MADV_NOHUGEPAGE);
+            for (size_t i = 0; i < sz; i += 4096)
+                ((volatile char*) p)[i] = 0;
+        }
+    }
+    if (p == MAP_FAILED) {
+        poolSz = 0;
+        return -1;
+    }
+    poolBase = (char*) p;
+    return pages;
+#endif
+}
+
+//
+// poolAlloc
+//
+void* poolAlloc(size_t sz)
+{
+    if (sz > poolObjSz)
+        return malloc(sz);
+    if (poolFreeList) {
+        void *p = poolFreeList;
+        poolFreeList = *(void**) p;
+        return p;
+    }
+    if (poolNext == poolEnd) {
+        UINT64 off = InterlockedExchangeAdd64(&poolUsed, POOLCHUNK);
+        if (off + POOLCHUNK > poolSz)
+            return malloc(sz);
+        poolNext = poolBase + off;
+        poolEnd = poolNext + POOLCHUNK;
+    }
+    void *p = poolNext;
+    poolNext += poolObjSz;
+    return p;
+}
+
+//
+// poolFree
+//
+void poolFree(void *p)
+{
+    if ((char*) p >= poolBase && (char*) p < poolBase + poolSz) {
+        *(void**) p = poolFreeList;
+        poolFreeList = p;
+    } else {
+        free(p);
+    }
+}
+
+//
+// poolReset
+//
+// called between runs by the main thread, worker threads (and their chunks) are gone
+//
+void poolReset()
+{
+    poolUsed = 0;
+    poolNext = poolEnd = NULL;
+    poolFreeList = NULL;
+}
+
+//
+// openDTLBMissCounter
+//
+// user mode DTLB load misses; inherit counts threads created after the counter is opened and
+// adds their counts to it when they exit
+//
+int openDTLBMissCounter()
+{
+#ifdef WIN32
+    return -1;
+#elif __linux__
+    struct perf_event_attr pe;
+    memset(&pe, 0, sizeof(pe));
+    pe.type = PERF_TYPE_HW_CACHE;
+    pe.size = sizeof(pe);
+    pe.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    pe.disabled = 1;
+    pe.inherit = 1;
+    pe.exclude_kernel = 1;
+    pe.exclude_hv = 1;
+    return (int) syscall(__NR_perf_event_open, &pe, 0, -1, -1, 0);
+#endif
+}
+
+//
+// startCounter
+//
+void startCounter(int fd)
+{
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+#endif
+}
+
+//
+// stopCounter
+//
+UINT64 stopCounter(int fd)
+{
+    UINT64 v = 0;
+#ifdef __linux__
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &v, sizeof(v)) != sizeof(v))
+            v = 0;
+    }
+#endif
+    return v;
+}
+
+//
+// getPageFaults
+//
+UINT64 getPageFaults()
+{
+#ifdef WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc));
+    return pmc.PageFaultCount;
+#elif __linux__
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_minflt + ru.ru_majflt;
+#endif
+}
+
+//
+// getTSCTicksPerMS
+//
+// measured over 20ms the first time it is called
+//
+UINT64 getTSCTicksPerMS()
+{
+    static UINT64 ticks = 0;
+    if (ticks == 0) {
+        UINT64 us0 = getWallClockUS();
+        UINT64 t0 = __rdtsc();
+        Sleep(20);
+        UINT64 t1 = __rdtsc();
+        UINT64 us1 = getWallClockUS();
+        ticks = (t1 - t0) * 1000 / (us1 - us0);
+    }
+    return ticks;
+}
+
+//
+// resetSeries
+//
+void resetSeries(Series *s, int nt, UINT ms)
+{
+    UINT64 tick = ms * getTSCTicksPerMS();
+    UINT64 t0 = __rdtsc();
+    for (int thread = 0; thread < nt; thread++) {
+        memset(s[thread].n, 0, sizeof(s[thread].n));
+        s[thread].tick = tick;
+        s[thread].t0 = t0;
+    }
+}
+
+//
+// mergeSeries
+//
+int mergeSeries(Series *s, int nt, UINT64 *merged)
+{
+    int nb = 0;
+    for (int b = 0; b < MAXBUCKET; b++) {
+        merged[b] = 0;
+        for (int thread = 0; thread < nt; thread++)
+            merged[b] += s[thread].n[b];
+        if (merged[b])
+            nb = b + 1;
+    }
+    return nb;
+}
+
+//
+// seriesStats
+//
+// the first half of a run is taken as warmup, the last bucket is dropped as it is only
+// partly filled; steady is the mean ops/s of the rest and cv its coefficient of variation
+//
+void seriesStats(UINT64 *merged, int nb, UINT ms, double &steady, double &cv)
+{
+    int lo = nb / 2;
+    int hi = nb - 1;
+    steady = cv = 0;
+    if (hi <= lo)
+        return;
+    double sum = 0, sum2 = 0;
+    for (int b = lo; b < hi; b++) {
+        sum += (double) merged[b];
+        sum2 += (double) merged[b] * merged[b];
+    }
+    double mean = sum / (hi - lo);
+    double var = sum2 / (hi - lo) - mean * mean;
+    steady = mean * 1000 / ms;
+    cv = mean > 0 ? 100 * sqrt(var > 0 ? var : 0) / mean : 0;
+}
+
+UINT64 gapStart;                                // TSC when the run's intervals started
+
+//
+// resetGaps
+//
+void resetGaps(Gap *g, int nt)
+{
+    UINT64 t = __rdtsc();
+    gapStart = t;
+    for (int thread = 0; thread < nt; thread++) {
+        g[thread].last = t;
+        g[thread].max = 0;
+    }
+}
+
+//
+// closeGaps
+//
+// a thread starved until the run deadline (ms after resetGaps) has an open interval, which is
+// closed at the deadline rather than now so the wait for slower threads to exit isn't counted
+//
+void closeGaps(Gap *g, int nt, UINT ms)
+{
+    UINT64 end = gapStart + ms * getTSCTicksPerMS();
+    for (int thread = 0; thread < nt; thread++) {
+        if (g[thread].last < end && end - g[thread].last > g[thread].max)
+            g[thread].max = end - g[thread].last;
+    }
+}
+
+//
+// ticksToUS
+//
+UINT64 ticksToUS(UINT64 ticks)
+{
+    return ticks * 1000 / getTSCTicksPerMS();
+}
+
+//
+// fairStats
+//
+// Jain's index (sum x)^2 / (n * sum x^2) is 1 when every thread does the same number of ops
+// and 1/n when one thread does them all
+//
+double fairStats(UINT64 *n, int nt, UINT64 &min, UINT64 &max, double &cv)
+{
+    double sum = 0, sum2 = 0;
+    min = max = n[0];
+    for (int thread = 0; thread < nt; thread++) {
+        if (n[thread] < min)
+            min = n[thread];
+        if (n[thread] > max)
+            max = n[thread];
+        sum += (double) n[thread];
+        sum2 += (double) n[thread] * n[thread];
+    }
+    double mean = sum / nt;
+    double var = sum2 / nt - mean * mean;
+    cv = mean > 0 ? 100 * sqrt(var > 0 ? var : 0) / mean : 0;
+    return sum2 > 0 ? sum * sum / (nt * sum2) : 1;
+}
+
 locale *commaLocale = NULL;
 
 //
@@ -129,6 +129,7 @@ extern size_t getMemUse();                                          // get worki
 extern size_t getVMUse();                                           // get page file usage {joj 10/5/14}
 
 extern UINT64 getWallClockMS();                                     // get wall clock in milliseconds from some epoch
+extern UINT64 getWallClockUS();                                     // get wall clock in microseconds from some epoch
 extern void createThread(THREADH*, WORKERF, void*);                 //
 extern void runThreadOnCPU(UINT);                                   // run thread on CPU {joj 25/7/14}
 extern void waitForThreadsToFinish(UINT, THREADH*);                 // {joj 25/7/14}
@@ -140,6 +141,151 @@ extern UINT64 rand(UINT64&);                                        // {joj 11/5
 extern UINT rand(UINT&);                                            // {joj 3/1/14}
 #endif
 
+//
+// Rng
+//
+// xoshiro256** (Blackman & Vigna) - all 64 output bits are usable, so callers can take
+// independent fields (key, op) from a single draw
+//
+typedef struct {
+    UINT64 s[4];
+} Rng;
+
+extern UINT64 splitmix64(UINT64&);                                  // splitmix64 step
+extern void seedRng(Rng&, UINT64, UINT);                            // stream n of master seed
+
+inline UINT64 nextRng(Rng &r)
+{
+    UINT64 x = r.s[1] * 5;
+    UINT64 v = ((x << 7) | (x >> 57)) * 9;
+    UINT64 t = r.s[1] << 17;
+    r.s[2] ^= r.s[0];
+    r.s[3] ^= r.s[1];
+    r.s[1] ^= r.s[2];
+    r.s[0] ^= r.s[3];
+    r.s[2] ^= t;
+    r.s[3] = (r.s[3] << 45) | (r.s[3] >> 19);
+    return v;
+}
+
+//
+// trace files
+//
+// a trace file is a raw array of fixed width TraceOp records (no header), one file per thread
+//
+typedef struct {
+    UINT key;
+    UINT op;                                                        // 0 remove, 1 add, 2 lookup, 3 scan, 4 range remove
+} TraceOp;
+
+#define TRACEBUF    4096                                            // records buffered by a TraceWriter
+
+typedef struct {
+    FILE *f;
+    UINT n;
+    TraceOp buf[TRACEBUF];
+} TraceWriter;
+
+extern TraceOp* mapTrace(const char*, size_t&);                     // map trace read only, returns NULL if no file
+extern void unmapTrace(TraceOp*, size_t);                           //
+extern int openTrace(TraceWriter&, const char*);                    // returns 0 if file can't be created
+extern void flushTrace(TraceWriter&);                               //
+extern void closeTrace(TraceWriter&);                               //
+
+inline void recordOp(TraceWriter &w, UINT key, UINT op)
+{
+    w.buf[w.n].key = key;
+    w.buf[w.n].op = op;
+    if (++w.n == TRACEBUF)
+        flushTrace(w);
+}
+
+//
+// image files
+//
+// an image file is written at explicit offsets so several threads can write their own parts
+// at once, and is mapped back without reading it (pages are faulted in as they are touched)
+//
+#define IMAGEPAGE   4096                                            // image header size, records start page aligned
+
+extern INT64 createImage(const char*, size_t);                      // create file of given size, returns -1 on error
+extern int writeImage(INT64, const void*, size_t, size_t);          // write bytes at offset, returns 0 on error
+extern void closeImage(INT64);                                      //
+extern void* mapImage(const char*, int, size_t&);                   // map whole file read only, or copy on write if cow, NULL if no file
+extern void unmapImage(void*, size_t);                              //
+
+//
+// node pool
+//
+// fixed size objects carved from one pre-faulted region, each thread allocates from its own
+// chunk and keeps its own free list; falls back to malloc once the region is used up
+//
+#define PAGES4K     0                                               // normal pages (THP disabled)
+#define PAGESTHP    1                                               // transparent huge pages
+#define PAGESHUGE   2                                               // MAP_HUGETLB, needs reserved huge pages
+
+extern const char *pagesName[];                                     // "4K", "THP", "HUGETLB"
+extern int poolInit(size_t, size_t, int);                           // object size, region bytes, pages wanted - returns pages used
+extern void* poolAlloc(size_t);                                     //
+extern void poolFree(void*);                                        //
+extern void poolReset();                                            // every object back to the pool, no thread may hold one
+
+extern int openDTLBMissCounter();                                   // DTLB load misses of this and later threads, -1 if unavailable
+extern void startCounter(int);                                      // reset and enable
+extern UINT64 stopCounter(int);                                     // disable and read
+extern UINT64 getPageFaults();                                      // page faults of process so far
+
+//
+// time series
+//
+// each thread adds its completed ops to the TSC time bucket they finished in, buckets are
+// merged per run; ops after MAXBUCKET buckets go in the last bucket
+//
+#define MAXBUCKET   1024
+
+class Series {
+    public:
+        ALIGN(64) UINT64 t0;                                        // TSC at start of run
+        UINT64 tick;                                                // TSC ticks per bucket
+        UINT64 n[MAXBUCKET];                                        // ops completed in each bucket
+};
+
+extern UINT64 getTSCTicksPerMS();                                   // calibrated against getWallClockUS on first call
+extern void resetSeries(Series*, int, UINT);                        // zero nt series, start now with ms buckets
+extern int mergeSeries(Series*, int, UINT64*);                      // sum nt series into merged, returns # buckets used
+extern void seriesStats(UINT64*, int, UINT, double&, double&);      // steady state ops/s and cv % of the second half
+
+inline void recordSeries(Series &s, UINT64 ops)
+{
+    UINT64 b = (__rdtsc() - s.t0) / s.tick;
+    s.n[b < MAXBUCKET ? b : MAXBUCKET - 1] += ops;
+}
+
+//
+// fairness
+//
+// each thread keeps the TSC of its last completed op and its longest op-free interval in its
+// own cache line; an interval still open at the run deadline counts up to the deadline
+//
+class Gap {
+    public:
+        ALIGN(64) UINT64 last;                                      // TSC when last op completed
+        UINT64 max;                                                 // longest op-free interval (ticks)
+};
+
+extern void resetGaps(Gap*, int);                                   // start nt threads' intervals now
+extern void closeGaps(Gap*, int, UINT);                             // end nt threads' open intervals at the run deadline (ms)
+extern UINT64 ticksToUS(UINT64);                                    // TSC ticks to microseconds
+extern double fairStats(UINT64*, int, UINT64&, UINT64&, double&);   // min, max and cv % of nt counts, returns Jain's index
+
+inline void recordGap(Gap &g)
+{
+    UINT64 t = __rdtsc();
+    if (t - g.last > g.max)
+        g.max = t - g.last;
+    g.last = t;
+}
+
 extern int cpu64bit();                                              // return 1 if CPU is 64 bit
 extern int cpuFamily();                                             // CPU family
 extern int cpuModel();                                              // CPU model
@@ -0,0 +1,1086 @@
+//
+// sharing.cpp
+//
+// Copyright (C) 2013 - 2015 jones@scss.tcd.ie
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software Foundation;
+// either version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// 19/11/12 first version
+// 19/11/12 works with Win32 and x64
+// 21/11/12 works with Character Set: Not Set, Unicode Character Set or Multi-Byte Character
+// 21/11/12 output results so they can be easily pasted into a spreadsheet from console
+// 24/12/12 increment using (0) non atomic increment (1) InterlockedIncrement64 (2) InterlockedCompareExchange
+// 12/07/13 increment using (3) RTM (restricted transactional memory)
+// 18/07/13 added performance counters
+// 27/08/13 choice of 32 or 64 bit counters (32 bit can oveflow if run time longer than a couple of seconds)
+// 28/08/13 extended struct Result
+// 16/09/13 linux support (needs g++ 4.8 or later)
+// 21/09/13 added getWallClockMS()
+// 12/10/13 Visual Studio 2013 RC
+// 12/10/13 added FALSESHARING
+// 14/10/14 added USEPMS
+//
+
+//
+// NB: hints for pasting from console window
+// NB: Edit -> Select All followed by Edit -> Copy
+// NB: paste into Excel using paste "Use Text Import Wizard" option and select "/" as the delimiter
+//
+
+#include "stdafx.h"                             // pre-compiled headers
+#include <iostream>
+#include <iomanip>                              // setprecision
+#include "helper.h"
+#include <math.h>
+#include <fstream> 
+
+using namespace std;
+
+#define K           1024
+#define GB          (K*K*K)
+#define NOPS        1000
+#define NSECONDS    1                           // run each test for NSECONDS
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define TRACE       0                           // 0 generate ops, 1 generate and record ops, 2 replay ops from trace files
+#define TRACEFILE   "trace%d.bin"               // trace file of thread %d
+#define PREFILL     0                           // % of key range loaded before each run
+#define READPCT     0                           // % of ops that are lookups
+#define SCANPCT     0                           // % of ops that are range scans
+#define RDELPCT     0                           // % of ops that are range removes
+#define SCANLEN     16                          // key range covered by a scan or range remove
+#define LOOKUP      2                           // op: 0 remove, 1 add, 2 lookup, 3 scan, 4 range remove
+#define SCAN        3
+#define RDEL        4
+#define NOPTYPE     5                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | ((READPCT > 0 || TRACE == 2) << LOOKUP) | ((SCANPCT > 0 || TRACE == 2) << SCAN) | ((RDELPCT > 0 || TRACE == 2) << RDEL))
+
+#define NPART       16                          // key range partitions, each with its own lock in PART mode
+#define MAXATTEMPTS 8                           // transaction attempts before taking the lock
+#define EPOCHMS     10                          // controller samples the counters every EPOCHMS
+#define ABORTPCT    50                          // leave RTM mode if more than ABORTPCT% of transactions abort
+#define WAITPCT     30                          // leave LOCK mode if threads spend more than WAITPCT% of the epoch waiting
+#define PROBE       20                          // re-measure a mode that hasn't run for PROBE epochs
+#define HYST        10                          // switch to a mode measured HYST% faster than the current one
+
+#define RTM         0                           // modes
+#define LOCK        1
+#define PART        2
+#define NMODE       3
+
+#define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
+
+UINT64 tstart;                                  // start of test in ms
+int sharing;
+int lineSz;                                     // cache line size
+int maxThread;                                  // max # of threads
+
+THREADH *threadH;                               // thread handles
+UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+const char *modeName[NMODE] = {"rtm", "lock", "part"};
+
+class Node {
+    public:
+        INT64 volatile key;
+        Node* volatile left;
+        Node* volatile right;
+        Node() {key = 0; right = left = NULL;} // default constructor
+};
+
+//
+// Part
+//
+// sub tree holding one partition of the key range, the lock is only used in PART mode
+//
+class Part {
+    public:
+        ALIGN(64) Node* volatile root;
+        volatile long lock;
+};
+
+//
+// AdaptStats
+//
+// per thread state read by the controller, one cache line each
+//
+class AdaptStats {
+    public:
+        ALIGN(64) volatile long busy;           // 1 while the thread is in an op
+        volatile UINT64 ops;                    // ops completed
+        volatile UINT64 starts;                 // transactions started
+        volatile UINT64 aborts;                 // transactions aborted
+        volatile UINT64 wait;                   // TSC ticks spent waiting for a lock
+};
+
+//
+// BST
+//
+// the tree is a forest of NPART sub trees, one per contiguous partition of the key range, so
+// switching mode never restructures it. The mode only decides how an op is synchronised:
+//
+// RTM  - op runs in a transaction that reads lock, falling back to taking lock
+// LOCK - op takes lock
+// PART - op takes the lock of each partition it touches, in partition order
+//
+// ops in different modes must not overlap, so a mode switch waits for quiescence: the
+// controller sets switching, waits until no thread is busy, changes mode and clears switching
+//
+class BST {
+    public:
+        Part part[NPART];
+        ALIGN(64) volatile long lock; // global lock, used in LOCK mode and as the RTM fallback
+        ALIGN(64) volatile int mode;
+        volatile int switching; // set while the controller waits for quiescence
+        AdaptStats *stats; // [thread]
+        int nthread;
+        UINT range; // key range of current run
+        BST() {for (int i = 0; i < NPART; i++) {part[i].root = NULL; part[i].lock = 0;} lock = 0; mode = LOCK; switching = 0; stats = NULL; nthread = 0; range = 1;} // default constructor
+        int partOf(INT64 key) {return (int) ((UINT64) key * NPART / range);}
+        INT64 partLo(int i) {return (INT64) (((UINT64) i * range + NPART - 1) / NPART);} // smallest key in partition i
+        int enter(int thread); // announce op, returns mode to run it in
+        void leave(int thread) {stats[thread].busy = 0;}
+        void setMode(int m); // quiescence protocol, controller only
+        int execute(int thread, int op, INT64 key, INT64 hi, Node *n, INT64 *buf, int max); // run op in current mode
+        int apply(int op, INT64 key, INT64 hi, Node *n, INT64 *buf, int max); // op body, caller has synchronised
+        int add(int thread, Node *nn); // add node to tree, returns 0 if key already present
+        int remove(int thread, INT64 key); // remove key from tree, returns 0 if key not present
+        int contains(int thread, INT64 key); // 1 if key in tree
+        int scan(int thread, INT64 lo, INT64 hi, INT64 *buf, int max); // copy keys in [lo, hi] to buf in order
+        int removeRange(int thread, INT64 lo, INT64 hi); // remove keys in [lo, hi]
+        int addCS(Part *p, Node *nn);
+        int removeCS(Part *p, INT64 key);
+        int containsCS(Part *p, INT64 key);
+        int scanCS(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max);
+        int removeRangeCS(Part *p, INT64 lo, INT64 hi);
+        void acquire(volatile long *l, int thread); // TATAS, counts ticks spent waiting
+        void destroy(Node *p); // free sub tree
+        void clear(); // free every node, tree must be quiescent
+};
+
+BST *BinarySearchTree = new BST;
+
+thread_local Node *garbage;                     // nodes unlinked by the current op, freed once it completes
+
+//
+// acquire
+//
+void BST::acquire(volatile long *l, int thread)
+{
+    if (InterlockedExchange(l, 1) == 0)
+        return;
+    UINT64 t0 = __rdtsc();
+    do {
+        do {
+            _mm_pause();
+        } while (*l == 1);
+    } while (InterlockedExchange(l, 1) == 1);
+    stats[thread].wait += __rdtsc() - t0;
+}
+
+//
+// enter
+//
+// the exchange makes busy visible before switching is read (a thread and the controller
+// can't both miss each other), so once the controller has seen busy == 0 for every thread
+// no op can start in the old mode
+//
+int BST::enter(int thread)
+{
+    AdaptStats *s = &stats[thread];
+    while (1) {
+        InterlockedExchange(&s->busy, 1);
+        if (!switching)
+            return mode;
+        s->busy = 0;
+        while (switching)
+            _mm_pause();
+    }
+}
+
+//
+// setMode
+//
+void BST::setMode(int m)
+{
+    InterlockedExchange(&switching, 1);
+    for (int thread = 0; thread < nthread; thread++) {
+        while (stats[thread].busy)
+            _mm_pause();
+    }
+    mode = m;
+    switching = 0;
+}
+
+//
+// addCS
+//
+int BST::addCS(Part *p, Node *n)
+{
+    Node* volatile* volatile pp = &p->root;
+    Node* volatile q = p->root;
+    while (q) {
+        if (n->key < q->key) {
+            pp = &q->left;
+        } else if (n->key > q->key) {
+            pp = &q->right;
+        } else {
+            return 0;
+        }
+        q = *pp;
+    }
+    *pp = n;
+    return 1;
+}
+
+//
+// removeCS
+//
+// the unlinked node goes on garbage rather than being freed inside a transaction
+//
+int BST::removeCS(Part *p, INT64 key)
+{
+    Node* volatile* volatile pp = &p->root;
+    Node* volatile q = p->root;
+    while (q) {
+        if (key < q->key) {
+            pp = &q->left;
+        } else if (key > q->key) {
+            pp = &q->right;
+        } else {
+            break;
+        }
+        q = *pp;
+    }
+    if (q == NULL)
+        return 0;
+    if (q->left == NULL) {
+        *pp = q->right;
+    } else if (q->right == NULL) {
+        *pp = q->left;
+    } else {
+        Node* volatile* volatile sp = &q->right; // replace with successor
+        Node *s = q->right;
+        while (s->left) {
+            sp = &s->left;
+            s = s->left;
+        }
+        *sp = s->right;
+        s->left = q->left;
+        s->right = q->right;
+        *pp = s;
+    }
+    q->left = garbage;
+    garbage = q;
+    return 1;
+}
+
+//
+// containsCS
+//
+int BST::containsCS(Part *p, INT64 key)
+{
+    Node* volatile q = p->root;
+    while (q && q->key != key)
+        q = (key < q->key) ? q->left : q->right;
+    return q != NULL;
+}
+
+//
+// scanCS
+//
+// in order walk of the sub tree rooted at p, appending keys in [lo, hi] to buf
+//
+int BST::scanCS(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max)
+{
+    if (p == NULL || n == max)
+        return n;
+    if (lo < p->key)
+        n = scanCS(p->left, lo, hi, buf, n, max);
+    if (n < max && lo <= p->key && p->key <= hi)
+        buf[n++] = p->key;
+    if (p->key < hi)
+        n = scanCS(p->right, lo, hi, buf, n, max);
+    return n;
+}
+
+//
+// removeRangeCS
+//
+// [lo, hi] is clipped to the keys partition p can hold
+//
+int BST::removeRangeCS(Part *p, INT64 lo, INT64 hi)
+{
+    int i = (int) (p - part);
+    lo = max(lo, partLo(i));
+    hi = min(hi, partLo(i + 1) - 1);
+    int n = 0;
+    for (INT64 key = lo; key <= hi; key++)
+        n += removeCS(p, key);
+    return n;
+}
+
+//
+// apply
+//
+// range ops visit each partition that overlaps [key, hi] in key order
+//
+int BST::apply(int op, INT64 key, INT64 hi, Node *n, INT64 *buf, int max)
+{
+    switch (op) {
+        case 0:
+            return removeCS(&part[partOf(key)], key);
+        case 1:
+            return addCS(&part[partOf(key)], n);
+        case LOOKUP:
+            return containsCS(&part[partOf(key)], key);
+        case SCAN: {
+            int cnt = 0;
+            for (int i = partOf(key); i <= partOf(hi); i++)
+                cnt = scanCS(part[i].root, key, hi, buf, cnt, max);
+            return cnt;
+        }
+        case RDEL: {
+            int cnt = 0;
+            for (int i = partOf(key); i <= partOf(hi); i++)
+                cnt += removeRangeCS(&part[i], key, hi);
+            return cnt;
+        }
+    }
+    return 0;
+}
+
+//
+// execute
+//
+int BST::execute(int thread, int op, INT64 key, INT64 hi, Node *n, INT64 *buf, int max)
+{
+    AdaptStats *s = &stats[thread];
+    int r = 0;
+    if (hi >= range)
+        hi = range - 1;
+    garbage = NULL;
+    int m = enter(thread);
+    if (m == PART) {
+        int first = partOf(key);
+        int last = (op == SCAN || op == RDEL) ? partOf(hi) : first;
+        for (int i = first; i <= last; i++)
+            acquire(&part[i].lock, thread);
+        r = apply(op, key, hi, n, buf, max);
+        for (int i = last; i >= first; i--)
+            part[i].lock = 0;
+    } else {
+        int done = 0;
+        if (m == RTM) {
+            int attempts = 0;
+            while (attempts++ < MAXATTEMPTS) {
+                s->starts++;
+                UINT status = _xbegin();
+                if (status == _XBEGIN_STARTED) {
+                    if (lock)
+                        _xabort(0xA0);
+                    r = apply(op, key, hi, n, buf, max);
+                    _xend();
+                    done = 1;
+                    break;
+                }
+                s->aborts++;
+                if (status & _XABORT_CAPACITY)
+                    break;
+                while (lock)
+                    _mm_pause();
+            }
+        }
+        if (!done) {
+            acquire(&lock, thread);
+            r = apply(op, key, hi, n, buf, max);
+            lock = 0;
+        }
+    }
+    s->ops++;
+    leave(thread);
+    while (garbage) {
+        Node *q = garbage;
+        garbage = q->left;
+        delete q;
+    }
+    return r;
+}
+
+int BST::add(int thread, Node *n)
+{
+    return execute(thread, 1, n->key, n->key, n, NULL, 0);
+}
+
+int BST::remove(int thread, INT64 key)
+{
+    return execute(thread, 0, key, key, NULL, NULL, 0);
+}
+
+int BST::contains(int thread, INT64 key)
+{
+    return execute(thread, LOOKUP, key, key, NULL, NULL, 0);
+}
+
+int BST::scan(int thread, INT64 lo, INT64 hi, INT64 *buf, int max)
+{
+    return execute(thread, SCAN, lo, hi, NULL, buf, max);
+}
+
+int BST::removeRange(int thread, INT64 lo, INT64 hi)
+{
+    return execute(thread, RDEL, lo, hi, NULL, NULL, 0);
+}
+
+void BST::destroy(Node *p)
+{
+    if (p) {
+        destroy(p->left);
+        destroy(p->right);
+        delete p;
+    }
+}
+
+void BST::clear()
+{
+    for (int i = 0; i < NPART; i++) {
+        destroy(part[i].root);
+        part[i].root = NULL;
+    }
+}
+
+//
+// Controller
+//
+// epoch by epoch view of the counters, kept by the controller thread
+//
+typedef struct {
+    int rtm;                                    // 1 if RTM mode allowed
+    double score[NMODE];                        // ops per ms when mode last ran (0 = not measured)
+    int age[NMODE];                             // epochs since mode last ran
+    UINT64 ops, starts, aborts, wait;           // counter totals at start of epoch
+    UINT64 tsc;                                 // TSC at start of epoch
+    int epochs[NMODE];                          // # epochs spent in each mode this run
+    int switches;                               // # mode switches this run
+} Controller;
+
+Controller ctl;
+volatile int running;                           // cleared by main once the workers have finished
+
+//
+// startMode
+//
+// reset the controller for a new run, every mode starts unmeasured so each is probed once
+//
+void startMode(int nt, UINT range)
+{
+    BST *t = BinarySearchTree;
+    memset(ctl.score, 0, sizeof(ctl.score));
+    memset(ctl.epochs, 0, sizeof(ctl.epochs));
+    for (int m = 0; m < NMODE; m++)
+        ctl.age[m] = PROBE;
+    ctl.ops = ctl.starts = ctl.aborts = ctl.wait = 0;
+    ctl.switches = 0;
+    memset(t->stats, 0, nt*sizeof(AdaptStats));
+    t->nthread = nt;
+    t->range = range;
+    t->mode = ctl.rtm ? RTM : LOCK;
+    ctl.age[t->mode] = 0;
+}
+
+//
+// decide
+//
+// pick the mode for the next epoch from the last epoch's abort rate, lock wait and throughput
+// returns the current mode to stay, reason is set if switching
+//
+int decide(double tput, double abortPct, double waitPct, const char *&reason)
+{
+    int cur = BinarySearchTree->mode;
+    reason = NULL;
+    ctl.score[cur] = tput;
+    for (int m = 0; m < NMODE; m++)
+        ctl.age[m] = (m == cur) ? 0 : ctl.age[m] + 1;
+    int best = cur;
+    for (int m = 0; m < NMODE; m++) {
+        if ((m != RTM || ctl.rtm) && ctl.score[m] > ctl.score[best])
+            best = m;
+    }
+    if (cur == RTM && abortPct > ABORTPCT) {
+        reason = "aborts";
+        return ctl.score[PART] >= ctl.score[LOCK] ? PART : LOCK;
+    }
+    if (cur == LOCK && waitPct > WAITPCT) {
+        reason = "lock wait";
+        return PART;
+    }
+    for (int m = 0; m < NMODE; m++) {
+        if ((m != RTM || ctl.rtm) && ctl.age[m] >= PROBE) {
+            reason = "probe";
+            return m;
+        }
+    }
+    if (ctl.score[best] > ctl.score[cur] * (100 + HYST) / 100) {
+        reason = "throughput";
+        return best;
+    }
+    return cur;
+}
+
+//
+// controller
+//
+// every EPOCHMS, sum the per thread counters, decide and switch mode if needed
+// every switch is appended to switchAdaptive.txt
+//
+WORKER controller(void *)
+{
+    BST *t = BinarySearchTree;
+    ofstream log;
+    log.open("switchAdaptive.txt", ios_base::app);
+    ctl.tsc = __rdtsc();
+    while (running) {
+        Sleep(EPOCHMS);
+        UINT64 ops = 0, starts = 0, aborts = 0, wait = 0;
+        for (int thread = 0; thread < t->nthread; thread++) {
+            ops += t->stats[thread].ops;
+            starts += t->stats[thread].starts;
+            aborts += t->stats[thread].aborts;
+            wait += t->stats[thread].wait;
+        }
+        UINT64 tsc = __rdtsc();
+        UINT64 dOps = ops - ctl.ops, dStarts = starts - ctl.starts, dAborts = aborts - ctl.aborts, dWait = wait - ctl.wait;
+        double tput = (double) dOps / EPOCHMS;
+        double abortPct = dStarts ? 100.0 * dAborts / dStarts : 0;
+        double waitPct = 100.0 * dWait / ((double) (tsc - ctl.tsc) * t->nthread);
+        int cur = t->mode;
+        ctl.epochs[cur]++;
+        const char *reason;
+        int m = decide(tput, abortPct, waitPct, reason);
+        if (m != cur) {
+            t->setMode(m);
+            ctl.switches++;
+            log << t->range << ", " << t->nthread << ", " << getWallClockMS() - tstart << ", ";
+            log << modeName[cur] << ", " << modeName[m] << ", " << reason << ", ";
+            log << fixed << setprecision(0) << tput << ", ";
+            log << fixed << setprecision(1) << abortPct << ", " << waitPct << endl;
+        }
+        ctl.ops = ops;
+        ctl.starts = starts;
+        ctl.aborts = aborts;
+        ctl.wait = wait;
+        ctl.tsc = __rdtsc();
+    }
+    log.close();
+    return 0;
+}
+
+//
+// buildPart
+//
+// link sorted keys into a balanced sub tree
+//
+Node *buildPart(INT64 *key, int lo, int hi)
+{
+    if (lo > hi)
+        return NULL;
+    int mid = lo + (hi - lo) / 2;
+    Node *n = new Node;
+    n->key = key[mid];
+    n->left = buildPart(key, lo, mid - 1);
+    n->right = buildPart(key, mid + 1, hi);
+    return n;
+}
+
+//
+// prefill
+//
+// load PREFILL% of the keys in [0, range), evenly spaced so the shape is the same every run,
+// each partition gets a balanced sub tree of its keys
+//
+void prefill(UINT range)
+{
+    BST *t = BinarySearchTree;
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    INT64 *key = new INT64[n];
+    for (int i = 0; i < n; i++)
+        key[i] = (UINT64) i * range / n;
+    t->range = range;
+    int lo = 0;
+    for (int p = 0; p < NPART; p++) {
+        int hi = lo;
+        while (hi < n && t->partOf(key[hi]) == p)
+            hi++;
+        t->part[p].root = buildPart(key, lo, hi - 1);
+        lo = hi;
+    }
+    delete[] key;
+}
+
+typedef struct {
+    int sharing;                                // sharing
+    int nt;                                     // # threads
+    UINT64 rt;                                  // run time (ms)
+    UINT64 ops;                                 // ops
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+    int switches;                               // # mode switches
+    int epochs[NMODE];                          // # epochs in each mode
+} Result;
+
+Result *r;                                      // results
+UINT indx;                                      // results index
+
+//
+// OpStats
+//
+// per thread op counts by type, own cache line
+// an op is effective if it inserts, removes or finds a key, or is a range op that hits at least
+// one key, so op - eff counts duplicate adds, removes of absent keys and lookup misses
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this thread's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "add/s", "get/s", "scan/s", "rdel/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s", "hit/s", "hit/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+thread_local INT64 *scanBuf;                    // keys returned by scan
+
+void runOp(int thread, UINT randomValue, UINT randomBit) {
+    if (randomBit == LOOKUP) {
+        countOp(LOOKUP, BinarySearchTree->contains(thread, randomValue));
+        return;
+    }
+    if (randomBit == SCAN) {
+        countOp(SCAN, BinarySearchTree->scan(thread, randomValue, randomValue + SCANLEN - 1, scanBuf, SCANLEN));
+        return;
+    }
+    if (randomBit == RDEL) {
+        countOp(RDEL, BinarySearchTree->removeRange(thread, randomValue, randomValue + SCANLEN - 1));
+        return;
+    }
+    if (randomBit) {
+        Node *addNode = new Node;
+        addNode->key = randomValue;
+        addNode->left = NULL;
+        addNode->right = NULL;
+        int r = BinarySearchTree->add(thread, addNode);
+        if (r == 0)
+            delete addNode;
+        countOp(1, r);
+    }
+    else {
+        countOp(0, BinarySearchTree->remove(thread, randomValue));
+    }
+}
+#if TRACE == 2
+TraceOp **trace;                                // mapped trace files, thread t replays trace[t % ntrace]
+size_t *ntraceOp;                               // # records in each trace
+int ntrace;                                     // # trace files
+
+//
+// loadTrace
+//
+// map trace files 0, 1, 2, ... up to the first missing one
+//
+void loadTrace()
+{
+    char fn[64];
+    trace = new TraceOp*[maxThread];
+    ntraceOp = new size_t[maxThread];
+    for (ntrace = 0; ntrace < maxThread; ntrace++) {
+        sprintf(fn, TRACEFILE, ntrace);
+        if ((trace[ntrace] = mapTrace(fn, ntraceOp[ntrace])) == NULL)
+            break;
+        for (size_t i = 0; i < ntraceOp[ntrace]; i++) {
+            if (trace[ntrace][i].op >= NOPTYPE) {
+                cout << fn << ": bad op " << trace[ntrace][i].op << " in record " << i << endl;
+                quit(1);
+            }
+        }
+    }
+    if (ntrace == 0) {
+        cout << "no trace file " << fn << endl;
+        quit(1);
+    }
+}
+#endif
+
+//
+// worker
+//
+WORKER worker(void *vthread)
+{
+    int thread = (int)((size_t) vthread);
+
+    UINT64 n = 0;
+
+    runThreadOnCPU(thread % ncpu);
+
+    Rng rng;
+    seedRng(rng, SEED, thread);
+    UINT randomValue;
+    UINT randomBit;
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+#if TRACE == 1
+    char fn[64];
+    sprintf(fn, TRACEFILE, thread);
+    TraceWriter *tw = new TraceWriter;
+    openTrace(*tw, fn);
+#elif TRACE == 2
+    TraceOp *tp = trace[thread % ntrace];
+    TraceOp *te = tp + ntraceOp[thread % ntrace];
+#endif
+
+    scanBuf = new INT64[SCANLEN];
+
+    while (1) {
+        for(int y=0; y<NOPS; y++) {
+#if TRACE == 2
+            randomValue = tp->key & keyMask;            // fold recorded key into key range
+            randomBit = tp->op;
+            if (++tp == te)
+                tp = trace[thread % ntrace];            // wrap
+#else
+            UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+            randomBit = (UINT) (r >> 63);
+#if READPCT + SCANPCT + RDELPCT > 0
+            UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+            if (pct < READPCT)
+                randomBit = LOOKUP;
+            else if (pct < READPCT + SCANPCT)
+                randomBit = SCAN;
+            else if (pct < READPCT + SCANPCT + RDELPCT)
+                randomBit = RDEL;
+#endif
+            randomValue = (UINT) r & keyMask;
+#if TRACE == 1
+            recordOp(*tw, randomValue, randomBit);
+#endif
+#endif
+            runOp(thread, randomValue, randomBit);
+#if GAPS
+            recordGap(*gap);
+#endif
+        }
+        n += NOPS;
+        recordSeries(series[thread], NOPS);
+        //
+        // check if runtime exceeded
+        //
+        if ((getWallClockMS() - tstart) > NSECONDS*1000)
+            break;
+    }
+    delete[] scanBuf;
+#if TRACE == 1
+    closeTrace(*tw);
+    delete tw;
+#endif
+    ops[thread] = n;
+    return 0;
+}
+//
+// main
+//
+int main()
+{
+    ncpu = getNumberOfCPUs();   // number of logical CPUs
+    maxThread = 2 * ncpu;       // max number of threads
+#if TRACE == 2
+    loadTrace();                // replay traces
+#endif
+    ctl.rtm = rtmSupported();   // RTM mode only if the CPU has RTM
+    //
+    // get date
+    //
+    char dateAndTime[256];
+    getDateAndTime(dateAndTime, sizeof(dateAndTime));
+    //
+    // get cache info
+    //
+    lineSz = getCacheLineSz();
+    //
+    // allocate global variable
+    //
+    // NB: per thread counts are cache line aligned to stop false sharing
+    //
+    threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
+    ops = (UINT64*) ALIGNED_MALLOC(maxThread*sizeof(UINT64), lineSz);                   // for ops per thread
+
+    opStats = (OpStats*) ALIGNED_MALLOC(maxThread*sizeof(OpStats), 64);                 // op counts per thread
+    series = (Series*) ALIGNED_MALLOC(maxThread*sizeof(Series), 64);                    // time series per thread
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+    gaps = (Gap*) ALIGNED_MALLOC(maxThread*sizeof(Gap), 64);                            // op-free intervals per thread
+    BinarySearchTree->stats = (AdaptStats*) ALIGNED_MALLOC(maxThread*sizeof(AdaptStats), 64);  // controller counters per thread
+
+    r = (Result*) ALIGNED_MALLOC(5*maxThread*sizeof(Result), lineSz);                   // for results
+    memset(r, 0, 5*maxThread*sizeof(Result));                                        // zero
+
+    indx = 0;
+    //
+    // use thousands comma separator
+    //
+    setCommaLocale();
+    //
+    // header
+    //
+    cout << setw(13) << "BST";
+    cout << setw(10) << "nt";
+    cout << setw(10) << "rt";
+    cout << setw(20) << "ops";
+    cout << setw(10) << "rel";
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+    cout << setw(6) << "sw";
+    for (int m = 0; m < NMODE; m++)
+        cout << setw(7) << modeName[m] << "%";
+    cout << endl;
+
+    cout << setw(13) << "---";       // random count
+    cout << setw(10) << "--";        // nt
+    cout << setw(10) << "--";        // rt
+    cout << setw(20) << "---";       // ops
+    cout << setw(10) << "---";       // rel
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+    cout << setw(6) << "--";
+    for (int m = 0; m < NMODE; m++)
+        cout << setw(8) << "-----";
+    cout << endl;
+
+    //
+    // run tests
+    //
+    UINT64 ops1 = 1;
+
+    for (sharing = 0; sharing < 5; sharing++) {
+        for (int nt = 1; nt <= maxThread; nt+=1, indx++) {
+            //
+            //  zero shared memory
+            //
+            memset(opStats, 0, nt*sizeof(OpStats));
+            startMode(nt, (UINT) pow(16, sharing+1));
+#if PREFILL > 0
+            prefill((UINT) pow(16, sharing+1));
+#endif
+            //
+            // get start time
+            //
+            resetSeries(series, nt, BUCKETMS);
+#if GAPS
+            resetGaps(gaps, nt);
+#endif
+            tstart = getWallClockMS();
+            //
+            // create worker threads
+            //
+            running = 1;
+            for (int thread = 0; thread < nt; thread++)
+                createThread(&threadH[thread], worker, (void*)(size_t)thread);
+            THREADH controllerH;
+            createThread(&controllerH, controller, NULL);
+            //
+            // wait for ALL worker threads to finish
+            //
+            waitForThreadsToFinish(nt, threadH);
+            UINT64 rt = getWallClockMS() - tstart;
+            int nb = mergeSeries(series, nt, merged);
+            seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+            r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+            closeGaps(gaps, nt, NSECONDS*1000);
+            for (int thread = 0; thread < nt; thread++)
+                r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+            running = 0;
+            waitForThreadsToFinish(1, &controllerH);
+            closeThread(controllerH);
+            BinarySearchTree->clear();
+
+            //
+            // save results and output summary to console
+            //
+            for (int thread = 0; thread < nt; thread++) {
+                r[indx].ops += ops[thread];
+                for (int op = 0; op < NOPTYPE; op++) {
+                    r[indx].op[op] += opStats[thread].op[op];
+                    r[indx].eff[op] += opStats[thread].eff[op];
+                }
+            }
+            if ((sharing == 0) && (nt == 1))
+                ops1 = r[indx].ops;
+            r[indx].sharing = sharing;
+            r[indx].nt = nt;
+            r[indx].rt = rt;
+            r[indx].switches = ctl.switches;
+            int epochs = 0;
+            for (int m = 0; m < NMODE; m++) {
+                r[indx].epochs[m] = ctl.epochs[m];
+                epochs += ctl.epochs[m];
+            }
+
+            cout << setw(13) << pow(16,sharing+1);
+            cout << setw(10) << nt;
+            cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
+            cout << setw(20) << r[indx].ops;
+            cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+            UINT64 eff = 0;
+            for (int op = 0; op < NOPTYPE; op++)
+                eff += r[indx].eff[op];
+            cout << setw(14) << r[indx].ops * 1000 / rt;
+            cout << setw(14) << eff * 1000 / rt;
+            cout << setw(14) << (UINT64) r[indx].steady;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+            cout << setw(12) << r[indx].minOps;
+            cout << setw(12) << r[indx].maxOps;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+            cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            cout << setw(10) << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++) {
+                if (OPCOLS & (1 << op)) {
+                    cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                    cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                }
+            }
+            cout << setw(6) << r[indx].switches;
+            for (int m = 0; m < NMODE; m++)
+                cout << setw(8) << fixed << setprecision(2) << (epochs ? 100.0 * r[indx].epochs[m] / epochs : 0.0);
+            cout << endl;
+
+            ofstream metrics;
+            metrics.open("metricsAdaptive.txt", ios_base::app);
+
+            metrics << pow(16,sharing+1) << ", ";
+            metrics << nt << ", ";
+            metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
+            metrics << r[indx].ops << ", ";
+            metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1;
+            metrics << ", " << eff;
+            metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+            metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+            metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            metrics << ", " << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++)
+                metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+            metrics << ", " << r[indx].switches;
+            for (int m = 0; m < NMODE; m++)
+                metrics << ", " << r[indx].epochs[m];
+            metrics << endl;
+
+            metrics.close();
+
+            ofstream buckets;
+            buckets.open("seriesAdaptive.txt", ios_base::app);
+            buckets << pow(16,sharing+1) << ", ";
+            buckets << nt << ", " << BUCKETMS;
+            for (int b = 0; b < nb; b++)
+                buckets << ", " << merged[b];
+            buckets << endl;
+            buckets.close();
+
+            ofstream fair;
+            fair.open("fairAdaptive.txt", ios_base::app);
+            fair << pow(16,sharing+1) << ", ";
+            fair << nt;
+            for (int thread = 0; thread < nt; thread++) {
+                fair << ", " << ops[thread];
+#if GAPS
+                fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+            }
+            fair << endl;
+            fair.close();
+
+            if (r[indx].jain < MINJAIN) {
+                cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                quit(1);
+            }
+
+            //
+            // delete thread handles
+            //
+            for (int thread = 0; thread < nt; thread++) {
+                closeThread(threadH[thread]);
+            }
+        }
+    }
+
+    cout << endl;
+    quit();
+
+    return 0;
+
+}
+
+// eof
\ No newline at end of file
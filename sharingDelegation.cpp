@@ -0,0 +1,1037 @@
+//
+// sharing.cpp
+//
+// Copyright (C) 2013 - 2015 jones@scss.tcd.ie
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software Foundation;
+// either version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// 19/11/12 first version
+// 19/11/12 works with Win32 and x64
+// 21/11/12 works with Character Set: Not Set, Unicode Character Set or Multi-Byte Character
+// 21/11/12 output results so they can be easily pasted into a spreadsheet from console
+// 24/12/12 increment using (0) non atomic increment (1) InterlockedIncrement64 (2) InterlockedCompareExchange
+// 12/07/13 increment using (3) RTM (restricted transactional memory)
+// 18/07/13 added performance counters
+// 27/08/13 choice of 32 or 64 bit counters (32 bit can oveflow if run time longer than a couple of seconds)
+// 28/08/13 extended struct Result
+// 16/09/13 linux support (needs g++ 4.8 or later)
+// 21/09/13 added getWallClockMS()
+// 12/10/13 Visual Studio 2013 RC
+// 12/10/13 added FALSESHARING
+// 14/10/14 added USEPMS
+//
+
+//
+// NB: hints for pasting from console window
+// NB: Edit -> Select All followed by Edit -> Copy
+// NB: paste into Excel using paste "Use Text Import Wizard" option and select "/" as the delimiter
+//
+
+#include "stdafx.h"                             // pre-compiled headers
+#include <iostream>
+#include <iomanip>                              // setprecision
+#include "helper.h"
+#include <math.h>
+#include <fstream> 
+
+using namespace std;
+
+#define K           1024
+#define GB          (K*K*K)
+#define NOPS        1000
+#define NSECONDS    1                           // run each test for NSECONDS
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define TRACE       0                           // 0 generate ops, 1 generate and record ops, 2 replay ops from trace files
+#define TRACEFILE   "trace%d.bin"               // trace file of thread %d
+#define PREFILL     0                           // % of key range bulk loaded before each run
+#define NSERVER     1                           // # server threads, each owns a key range partition
+#define NINFLIGHT   4                           // outstanding requests per client per server (<= 4 fits a cache line)
+#define SCANPCT     0                           // % of ops that are range scans
+#define RDELPCT     0                           // % of ops that are range removes
+#define SCANLEN     16                          // key range covered by a scan or range remove
+#define LOOKUP      2                           // op: 0 remove, 1 add, 2 lookup, 3 scan, 4 range remove
+#define SCAN        3
+#define RDEL        4
+#define NOPTYPE     5                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | ((TRACE == 2) << LOOKUP) | ((SCANPCT > 0 || TRACE == 2) << SCAN) | ((RDELPCT > 0 || TRACE == 2) << RDEL))
+
+#define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
+
+UINT64 tstart;                                  // start of test in ms
+int sharing;
+int lineSz;                                     // cache line size
+int maxThread;                                  // max # of threads
+
+THREADH *threadH;                               // thread handles
+THREADH *serverH;                               // server thread handles
+UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+//ALIGN(64) volatile long lock = 0;
+
+class Node {
+    public:
+        INT64 volatile key;
+        Node* volatile left;
+        Node* volatile right;
+        Node() {key = 0; right = left = NULL;} // default constructor
+};
+
+//
+// BST
+//
+// owned exclusively by one server thread so no lock is needed
+//
+class BST {
+    public:
+        Node* volatile root; // root of BST, initially NULL
+        Node *bulk; // node block of last bulkLoad
+        int nbulk;
+        BST() {root = NULL; bulk = NULL; nbulk = 0;} // default constructor
+        void bulkLoad(INT64 *key, int n, int nt); // replace tree with balanced tree of sorted keys
+        int inBulk(Node *p) {return p >= bulk && p < bulk + nbulk;} // node in bulk block, not individually freed
+        int add(INT64 key); // add key to tree
+        void destroy(volatile Node *nextNode);
+        int remove(INT64 key); // remove key from tree
+        int contains(INT64 key); // 1 if key in tree
+        int scan(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max); // append keys in [lo, hi] to buf
+        int removeRange(INT64 lo, INT64 hi); // remove keys in [lo, hi]
+};
+
+//
+// Request
+//
+// client -> server mailbox, written only by the client, one cache line
+// slot i is outstanding while seq[i] differs from the matching Response seq[i]
+//
+class Request {
+    public:
+        ALIGN(64) volatile INT64 key[NINFLIGHT];
+        volatile int add[NINFLIGHT];            // 1 = add, 0 = remove, LOOKUP
+        volatile UINT seq[NINFLIGHT];           // bumped by client to issue
+};
+
+//
+// Response
+//
+// server -> client mailbox, written only by the server, one cache line
+//
+class Response {
+    public:
+        ALIGN(64) volatile UINT seq[NINFLIGHT]; // set to Request seq when served
+        volatile int result[NINFLIGHT];         // 1 if op changed the tree or key found
+};
+
+//
+// RangeRequest
+//
+// client -> server mailbox for scans and range removes, one op outstanding per client
+// a range spanning several partitions is sent to each of the servers involved
+//
+class RangeRequest {
+    public:
+        ALIGN(64) volatile INT64 lo;
+        volatile INT64 hi;
+        INT64* volatile buf;                    // where scan puts keys
+        volatile int max;                       // size of buf
+        volatile int op;                        // SCAN or RDEL
+        volatile int parts;                     // # servers involved
+        volatile UINT seq;                      // bumped by client to issue
+};
+
+//
+// RangeResponse
+//
+class RangeResponse {
+    public:
+        ALIGN(64) volatile UINT seq;            // set to RangeRequest seq when served
+        volatile int result;                    // # keys scanned or removed by this server
+};
+
+//
+// Span
+//
+// coordinates the servers of a range op that spans partitions, only one such op at a time
+// (spanLock): each server parks when it sees its part, and once all have parked (at which
+// point the op takes effect) they apply their parts in key order, appending to the buffer
+//
+class Span {
+    public:
+        ALIGN(64) volatile long lock;           // held by client for the duration of the op
+        ALIGN(64) volatile int arrived;         // # servers parked
+        volatile int turn;                      // next part to apply
+        volatile int count;                     // keys appended to scan buffer so far
+};
+
+BST *serverTree;                                // one tree per server
+RangeRequest *rangeRequest;                     // [client*NSERVER + server]
+RangeResponse *rangeResponse;                   // [client*NSERVER + server]
+Span span;
+Request *request;                               // [client*NSERVER + server]
+Response *response;                             // [client*NSERVER + server]
+volatile int nclient;                           // # clients in current run
+volatile int stop;                              // set when clients have finished
+UINT range;                                     // key range of current run
+
+//
+// add
+//
+// server allocates the node so the tree stays in memory touched by the server only
+//
+int BST::add(INT64 key)
+{
+    Node* volatile* volatile pp = &root;
+    Node* volatile p = root;
+    while (p) {
+        if (key < p->key) {
+            pp = &p->left;
+        } else if (key > p->key) {
+            pp = &p->right;
+        } else {
+            return 0;
+        }
+        p = *pp;
+    }
+    Node *n = new Node;
+    n->key = key;
+    *pp = n;
+    return 1;
+}
+
+//
+// contains
+//
+int BST::contains(INT64 key)
+{
+    Node* volatile p = root;
+    while (p && p->key != key)
+        p = (key < p->key) ? p->left : p->right;
+    return p != NULL;
+}
+
+//
+// remove
+//
+// no concurrent readers so the unlinked node can be freed immediately
+//
+int BST::remove(INT64 key)
+{
+    Node* volatile* volatile pp = &root;
+    Node* volatile p = root;
+    while (p) {
+        if (key < p->key) {
+            pp = &p->left;
+        } else if (key > p->key) {
+            pp = &p->right;
+        } else {
+            break;
+        }
+        p = *pp;
+    }
+    if (p == NULL)
+        return 0;
+    if (p->left == NULL && p->right == NULL) {
+        *pp = NULL; // NO children
+    } else if (p->left == NULL) {
+        *pp = p->right; // ONE child
+    } else if (p->right == NULL) {
+        *pp = p->left; // ONE child
+    } else {
+        Node *r = p->right; // TWO children
+        Node* volatile* volatile ppr = &p->right; // find min key in right sub tree
+        while (r->left) {
+            ppr = &r->left;
+            r = r->left;
+        }
+        p->key = r->key; // could move...
+        p = r; // node instead
+        *ppr = r->right;
+    }
+    if (!inBulk(p))
+        delete p;
+    return 1;
+}
+
+//
+// scan
+//
+// in order walk of the part of sub tree p that can hold keys in [lo, hi]
+// keys are appended to buf starting at buf[n], returns new n (at most max)
+//
+int BST::scan(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max)
+{
+    while (p && n < max) {
+        if (p->key > lo)
+            n = scan(p->left, lo, hi, buf, n, max);
+        if (p->key >= lo && p->key <= hi && n < max)
+            buf[n++] = p->key;
+        if (p->key >= hi)
+            break;
+        p = p->right;
+    }
+    return n;
+}
+
+//
+// removeRange
+//
+// repeatedly find a node with a key in [lo, hi] and remove it
+// returns # keys removed
+//
+int BST::removeRange(INT64 lo, INT64 hi)
+{
+    int n = 0;
+    while (1) {
+        Node* volatile p = root;
+        while (p && (p->key < lo || p->key > hi))
+            p = (p->key < lo) ? p->right : p->left;
+        if (p == NULL)
+            return n;
+        n += remove(p->key);
+    }
+}
+
+void BST::destroy(volatile Node *nextNode)
+{
+    if (nextNode != NULL)
+    {
+        destroy(nextNode->left);
+        destroy(nextNode->right);
+    }
+}
+
+//
+// BulkTask
+//
+// sub tree of a bulk load built by one thread
+//
+typedef struct {
+    INT64 *key;                                 // sorted keys
+    Node *node;                                 // node[i] holds key[i]
+    int lo;                                     // sub tree holds key[lo] .. key[hi-1]
+    int hi;
+    Node* volatile *pp;                         // where to link the sub tree's root
+} BulkTask;
+
+//
+// buildBalanced
+//
+// returns root of a perfectly balanced tree of key[lo] .. key[hi-1]
+//
+Node *buildBalanced(INT64 *key, Node *node, int lo, int hi)
+{
+    if (lo >= hi)
+        return NULL;
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    p->left = buildBalanced(key, node, lo, mid);
+    p->right = buildBalanced(key, node, mid + 1, hi);
+    return p;
+}
+
+//
+// splitBulk
+//
+// build the top levels of the tree and queue the sub trees below them as tasks
+//
+void splitBulk(INT64 *key, Node *node, int lo, int hi, Node* volatile *pp, int levels, BulkTask *task, int &ntask)
+{
+    if (lo >= hi) {
+        *pp = NULL;
+        return;
+    }
+    if (levels == 0) {
+        BulkTask *t = &task[ntask++];
+        t->key = key;
+        t->node = node;
+        t->lo = lo;
+        t->hi = hi;
+        t->pp = pp;
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    *pp = p;
+    splitBulk(key, node, lo, mid, &p->left, levels - 1, task, ntask);
+    splitBulk(key, node, mid + 1, hi, &p->right, levels - 1, task, ntask);
+}
+
+//
+// bulkWorker
+//
+WORKER bulkWorker(void *vtask)
+{
+    BulkTask *t = (BulkTask*) vtask;
+    *t->pp = buildBalanced(t->key, t->node, t->lo, t->hi);
+    return 0;
+}
+
+//
+// bulkLoad
+//
+// replace the tree with a perfectly balanced tree of n sorted distinct keys in O(n)
+// nodes come from one contiguous block (node i holds key i, so in order is memory order)
+// which is freed by the next bulkLoad, sub trees below the top levels are built by nt threads
+// no other thread may be using the tree
+//
+void BST::bulkLoad(INT64 *key, int n, int nt)
+{
+    if (bulk)
+        AFREE(bulk);
+    bulk = n ? (Node*) AMALLOC(n*sizeof(Node), 64) : NULL;
+    nbulk = n;
+    int levels = 0;
+    while ((1 << levels) < nt)
+        levels++;
+    BulkTask *task = new BulkTask[1 << levels];
+    THREADH *h = new THREADH[1 << levels];
+    int ntask = 0;
+    splitBulk(key, bulk, 0, n, &root, levels, task, ntask);
+    for (int i = 0; i < ntask; i++)
+        createThread(&h[i], bulkWorker, &task[i]);
+    waitForThreadsToFinish(ntask, h);
+    for (int i = 0; i < ntask; i++)
+        closeThread(h[i]);
+    delete[] h;
+    delete[] task;
+}
+
+//
+// serverOf
+//
+// servers own contiguous key ranges so each tree stays ordered
+//
+inline int serverOf(UINT key)
+{
+    return (int) ((UINT64) key * NSERVER / range);
+}
+
+//
+// serverCPU
+//
+// servers are pinned to the highest numbered CPUs, clients to the rest
+//
+inline UINT serverCPU(int server)
+{
+    return (ncpu - 1 - server % ncpu);
+}
+
+inline UINT clientCPU(int thread)
+{
+    return (ncpu > NSERVER) ? thread % (ncpu - NSERVER) : thread % ncpu;
+}
+
+//
+// prefill
+//
+// bulk load PREFILL% of the keys in [0, range), evenly spaced so the shape is the same
+// every run, each server's tree gets the keys in its partition
+//
+void prefill()
+{
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    INT64 *key = new INT64[n];
+    for (int i = 0; i < n; i++)
+        key[i] = (UINT64) i * range / n;
+    int lo = 0;
+    for (int server = 0; server < NSERVER; server++) {
+        int hi = lo;
+        while (hi < n && serverOf((UINT) key[hi]) == server)
+            hi++;
+        serverTree[server].bulkLoad(key + lo, hi - lo, ncpu);
+        lo = hi;
+    }
+    delete[] key;
+}
+
+typedef struct {
+    int sharing;                                // sharing
+    int nt;                                     // # threads
+    UINT64 rt;                                  // run time (ms)
+    UINT64 ops;                                 // ops
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+} Result;
+
+Result *r;                                      // results
+UINT indx;                                      // results index
+
+//
+// OpStats
+//
+// per thread op counts by type, own cache line
+// an op is effective if it inserts, removes or finds a key, or is a range op that hits at least
+// one key, so op - eff counts duplicate adds, removes of absent keys and lookup misses
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this thread's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "add/s", "get/s", "scan/s", "rdel/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s", "hit/s", "hit/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+//
+// runRangeOp
+//
+// send a scan or range remove to every server whose partition overlaps [lo, hi] and wait
+// for all the parts, returns # keys scanned or removed
+//
+int runRangeOp(int thread, int op, INT64 lo, INT64 hi, INT64 *buf, int max) {
+    if (hi >= range)
+        hi = range - 1;
+    int first = serverOf(lo);
+    int last = serverOf(hi);
+    int parts = last - first + 1;
+    if (parts > 1) {
+        while (InterlockedExchange(&span.lock, 1) == 1) {
+            do {
+                _mm_pause();
+            } while (span.lock == 1);
+        }
+        span.arrived = 0;
+        span.turn = 0;
+        span.count = 0;
+    }
+    for (int server = first; server <= last; server++) {
+        RangeRequest *rq = &rangeRequest[thread*NSERVER + server];
+        rq->lo = lo;
+        rq->hi = hi;
+        rq->buf = buf;
+        rq->max = max;
+        rq->op = op;
+        rq->parts = parts;
+        rq->seq = rq->seq + 1; // issue last
+    }
+    int n = 0;
+    for (int server = first; server <= last; server++) {
+        RangeRequest *rq = &rangeRequest[thread*NSERVER + server];
+        RangeResponse *rs = &rangeResponse[thread*NSERVER + server];
+        while (rs->seq != rq->seq)
+            _mm_pause();
+        n += rs->result;
+    }
+    if (parts > 1)
+        span.lock = 0;
+    return n;
+}
+
+//
+// serveRange
+//
+// apply this server's part of a range op, parking first if the op spans partitions
+//
+void serveRange(int server, BST *tree, RangeRequest *rq, RangeResponse *rs) {
+    int parts = rq->parts;
+    int part = server - serverOf(rq->lo);
+    int n;
+    if (parts > 1) {
+        InterlockedIncrement(&span.arrived);
+        while (span.arrived < parts || span.turn != part)
+            _mm_pause();
+    }
+    if (rq->op == SCAN) {
+        int start = (parts > 1) ? span.count : 0;
+        n = tree->scan(tree->root, rq->lo, rq->hi, rq->buf, start, rq->max) - start;
+    } else {
+        n = tree->removeRange(rq->lo, rq->hi);
+    }
+    if (parts > 1) {
+        span.count = span.count + n;
+        span.turn = part + 1;
+    }
+    rs->result = n;
+    rs->seq = rq->seq;
+}
+
+thread_local int nextSlot[NSERVER];             // round robin in flight slot per server
+thread_local int issued[NSERVER][NINFLIGHT];    // 1 if slot holds an op of this run not yet counted
+thread_local INT64 *scanBuf;                    // keys returned by scan
+
+//
+// runOp
+//
+// issue op in the next slot of the server's mailbox, first waiting for the slot's
+// previous request to be served so a client keeps at most NINFLIGHT ops in flight per server
+// the previous request's outcome is counted when its slot is reused or drained
+//
+void runOp(int thread, UINT randomValue, UINT randomBit) {
+    if (randomBit == SCAN || randomBit == RDEL) {
+        countOp(randomBit, runRangeOp(thread, randomBit, randomValue, randomValue + SCANLEN - 1, scanBuf, SCANLEN));
+        return;
+    }
+    int server = serverOf(randomValue);
+    Request *rq = &request[thread*NSERVER + server];
+    Response *rs = &response[thread*NSERVER + server];
+    int i = nextSlot[server];
+    while (rs->seq[i] != rq->seq[i])
+        _mm_pause();
+    if (issued[server][i])
+        countOp(rq->add[i], rs->result[i]);
+    rq->key[i] = randomValue;
+    rq->add[i] = randomBit;
+    rq->seq[i] = rq->seq[i] + 1; // issue last
+    issued[server][i] = 1;
+    nextSlot[server] = (i + 1) % NINFLIGHT;
+}
+
+//
+// drain
+//
+// wait for all of the client's outstanding requests to be served
+//
+void drain(int thread) {
+    for (int server = 0; server < NSERVER; server++) {
+        Request *rq = &request[thread*NSERVER + server];
+        Response *rs = &response[thread*NSERVER + server];
+        for (int i = 0; i < NINFLIGHT; i++) {
+            while (rs->seq[i] != rq->seq[i])
+                _mm_pause();
+            if (issued[server][i])
+                countOp(rq->add[i], rs->result[i]);
+            issued[server][i] = 0;
+        }
+    }
+}
+
+//
+// serverThread
+//
+// poll every client's request line and apply newly issued ops to the server's tree
+//
+WORKER serverThread(void *vserver)
+{
+    int server = (int)((size_t) vserver);
+    BST *tree = &serverTree[server];
+
+    runThreadOnCPU(serverCPU(server));
+
+    while (!stop) {
+        for (int thread = 0; thread < nclient; thread++) {
+            Request *rq = &request[thread*NSERVER + server];
+            Response *rs = &response[thread*NSERVER + server];
+            for (int i = 0; i < NINFLIGHT; i++) {
+                UINT seq = rq->seq[i];
+                if (seq != rs->seq[i]) {
+                    int op = rq->add[i];
+                    rs->result[i] = op == LOOKUP ? tree->contains(rq->key[i]) : op ? tree->add(rq->key[i]) : tree->remove(rq->key[i]);
+                    rs->seq[i] = seq;
+                }
+            }
+            RangeRequest *rrq = &rangeRequest[thread*NSERVER + server];
+            RangeResponse *rrs = &rangeResponse[thread*NSERVER + server];
+            if (rrq->seq != rrs->seq)
+                serveRange(server, tree, rrq, rrs);
+        }
+    }
+    tree->destroy(tree->root); //Recursively destroy BST
+    tree->root = NULL;
+    return 0;
+}
+
+#if TRACE == 2
+TraceOp **trace;                                // mapped trace files, thread t replays trace[t % ntrace]
+size_t *ntraceOp;                               // # records in each trace
+int ntrace;                                     // # trace files
+
+//
+// loadTrace
+//
+// map trace files 0, 1, 2, ... up to the first missing one
+//
+void loadTrace()
+{
+    char fn[64];
+    trace = new TraceOp*[maxThread];
+    ntraceOp = new size_t[maxThread];
+    for (ntrace = 0; ntrace < maxThread; ntrace++) {
+        sprintf(fn, TRACEFILE, ntrace);
+        if ((trace[ntrace] = mapTrace(fn, ntraceOp[ntrace])) == NULL)
+            break;
+        for (size_t i = 0; i < ntraceOp[ntrace]; i++) {
+            if (trace[ntrace][i].op >= NOPTYPE) {
+                cout << fn << ": bad op " << trace[ntrace][i].op << " in record " << i << endl;
+                quit(1);
+            }
+        }
+    }
+    if (ntrace == 0) {
+        cout << "no trace file " << fn << endl;
+        quit(1);
+    }
+}
+#endif
+
+//
+// worker
+//
+WORKER worker(void *vthread)
+{
+    int thread = (int)((size_t) vthread);
+
+    UINT64 n = 0;
+
+    runThreadOnCPU(clientCPU(thread));
+
+    Rng rng;
+    seedRng(rng, SEED, thread);
+    UINT randomValue;
+    UINT randomBit;
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+#if TRACE == 1
+    char fn[64];
+    sprintf(fn, TRACEFILE, thread);
+    TraceWriter *tw = new TraceWriter;
+    openTrace(*tw, fn);
+#elif TRACE == 2
+    TraceOp *tp = trace[thread % ntrace];
+    TraceOp *te = tp + ntraceOp[thread % ntrace];
+#endif
+
+    scanBuf = new INT64[SCANLEN];
+
+    while (1) {
+        for(int y=0; y<NOPS; y++) {
+#if TRACE == 2
+            randomValue = tp->key & keyMask;            // fold recorded key into key range
+            randomBit = tp->op;
+            if (++tp == te)
+                tp = trace[thread % ntrace];            // wrap
+#else
+            UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+            randomBit = (UINT) (r >> 63);
+#if SCANPCT + RDELPCT > 0
+            UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+            if (pct < SCANPCT)
+                randomBit = SCAN;
+            else if (pct < SCANPCT + RDELPCT)
+                randomBit = RDEL;
+#endif
+            randomValue = (UINT) r & keyMask;
+#if TRACE == 1
+            recordOp(*tw, randomValue, randomBit);
+#endif
+#endif
+            runOp(thread, randomValue, randomBit);
+#if GAPS
+            recordGap(*gap);
+#endif
+        }
+        n += NOPS;
+        recordSeries(series[thread], NOPS);
+        //
+        // check if runtime exceeded
+        //
+        if ((getWallClockMS() - tstart) > NSECONDS*1000)
+            break;
+    }
+    drain(thread);
+    delete[] scanBuf;
+#if TRACE == 1
+    closeTrace(*tw);
+    delete tw;
+#endif
+    ops[thread] = n;
+    return 0;
+}
+//
+// main
+//
+int main()
+{
+    ncpu = getNumberOfCPUs();   // number of logical CPUs
+    maxThread = 2 * ncpu;       // max number of threads
+#if TRACE == 2
+    loadTrace();                // replay traces
+#endif
+    //
+    // get date
+    //
+    char dateAndTime[256];
+    getDateAndTime(dateAndTime, sizeof(dateAndTime));
+    //
+    // get cache info
+    //
+    lineSz = getCacheLineSz();
+    //
+    // allocate global variable
+    //
+    // NB: per thread counts are cache line aligned to stop false sharing
+    //
+    threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
+    serverH = (THREADH*) ALIGNED_MALLOC(NSERVER*sizeof(THREADH), lineSz);               // server thread handles
+    ops = (UINT64*) ALIGNED_MALLOC(maxThread*sizeof(UINT64), lineSz);                   // for ops per thread
+
+    opStats = (OpStats*) ALIGNED_MALLOC(maxThread*sizeof(OpStats), 64);                 // op counts per thread
+    series = (Series*) ALIGNED_MALLOC(maxThread*sizeof(Series), 64);                    // time series per thread
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+    gaps = (Gap*) ALIGNED_MALLOC(maxThread*sizeof(Gap), 64);                            // op-free intervals per thread
+
+    r = (Result*) ALIGNED_MALLOC(5*maxThread*sizeof(Result), lineSz);                   // for results
+    memset(r, 0, 5*maxThread*sizeof(Result));                                        // zero
+
+    serverTree = new BST[NSERVER];
+    request = (Request*) ALIGNED_MALLOC(maxThread*NSERVER*sizeof(Request), 64);        // client -> server mailboxes
+    response = (Response*) ALIGNED_MALLOC(maxThread*NSERVER*sizeof(Response), 64);     // server -> client mailboxes
+    memset((void*) request, 0, maxThread*NSERVER*sizeof(Request));
+    memset((void*) response, 0, maxThread*NSERVER*sizeof(Response));
+    rangeRequest = (RangeRequest*) ALIGNED_MALLOC(maxThread*NSERVER*sizeof(RangeRequest), 64);
+    rangeResponse = (RangeResponse*) ALIGNED_MALLOC(maxThread*NSERVER*sizeof(RangeResponse), 64);
+    memset((void*) rangeRequest, 0, maxThread*NSERVER*sizeof(RangeRequest));
+    memset((void*) rangeResponse, 0, maxThread*NSERVER*sizeof(RangeResponse));
+    span.lock = 0;
+
+    indx = 0;
+    //
+    // use thousands comma separator
+    //
+    setCommaLocale();
+    //
+    // header
+    //
+    cout << setw(13) << "BST";
+    cout << setw(10) << "nt";
+    cout << setw(10) << "rt";
+    cout << setw(20) << "ops";
+    cout << setw(10) << "rel";
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+    cout << endl;
+
+    cout << setw(13) << "---";       // random count
+    cout << setw(10) << "--";        // nt
+    cout << setw(10) << "--";        // rt
+    cout << setw(20) << "---";       // ops
+    cout << setw(10) << "---";       // rel
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+    cout << endl;
+
+    //
+    // run tests
+    //
+    UINT64 ops1 = 1;
+
+    for (sharing = 0; sharing < 5; sharing++) {
+        for (int nt = 1; nt <= maxThread; nt+=1, indx++) {
+            //
+            //  zero shared memory
+            //
+            memset(opStats, 0, nt*sizeof(OpStats));
+            //
+            // get start time
+            //
+            resetSeries(series, nt, BUCKETMS);
+#if GAPS
+            resetGaps(gaps, nt);
+#endif
+            tstart = getWallClockMS();
+            //
+            // create server threads
+            //
+            range = (UINT) pow(16, sharing+1);
+#if PREFILL > 0
+            prefill();
+#endif
+            nclient = nt;
+            stop = 0;
+            for (int server = 0; server < NSERVER; server++)
+                createThread(&serverH[server], serverThread, (void*)(size_t)server);
+            //
+            // create worker threads
+            //
+            for (int thread = 0; thread < nt; thread++)
+                createThread(&threadH[thread], worker, (void*)(size_t)thread);
+            //
+            // wait for ALL worker threads to finish
+            //
+            waitForThreadsToFinish(nt, threadH);
+            UINT64 rt = getWallClockMS() - tstart;
+            int nb = mergeSeries(series, nt, merged);
+            seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+            r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+            closeGaps(gaps, nt, NSECONDS*1000);
+            for (int thread = 0; thread < nt; thread++)
+                r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+            stop = 1;
+            waitForThreadsToFinish(NSERVER, serverH);
+
+            //
+            // save results and output summary to console
+            //
+            for (int thread = 0; thread < nt; thread++) {
+                r[indx].ops += ops[thread];
+                for (int op = 0; op < NOPTYPE; op++) {
+                    r[indx].op[op] += opStats[thread].op[op];
+                    r[indx].eff[op] += opStats[thread].eff[op];
+                }
+            }
+            if ((sharing == 0) && (nt == 1))
+                ops1 = r[indx].ops;
+            r[indx].sharing = sharing;
+            r[indx].nt = nt;
+            r[indx].rt = rt;
+
+            cout << setw(13) << pow(16,sharing+1);
+            cout << setw(10) << nt;
+            cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
+            cout << setw(20) << r[indx].ops;
+            cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+            UINT64 eff = 0;
+            for (int op = 0; op < NOPTYPE; op++)
+                eff += r[indx].eff[op];
+            cout << setw(14) << r[indx].ops * 1000 / rt;
+            cout << setw(14) << eff * 1000 / rt;
+            cout << setw(14) << (UINT64) r[indx].steady;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+            cout << setw(12) << r[indx].minOps;
+            cout << setw(12) << r[indx].maxOps;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+            cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            cout << setw(10) << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++) {
+                if (OPCOLS & (1 << op)) {
+                    cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                    cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                }
+            }
+            cout << endl;
+
+            ofstream metrics;
+            metrics.open("metricsDelegation.txt", ios_base::app);
+
+            metrics << pow(16,sharing+1) << ", ";
+            metrics << nt << ", ";
+            metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
+            metrics << r[indx].ops << ", ";
+            metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1;
+            metrics << ", " << eff;
+            metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+            metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+            metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            metrics << ", " << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++)
+                metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+            metrics << endl;
+
+            metrics.close();
+
+            ofstream buckets;
+            buckets.open("seriesDelegation.txt", ios_base::app);
+            buckets << pow(16,sharing+1) << ", ";
+            buckets << nt << ", " << BUCKETMS;
+            for (int b = 0; b < nb; b++)
+                buckets << ", " << merged[b];
+            buckets << endl;
+            buckets.close();
+
+            ofstream fair;
+            fair.open("fairDelegation.txt", ios_base::app);
+            fair << pow(16,sharing+1) << ", ";
+            fair << nt;
+            for (int thread = 0; thread < nt; thread++) {
+                fair << ", " << ops[thread];
+#if GAPS
+                fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+            }
+            fair << endl;
+            fair.close();
+
+            if (r[indx].jain < MINJAIN) {
+                cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                quit(1);
+            }
+
+            //
+            // delete thread handles
+            //
+            for (int thread = 0; thread < nt; thread++) {
+                closeThread(threadH[thread]);
+            }
+            for (int server = 0; server < NSERVER; server++)
+                closeThread(serverH[server]);
+        }
+    }
+
+    cout << endl;
+    quit();
+
+    return 0;
+
+}
+
+// eof
\ No newline at end of file
@@ -0,0 +1,934 @@
+//
+// sharing.cpp
+//
+// Copyright (C) 2013 - 2015 jones@scss.tcd.ie
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software Foundation;
+// either version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// 19/11/12 first version
+// 19/11/12 works with Win32 and x64
+// 21/11/12 works with Character Set: Not Set, Unicode Character Set or Multi-Byte Character
+// 21/11/12 output results so they can be easily pasted into a spreadsheet from console
+// 24/12/12 increment using (0) non atomic increment (1) InterlockedIncrement64 (2) InterlockedCompareExchange
+// 12/07/13 increment using (3) RTM (restricted transactional memory)
+// 18/07/13 added performance counters
+// 27/08/13 choice of 32 or 64 bit counters (32 bit can oveflow if run time longer than a couple of seconds)
+// 28/08/13 extended struct Result
+// 16/09/13 linux support (needs g++ 4.8 or later)
+// 21/09/13 added getWallClockMS()
+// 12/10/13 Visual Studio 2013 RC
+// 12/10/13 added FALSESHARING
+// 14/10/14 added USEPMS
+//
+
+//
+// NB: hints for pasting from console window
+// NB: Edit -> Select All followed by Edit -> Copy
+// NB: paste into Excel using paste "Use Text Import Wizard" option and select "/" as the delimiter
+//
+
+#include "stdafx.h"                             // pre-compiled headers
+#include <iostream>
+#include <iomanip>                              // setprecision
+#include "helper.h"
+#include <math.h>
+#include <fstream> 
+#include <algorithm>                            // sort
+
+using namespace std;
+
+#define K           1024
+#define GB          (K*K*K)
+#define NOPS        1000
+#define NSECONDS    1                           // run each test for NSECONDS
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define TRACE       0                           // 0 generate ops, 1 generate and record ops, 2 replay ops from trace files
+#define TRACEFILE   "trace%d.bin"               // trace file of thread %d
+#define PREFILL     0                           // % of key range bulk loaded before each run
+#define SCANPCT     0                           // % of ops that are range scans
+#define RDELPCT     0                           // % of ops that are range removes
+#define SCANLEN     16                          // key range covered by a scan or range remove
+#define LOOKUP      2                           // op: 0 remove, 1 add, 2 lookup, 3 scan, 4 range remove
+#define SCAN        3
+#define RDEL        4
+#define NOPTYPE     5                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | ((TRACE == 2) << LOOKUP) | ((SCANPCT > 0 || TRACE == 2) << SCAN) | ((RDELPCT > 0 || TRACE == 2) << RDEL))
+
+#define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
+
+UINT64 tstart;                                  // start of test in ms
+int sharing;
+int lineSz;                                     // cache line size
+int maxThread;                                  // max # of threads
+
+THREADH *threadH;                               // thread handles
+UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+//ALIGN(64) volatile long lock = 0;
+
+class Node {
+    public:
+        INT64 volatile key;
+        Node* volatile left;
+        Node* volatile right;
+        Node() {key = 0; right = left = NULL;} // default constructor
+};
+
+//
+// FCSlot
+//
+// per thread publication slot for flat combining
+// ALIGN(64) gives each slot its own cache line so a thread spinning on its pending flag
+// only shares that line with the combiner
+//
+class FCSlot {
+    public:
+        ALIGN(64) Node* volatile n;             // node to link in if add
+        INT64 volatile key;                     // key to add or remove, or low end of range
+        INT64 volatile hi;                      // high end of range
+        INT64* volatile buf;                    // where scan puts keys
+        volatile int op;                        // 0 remove, 1 add, LOOKUP, SCAN, RDEL
+        volatile int max;                       // size of buf
+        volatile int result;                    // set by combiner (1 if add/remove changed the tree or key found, # keys if range op)
+        volatile int pending;                   // set by owner to publish, cleared by combiner
+};
+
+typedef struct {
+    INT64 key;                                  // key of pending request
+    int slot;                                   // slot holding the request
+} FCReq;
+
+inline bool fcReqLess(const FCReq &a, const FCReq &b) {return a.key < b.key;}
+
+class BST {
+    public:
+        Node* volatile root; // root of BST, initially NULL
+        ALIGN(64) volatile long lock;
+        FCSlot *slot; // publication slots, one per thread
+        int nslot;
+        FCReq *req; // combiner's list of pending requests
+        Node *bulk; // node block of last bulkLoad
+        int nbulk;
+        BST() {root = NULL, lock = 0; slot = NULL; nslot = 0; req = NULL; bulk = NULL; nbulk = 0;} // default constructor
+        void bulkLoad(INT64 *key, int n, int nt); // replace tree with balanced tree of sorted keys
+        int inBulk(Node *p) {return p >= bulk && p < bulk + nbulk;} // node in bulk block, not individually freed
+        void init(int n); // allocate n publication slots
+        int add(int thread, Node *nn); // add node to tree
+        void destroy(volatile Node *nextNode);
+        int remove(int thread, INT64 key); // remove key from tree
+        int contains(int thread, INT64 key); // 1 if key in tree
+        int scan(int thread, INT64 lo, INT64 hi, INT64 *buf, int max); // copy keys in [lo, hi] to buf in order
+        int removeRange(int thread, INT64 lo, INT64 hi); // remove keys in [lo, hi]
+        int execute(int thread, int op, INT64 key, INT64 hi, Node *n, INT64 *buf, int max); // publish op and wait for result
+        void combine(); // apply all pending ops, lock held
+        int addCS(Node *nn); // add with lock already held
+        int removeCS(INT64 key); // remove with lock already held
+        int containsCS(INT64 key); // lookup with lock already held
+        int scanCS(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max);
+        int removeRangeCS(INT64 lo, INT64 hi);
+        void releaseTATAS();
+        void acquireTATAS();
+};
+
+BST *BinarySearchTree = new BST;
+
+//
+// BulkTask
+//
+// sub tree of a bulk load built by one thread
+//
+typedef struct {
+    INT64 *key;                                 // sorted keys
+    Node *node;                                 // node[i] holds key[i]
+    int lo;                                     // sub tree holds key[lo] .. key[hi-1]
+    int hi;
+    Node* volatile *pp;                         // where to link the sub tree's root
+} BulkTask;
+
+//
+// buildBalanced
+//
+// returns root of a perfectly balanced tree of key[lo] .. key[hi-1]
+//
+Node *buildBalanced(INT64 *key, Node *node, int lo, int hi)
+{
+    if (lo >= hi)
+        return NULL;
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    p->left = buildBalanced(key, node, lo, mid);
+    p->right = buildBalanced(key, node, mid + 1, hi);
+    return p;
+}
+
+//
+// splitBulk
+//
+// build the top levels of the tree and queue the sub trees below them as tasks
+//
+void splitBulk(INT64 *key, Node *node, int lo, int hi, Node* volatile *pp, int levels, BulkTask *task, int &ntask)
+{
+    if (lo >= hi) {
+        *pp = NULL;
+        return;
+    }
+    if (levels == 0) {
+        BulkTask *t = &task[ntask++];
+        t->key = key;
+        t->node = node;
+        t->lo = lo;
+        t->hi = hi;
+        t->pp = pp;
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    *pp = p;
+    splitBulk(key, node, lo, mid, &p->left, levels - 1, task, ntask);
+    splitBulk(key, node, mid + 1, hi, &p->right, levels - 1, task, ntask);
+}
+
+//
+// bulkWorker
+//
+WORKER bulkWorker(void *vtask)
+{
+    BulkTask *t = (BulkTask*) vtask;
+    *t->pp = buildBalanced(t->key, t->node, t->lo, t->hi);
+    return 0;
+}
+
+//
+// bulkLoad
+//
+// replace the tree with a perfectly balanced tree of n sorted distinct keys in O(n)
+// nodes come from one contiguous block (node i holds key i, so in order is memory order)
+// which is freed by the next bulkLoad, sub trees below the top levels are built by nt threads
+// no other thread may be using the tree
+//
+void BST::bulkLoad(INT64 *key, int n, int nt)
+{
+    if (bulk)
+        AFREE(bulk);
+    bulk = n ? (Node*) AMALLOC(n*sizeof(Node), 64) : NULL;
+    nbulk = n;
+    int levels = 0;
+    while ((1 << levels) < nt)
+        levels++;
+    BulkTask *task = new BulkTask[1 << levels];
+    THREADH *h = new THREADH[1 << levels];
+    int ntask = 0;
+    splitBulk(key, bulk, 0, n, &root, levels, task, ntask);
+    for (int i = 0; i < ntask; i++)
+        createThread(&h[i], bulkWorker, &task[i]);
+    waitForThreadsToFinish(ntask, h);
+    for (int i = 0; i < ntask; i++)
+        closeThread(h[i]);
+    delete[] h;
+    delete[] task;
+}
+
+//
+// init
+//
+void BST::init(int n)
+{
+    slot = (FCSlot*) ALIGNED_MALLOC(n*sizeof(FCSlot), 64);
+    memset((void*) slot, 0, n*sizeof(FCSlot));
+    nslot = n;
+    req = new FCReq[n];
+}
+
+//
+// addCS
+//
+// add critical section, caller must hold the lock
+// returns 1 if n was linked into the tree, 0 if key already present
+//
+int BST::addCS(Node *n)
+{
+    Node* volatile* volatile pp = &root;
+    Node* volatile p = root;
+    while (p) {
+        if (n->key < p->key) {
+            pp = &p->left;
+        } else if (n->key > p->key) {
+            pp = &p->right;
+        } else {
+            return 0;
+        }
+        p = *pp;
+    }
+    *pp = n;
+    return 1;
+}
+
+//
+// containsCS
+//
+// lookup, caller must hold the lock
+//
+int BST::containsCS(INT64 key)
+{
+    Node* volatile p = root;
+    while (p && p->key != key)
+        p = (key < p->key) ? p->left : p->right;
+    return p != NULL;
+}
+
+//
+// removeCS
+//
+// remove critical section, caller must hold the lock
+// returns 1 if key was removed, 0 if key not present
+//
+int BST::removeCS(INT64 key)
+{
+    Node* volatile* volatile pp = &root;
+    Node* volatile p = root;
+    while (p) {
+        if (key < p->key) {
+            pp = &p->left;
+        } else if (key > p->key) {
+            pp = &p->right;
+        } else {
+            break;
+        }
+        p = *pp;
+    }
+    if (p == NULL)
+        return 0;
+    if (p->left == NULL && p->right == NULL) {
+        *pp = NULL; // NO children
+    } else if (p->left == NULL) {
+        *pp = p->right; // ONE child
+    } else if (p->right == NULL) {
+        *pp = p->left; // ONE child
+    } else {
+        Node *r = p->right; // TWO children
+        Node* volatile* volatile ppr = &p->right; // find min key in right sub tree
+        while (r->left) {
+            ppr = &r->left;
+            r = r->left;
+        }
+        p->key = r->key; // could move...
+        p = r; // node instead
+        *ppr = r->right;
+    }
+    return 1;
+}
+
+//
+// scanCS
+//
+// in order walk of the part of sub tree p that can hold keys in [lo, hi]
+// keys are appended to buf starting at buf[n], returns new n (at most max)
+//
+int BST::scanCS(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max)
+{
+    while (p && n < max) {
+        if (p->key > lo)
+            n = scanCS(p->left, lo, hi, buf, n, max);
+        if (p->key >= lo && p->key <= hi && n < max)
+            buf[n++] = p->key;
+        if (p->key >= hi)
+            break;
+        p = p->right;
+    }
+    return n;
+}
+
+//
+// removeRangeCS
+//
+// repeatedly find a node with a key in [lo, hi] and remove it
+// returns # keys removed
+//
+int BST::removeRangeCS(INT64 lo, INT64 hi)
+{
+    int n = 0;
+    while (1) {
+        Node* volatile p = root;
+        while (p && (p->key < lo || p->key > hi))
+            p = (p->key < lo) ? p->right : p->left;
+        if (p == NULL)
+            return n;
+        n += removeCS(p->key);
+    }
+}
+
+//
+// execute
+//
+// publish an op in the thread's slot then, until a combiner has cleared pending, either
+// become the combiner (lock free) or spin on the slot (lock held by another combiner)
+// returns the result written back by the combiner
+//
+int BST::execute(int thread, int op, INT64 key, INT64 hi, Node *n, INT64 *buf, int max)
+{
+    FCSlot *s = &slot[thread];
+    s->n = n;
+    s->key = key;
+    s->hi = hi;
+    s->buf = buf;
+    s->max = max;
+    s->op = op;
+    s->pending = 1; // publish last
+    while (s->pending) {
+        if (lock == 0 && InterlockedExchange(&lock, 1) == 0) {
+            combine();
+            releaseTATAS();
+        } else {
+            _mm_pause();
+        }
+    }
+    return s->result;
+}
+
+//
+// combine
+//
+// collect every pending request, sort by key so consecutive ops reuse the cached upper
+// levels of the search path, apply them and hand the results back through the slots
+//
+void BST::combine()
+{
+    int nreq = 0;
+    for (int i = 0; i < nslot; i++) {
+        if (slot[i].pending) {
+            req[nreq].key = slot[i].key;
+            req[nreq].slot = i;
+            nreq++;
+        }
+    }
+    sort(req, req + nreq, fcReqLess);
+    for (int i = 0; i < nreq; i++) {
+        FCSlot *s = &slot[req[i].slot];
+        switch (s->op) {
+            case 0:
+                s->result = removeCS(s->key);
+                break;
+            case 1:
+                s->result = addCS(s->n);
+                break;
+            case LOOKUP:
+                s->result = containsCS(s->key);
+                break;
+            case SCAN:
+                s->result = scanCS(root, s->key, s->hi, s->buf, 0, s->max);
+                break;
+            case RDEL:
+                s->result = removeRangeCS(s->key, s->hi);
+                break;
+        }
+        s->pending = 0;
+    }
+}
+
+int BST::add(int thread, Node *n)
+{
+    return execute(thread, 1, n->key, 0, n, NULL, 0);
+}
+
+int BST::remove(int thread, INT64 key)
+{
+    return execute(thread, 0, key, 0, NULL, NULL, 0);
+}
+
+int BST::contains(int thread, INT64 key)
+{
+    return execute(thread, LOOKUP, key, 0, NULL, NULL, 0);
+}
+
+//
+// scan
+//
+// range ops are applied by the combiner in one go so they are atomic
+//
+int BST::scan(int thread, INT64 lo, INT64 hi, INT64 *buf, int max)
+{
+    return execute(thread, SCAN, lo, hi, NULL, buf, max);
+}
+
+int BST::removeRange(int thread, INT64 lo, INT64 hi)
+{
+    return execute(thread, RDEL, lo, hi, NULL, NULL, 0);
+}
+
+void BST::destroy(volatile Node *nextNode)
+{
+    if (nextNode != NULL)
+    {
+        destroy(nextNode->left);
+        destroy(nextNode->right);
+    }
+}
+
+void BST::acquireTATAS() {
+    while (InterlockedExchange(&lock, 1) == 1){
+        do {
+            _mm_pause();
+        } while (lock == 1);
+    }
+}
+
+void BST::releaseTATAS() {
+    lock = 0;
+}
+
+//
+// prefill
+//
+// bulk load PREFILL% of the keys in [0, range), evenly spaced so the shape is the same every run
+//
+void prefill(UINT range)
+{
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    INT64 *key = new INT64[n];
+    for (int i = 0; i < n; i++)
+        key[i] = (UINT64) i * range / n;
+    BinarySearchTree->bulkLoad(key, n, ncpu);
+    delete[] key;
+}
+
+typedef struct {
+    int sharing;                                // sharing
+    int nt;                                     // # threads
+    UINT64 rt;                                  // run time (ms)
+    UINT64 ops;                                 // ops
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+} Result;
+
+Result *r;                                      // results
+UINT indx;                                      // results index
+
+//
+// OpStats
+//
+// per thread op counts by type, own cache line
+// an op is effective if it inserts, removes or finds a key, or is a range op that hits at least
+// one key, so op - eff counts duplicate adds, removes of absent keys and lookup misses
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this thread's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "add/s", "get/s", "scan/s", "rdel/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s", "hit/s", "hit/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+thread_local INT64 *scanBuf;                    // keys returned by scan
+
+void runOp(int thread, UINT randomValue, UINT randomBit) {
+    if (randomBit == LOOKUP) {
+        countOp(LOOKUP, BinarySearchTree->contains(thread, randomValue));
+        return;
+    }
+    if (randomBit == SCAN) {
+        countOp(SCAN, BinarySearchTree->scan(thread, randomValue, randomValue + SCANLEN - 1, scanBuf, SCANLEN));
+        return;
+    }
+    if (randomBit == RDEL) {
+        countOp(RDEL, BinarySearchTree->removeRange(thread, randomValue, randomValue + SCANLEN - 1));
+        return;
+    }
+    if (randomBit) {
+        Node *addNode = new Node;
+        addNode->key = randomValue;
+        addNode->left = NULL;
+        addNode->right = NULL;
+        int r = BinarySearchTree->add(thread, addNode);
+        if (r == 0)
+            delete addNode;
+        countOp(1, r);
+    }
+    else {
+        countOp(0, BinarySearchTree->remove(thread, randomValue));
+    }
+}
+#if TRACE == 2
+TraceOp **trace;                                // mapped trace files, thread t replays trace[t % ntrace]
+size_t *ntraceOp;                               // # records in each trace
+int ntrace;                                     // # trace files
+
+//
+// loadTrace
+//
+// map trace files 0, 1, 2, ... up to the first missing one
+//
+void loadTrace()
+{
+    char fn[64];
+    trace = new TraceOp*[maxThread];
+    ntraceOp = new size_t[maxThread];
+    for (ntrace = 0; ntrace < maxThread; ntrace++) {
+        sprintf(fn, TRACEFILE, ntrace);
+        if ((trace[ntrace] = mapTrace(fn, ntraceOp[ntrace])) == NULL)
+            break;
+        for (size_t i = 0; i < ntraceOp[ntrace]; i++) {
+            if (trace[ntrace][i].op >= NOPTYPE) {
+                cout << fn << ": bad op " << trace[ntrace][i].op << " in record " << i << endl;
+                quit(1);
+            }
+        }
+    }
+    if (ntrace == 0) {
+        cout << "no trace file " << fn << endl;
+        quit(1);
+    }
+}
+#endif
+
+//
+// worker
+//
+WORKER worker(void *vthread)
+{
+    int thread = (int)((size_t) vthread);
+
+    UINT64 n = 0;
+
+    runThreadOnCPU(thread % ncpu);
+
+    Rng rng;
+    seedRng(rng, SEED, thread);
+    UINT randomValue;
+    UINT randomBit;
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+#if TRACE == 1
+    char fn[64];
+    sprintf(fn, TRACEFILE, thread);
+    TraceWriter *tw = new TraceWriter;
+    openTrace(*tw, fn);
+#elif TRACE == 2
+    TraceOp *tp = trace[thread % ntrace];
+    TraceOp *te = tp + ntraceOp[thread % ntrace];
+#endif
+
+    scanBuf = new INT64[SCANLEN];
+
+    while (1) {
+        for(int y=0; y<NOPS; y++) {
+#if TRACE == 2
+            randomValue = tp->key & keyMask;            // fold recorded key into key range
+            randomBit = tp->op;
+            if (++tp == te)
+                tp = trace[thread % ntrace];            // wrap
+#else
+            UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+            randomBit = (UINT) (r >> 63);
+#if SCANPCT + RDELPCT > 0
+            UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+            if (pct < SCANPCT)
+                randomBit = SCAN;
+            else if (pct < SCANPCT + RDELPCT)
+                randomBit = RDEL;
+#endif
+            randomValue = (UINT) r & keyMask;
+#if TRACE == 1
+            recordOp(*tw, randomValue, randomBit);
+#endif
+#endif
+            runOp(thread, randomValue, randomBit);
+#if GAPS
+            recordGap(*gap);
+#endif
+        }
+        n += NOPS;
+        recordSeries(series[thread], NOPS);
+        //
+        // check if runtime exceeded
+        //
+        if ((getWallClockMS() - tstart) > NSECONDS*1000)
+            break;
+    }
+    delete[] scanBuf;
+#if TRACE == 1
+    closeTrace(*tw);
+    delete tw;
+#endif
+    ops[thread] = n;
+    BinarySearchTree->destroy(BinarySearchTree->root); //Recursively destroy BST
+    BinarySearchTree->root = NULL;
+    return 0;
+}
+//
+// main
+//
+int main()
+{
+    ncpu = getNumberOfCPUs();   // number of logical CPUs
+    maxThread = 2 * ncpu;       // max number of threads
+#if TRACE == 2
+    loadTrace();                // replay traces
+#endif
+    BinarySearchTree->init(maxThread);  // one publication slot per thread
+    //
+    // get date
+    //
+    char dateAndTime[256];
+    getDateAndTime(dateAndTime, sizeof(dateAndTime));
+    //
+    // get cache info
+    //
+    lineSz = getCacheLineSz();
+    //
+    // allocate global variable
+    //
+    // NB: per thread counts are cache line aligned to stop false sharing
+    //
+    threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
+    ops = (UINT64*) ALIGNED_MALLOC(maxThread*sizeof(UINT64), lineSz);                   // for ops per thread
+
+    opStats = (OpStats*) ALIGNED_MALLOC(maxThread*sizeof(OpStats), 64);                 // op counts per thread
+    series = (Series*) ALIGNED_MALLOC(maxThread*sizeof(Series), 64);                    // time series per thread
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+    gaps = (Gap*) ALIGNED_MALLOC(maxThread*sizeof(Gap), 64);                            // op-free intervals per thread
+
+    r = (Result*) ALIGNED_MALLOC(5*maxThread*sizeof(Result), lineSz);                   // for results
+    memset(r, 0, 5*maxThread*sizeof(Result));                                        // zero
+
+    indx = 0;
+    //
+    // use thousands comma separator
+    //
+    setCommaLocale();
+    //
+    // header
+    //
+    cout << setw(13) << "BST";
+    cout << setw(10) << "nt";
+    cout << setw(10) << "rt";
+    cout << setw(20) << "ops";
+    cout << setw(10) << "rel";
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+    cout << endl;
+
+    cout << setw(13) << "---";       // random count
+    cout << setw(10) << "--";        // nt
+    cout << setw(10) << "--";        // rt
+    cout << setw(20) << "---";       // ops
+    cout << setw(10) << "---";       // rel
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+    cout << endl;
+
+    //
+    // run tests
+    //
+    UINT64 ops1 = 1;
+
+    for (sharing = 0; sharing < 5; sharing++) {
+        for (int nt = 1; nt <= maxThread; nt+=1, indx++) {
+            //
+            //  zero shared memory
+            //
+            memset(opStats, 0, nt*sizeof(OpStats));
+#if PREFILL > 0
+            prefill((UINT) pow(16, sharing+1));
+#endif
+            //
+            // get start time
+            //
+            resetSeries(series, nt, BUCKETMS);
+#if GAPS
+            resetGaps(gaps, nt);
+#endif
+            tstart = getWallClockMS();
+            //
+            // create worker threads
+            //
+            for (int thread = 0; thread < nt; thread++)
+                createThread(&threadH[thread], worker, (void*)(size_t)thread);
+            //
+            // wait for ALL worker threads to finish
+            //
+            waitForThreadsToFinish(nt, threadH);
+            UINT64 rt = getWallClockMS() - tstart;
+            int nb = mergeSeries(series, nt, merged);
+            seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+            r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+            closeGaps(gaps, nt, NSECONDS*1000);
+            for (int thread = 0; thread < nt; thread++)
+                r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+
+            //
+            // save results and output summary to console
+            //
+            for (int thread = 0; thread < nt; thread++) {
+                r[indx].ops += ops[thread];
+                for (int op = 0; op < NOPTYPE; op++) {
+                    r[indx].op[op] += opStats[thread].op[op];
+                    r[indx].eff[op] += opStats[thread].eff[op];
+                }
+            }
+            if ((sharing == 0) && (nt == 1))
+                ops1 = r[indx].ops;
+            r[indx].sharing = sharing;
+            r[indx].nt = nt;
+            r[indx].rt = rt;
+
+            cout << setw(13) << pow(16,sharing+1);
+            cout << setw(10) << nt;
+            cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
+            cout << setw(20) << r[indx].ops;
+            cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+            UINT64 eff = 0;
+            for (int op = 0; op < NOPTYPE; op++)
+                eff += r[indx].eff[op];
+            cout << setw(14) << r[indx].ops * 1000 / rt;
+            cout << setw(14) << eff * 1000 / rt;
+            cout << setw(14) << (UINT64) r[indx].steady;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+            cout << setw(12) << r[indx].minOps;
+            cout << setw(12) << r[indx].maxOps;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+            cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            cout << setw(10) << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++) {
+                if (OPCOLS & (1 << op)) {
+                    cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                    cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                }
+            }
+            cout << endl;
+
+            ofstream metrics;
+            metrics.open("metricsFC.txt", ios_base::app);
+
+            metrics << pow(16,sharing+1) << ", ";
+            metrics << nt << ", ";
+            metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
+            metrics << r[indx].ops << ", ";
+            metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1;
+            metrics << ", " << eff;
+            metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+            metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+            metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            metrics << ", " << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++)
+                metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+            metrics << endl;
+
+            metrics.close();
+
+            ofstream buckets;
+            buckets.open("seriesFC.txt", ios_base::app);
+            buckets << pow(16,sharing+1) << ", ";
+            buckets << nt << ", " << BUCKETMS;
+            for (int b = 0; b < nb; b++)
+                buckets << ", " << merged[b];
+            buckets << endl;
+            buckets.close();
+
+            ofstream fair;
+            fair.open("fairFC.txt", ios_base::app);
+            fair << pow(16,sharing+1) << ", ";
+            fair << nt;
+            for (int thread = 0; thread < nt; thread++) {
+                fair << ", " << ops[thread];
+#if GAPS
+                fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+            }
+            fair << endl;
+            fair.close();
+
+            if (r[indx].jain < MINJAIN) {
+                cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                quit(1);
+            }
+
+            //
+            // delete thread handles
+            //
+            for (int thread = 0; thread < nt; thread++) {
+                closeThread(threadH[thread]);
+            }
+        }
+    }
+
+    cout << endl;
+    quit();
+
+    return 0;
+
+}
+
+// eof
\ No newline at end of file
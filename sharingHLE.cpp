@@ -43,6 +43,7 @@
 #include "helper.h"
 #include <math.h>
 #include <fstream> 
+#include <algorithm>                            // stable_sort
 
 using namespace std;
 
@@ -50,20 +51,29 @@ using namespace std;
 #define GB          (K*K*K)
 #define NOPS        1000
 #define NSECONDS    1                           // run each test for NSECONDS
-
-#define COUNTER64                               // comment for 32 bit counter
-
-#ifdef COUNTER64
-#define VINT    UINT64                          //  64 bit counter
-#else
-#define VINT    UINT                            //  32 bit counter
-#endif
-
-#ifdef FALSESHARING
-#define GINDX(n)    (g+n)
-#else
-#define GINDX(n)    (g+n*lineSz/sizeof(VINT))
-#endif
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define TRACE       0                           // 0 generate ops, 1 generate and record ops, 2 replay ops from trace files
+#define TRACEFILE   "trace%d.bin"               // trace file of thread %d
+#define PREFILL     0                           // % of key range bulk loaded before each run
+#define PAGES       PAGESTHP                    // node pool pages: PAGES4K, PAGESTHP or PAGESHUGE
+#define POOLMB      256                         // node pool size, nodes come from the heap once it is used up
+#define SAMPLE      0                           // probe search path of every SAMPLE-th op (0 = off)
+#define SHAPEMS     100                         // ms between tree shape samples when SAMPLE > 0
+#define MAXDEPTH    64                          // depth histogram buckets (last bucket counts deeper nodes)
+#define MAXREADATTEMPTS 4                       // optimistic lookup attempts before taking the lock
+#define READPCT     0                           // % of ops that are lookups
+#define SCANPCT     0                           // % of ops that are range scans
+#define RDELPCT     0                           // % of ops that are range removes
+#define SCANLEN     16                          // key range covered by a scan or range remove
+#define LOOKUP      2                           // runOp op: 0 remove, 1 add, 2 lookup, 3 scan, 4 range remove
+#define SCAN        3
+#define RDEL        4
+#define NOPTYPE     5                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | ((READPCT > 0 || TRACE == 2) << LOOKUP) | ((SCANPCT > 0 || TRACE == 2) << SCAN) | ((RDELPCT > 0 || TRACE == 2) << RDEL))
+#define BATCHSZ     1                           // ops per BST::applyBatch (1 = one critical section per op)
 
 #define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
 
@@ -74,6 +84,35 @@ int maxThread;                                  // max # of threads
 
 THREADH *threadH;                               // thread handles
 UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+//
+// PathStats
+//
+// search path samples per thread, one cache line each
+//
+class PathStats {
+    public:
+        ALIGN(64) UINT64 n;                     // # ops sampled
+        UINT64 depth;                           // total nodes visited
+        UINT64 lines;                           // total distinct cache lines visited
+};
+
+//
+// ShapeStats
+//
+// tree shape, sampled out of band
+//
+typedef struct {
+    UINT64 nodes;                               // # nodes
+    int height;                                 // # levels
+    UINT64 hist[MAXDEPTH];                      // # nodes at each depth
+} ShapeStats;
+
+PathStats *pathStats;                           // search path samples per thread
+ShapeStats shape;                               // last tree shape sample of run
 
 //ALIGN(64) volatile long lock = 0;
 
@@ -83,45 +122,183 @@ class Node {
         Node* volatile left;
         Node* volatile right;
         Node() {key = 0; right = left = NULL;} // default constructor
+        void* operator new(size_t sz) {return poolAlloc(sz);}
+        void operator delete(void *p) {poolFree(p);}
 };
 
+typedef struct {
+    INT64 key;                                  // key to add or remove
+    int add;                                    // 1 = add, 0 = remove
+    int result;                                 // set to 1 if op changed the tree
+    Node *n;                                    // node to link in if add
+} BatchOp;
+
+inline bool batchOpLess(const BatchOp &a, const BatchOp &b) {return a.key < b.key;}
+
 class BST {
     public:
         Node* volatile root; // root of BST, initially NULL
         ALIGN(64) volatile long lock;
-        BST() {root = NULL, lock = 0;} // default constructor
-        void add(Node *nn); // add node to tree
+        ALIGN(64) volatile UINT64 version; // seqlock, odd while a writer is changing the tree
+        Node *retired; // removed nodes, freed by reclaim()
+        Node *bulk; // node block of last bulkLoad
+        int nbulk;
+        BST() {root = NULL, lock = 0; version = 0; retired = NULL; bulk = NULL; nbulk = 0;} // default constructor
+        void bulkLoad(INT64 *key, int n, int nt); // replace tree with balanced tree of sorted keys
+        int inBulk(Node *p) {return p >= bulk && p < bulk + nbulk;} // node in bulk block, not individually freed
+        int add(Node *nn); // add node to tree, returns 0 if key already present
         void destroy(volatile Node *nextNode);
-        void remove(INT64 key); // remove key from tree
+        int remove(INT64 key); // remove key from tree, returns 0 if key not present
+        int addCS(Node *nn); // add with lock already held
+        int removeCS(INT64 key); // remove with lock already held
+        void applyBatch(BatchOp *op, int n); // apply n ops in one critical section
+        int contains(INT64 key); // optimistic lookup, falls back to the lock
+        int containsCS(INT64 key); // lookup with lock already held
+        int scan(INT64 lo, INT64 hi, INT64 *buf, int max); // copy keys in [lo, hi] to buf in order
+        int scanCS(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max);
+        int removeRange(INT64 lo, INT64 hi); // remove keys in [lo, hi]
+        int removeRangeCS(INT64 lo, INT64 hi);
+        void reclaim(); // free retired nodes, no thread may be in the tree
         void releaseHLE();  //HLE functionality added to BST class
         void acquireHLE();
+        void probe(INT64 key, int &depth, int &lines); // search path of key, no lock
+        int shapeCS(Node *p, int depth, ShapeStats *s); // add sub tree p to shape, returns height
 };
 
 BST *BinarySearchTree = new BST;
 
-void BST::add (Node *n)
+//
+// BulkTask
+//
+// sub tree of a bulk load built by one thread
+//
+typedef struct {
+    INT64 *key;                                 // sorted keys
+    Node *node;                                 // node[i] holds key[i]
+    int lo;                                     // sub tree holds key[lo] .. key[hi-1]
+    int hi;
+    Node* volatile *pp;                         // where to link the sub tree's root
+} BulkTask;
+
+//
+// buildBalanced
+//
+// returns root of a perfectly balanced tree of key[lo] .. key[hi-1]
+//
+Node *buildBalanced(INT64 *key, Node *node, int lo, int hi)
+{
+    if (lo >= hi)
+        return NULL;
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    p->left = buildBalanced(key, node, lo, mid);
+    p->right = buildBalanced(key, node, mid + 1, hi);
+    return p;
+}
+
+//
+// splitBulk
+//
+// build the top levels of the tree and queue the sub trees below them as tasks
+//
+void splitBulk(INT64 *key, Node *node, int lo, int hi, Node* volatile *pp, int levels, BulkTask *task, int &ntask)
+{
+    if (lo >= hi) {
+        *pp = NULL;
+        return;
+    }
+    if (levels == 0) {
+        BulkTask *t = &task[ntask++];
+        t->key = key;
+        t->node = node;
+        t->lo = lo;
+        t->hi = hi;
+        t->pp = pp;
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    *pp = p;
+    splitBulk(key, node, lo, mid, &p->left, levels - 1, task, ntask);
+    splitBulk(key, node, mid + 1, hi, &p->right, levels - 1, task, ntask);
+}
+
+//
+// bulkWorker
+//
+WORKER bulkWorker(void *vtask)
+{
+    BulkTask *t = (BulkTask*) vtask;
+    *t->pp = buildBalanced(t->key, t->node, t->lo, t->hi);
+    return 0;
+}
+
+//
+// bulkLoad
+//
+// replace the tree with a perfectly balanced tree of n sorted distinct keys in O(n)
+// nodes come from one contiguous block (node i holds key i, so in order is memory order)
+// which is freed by the next bulkLoad, sub trees below the top levels are built by nt threads
+// no other thread may be using the tree
+//
+void BST::bulkLoad(INT64 *key, int n, int nt)
+{
+    if (bulk)
+        AFREE(bulk);
+    bulk = n ? (Node*) AMALLOC(n*sizeof(Node), 64) : NULL;
+    nbulk = n;
+    int levels = 0;
+    while ((1 << levels) < nt)
+        levels++;
+    BulkTask *task = new BulkTask[1 << levels];
+    THREADH *h = new THREADH[1 << levels];
+    int ntask = 0;
+    splitBulk(key, bulk, 0, n, &root, levels, task, ntask);
+    for (int i = 0; i < ntask; i++)
+        createThread(&h[i], bulkWorker, &task[i]);
+    waitForThreadsToFinish(ntask, h);
+    for (int i = 0; i < ntask; i++)
+        closeThread(h[i]);
+    delete[] h;
+    delete[] task;
+}
+
+//
+// addCS
+//
+// add critical section, caller must hold the lock
+// returns 1 if n was linked into the tree, 0 if key already present
+//
+int BST::addCS(Node *n)
 {
-    acquireHLE();
     Node* volatile* volatile pp = &root;
     Node* volatile p = root;
     while (p) {
         if (n->key < p->key) {
-        pp = &p->left;
+            pp = &p->left;
         } else if (n->key > p->key) {
             pp = &p->right;
-            } else {
-                releaseHLE();
-                return;
-            }
+        } else {
+            return 0;
+        }
         p = *pp;
     }
+    version++; // odd: writer active
     *pp = n;
-    releaseHLE();
+    version++;
+    return 1;
 }
 
-void BST::remove(INT64 key)
+//
+// removeCS
+//
+// remove critical section, caller must hold the lock
+// returns 1 if key was removed, 0 if key not present
+//
+int BST::removeCS(INT64 key)
 {
-    acquireHLE();
     Node* volatile* volatile pp = &root;
     Node* volatile p = root;
     while (p) {
@@ -129,14 +306,14 @@ void BST::remove(INT64 key)
             pp = &p->left;
         } else if (key > p->key) {
             pp = &p->right;
-            } else {
-                break;
-            }
+        } else {
+            break;
+        }
         p = *pp;
     }
     if (p == NULL)
-        releaseHLE();
-        return;
+        return 0;
+    version++; // odd: writer active
     if (p->left == NULL && p->right == NULL) {
         *pp = NULL; // NO children
     } else if (p->left == NULL) {
@@ -154,7 +331,209 @@ void BST::remove(INT64 key)
         p = r; // node instead
         *ppr = r->right;
     }
+    p->left = retired; // retire, a stale reader may still be looking at p
+    retired = p;
+    version++;
+    return 1;
+}
+
+int BST::add(Node *n)
+{
+    acquireHLE();
+    int r = addCS(n);
     releaseHLE();
+    return r;
+}
+
+int BST::remove(INT64 key)
+{
+    acquireHLE();
+    int r = removeCS(key);
+    releaseHLE();
+    return r;
+}
+
+//
+// containsCS
+//
+// lookup, caller must hold the lock
+//
+int BST::containsCS(INT64 key)
+{
+    Node* volatile p = root;
+    while (p && p->key != key)
+        p = (key < p->key) ? p->left : p->right;
+    return p != NULL;
+}
+
+//
+// contains
+//
+// optimistic lookup that never writes shared memory: read an even version (no writer
+// active), search, then check version is unchanged. After MAXREADATTEMPTS failures take
+// the lock.
+//
+// removed nodes are retired rather than freed until reclaim() is called at a quiescent
+// point so a reader racing a writer only ever follows pointers to valid nodes, and it
+// rechecks version every 64 steps so a writer can't keep it going round a cycle
+//
+int BST::contains(INT64 key)
+{
+    for (int attempt = 0; attempt < MAXREADATTEMPTS; attempt++) {
+        UINT64 v = version;
+        if (v & 1) {
+            _mm_pause();
+            continue;
+        }
+        Node* volatile p = root;
+        int steps = 0;
+        while (p && p->key != key) {
+            p = (key < p->key) ? p->left : p->right;
+            if ((++steps & 63) == 0 && version != v)
+                break;
+        }
+        if (version == v)
+            return p != NULL;
+    }
+    acquireHLE();
+    int found = containsCS(key);
+    releaseHLE();
+    return found;
+}
+
+//
+// reclaim
+//
+void BST::reclaim()
+{
+    while (retired) {
+        Node *p = retired;
+        retired = p->left;
+        if (!inBulk(p))
+            delete p;
+    }
+}
+
+//
+// scanCS
+//
+// in order walk of the part of sub tree p that can hold keys in [lo, hi]
+// keys are appended to buf starting at buf[n], returns new n (at most max)
+//
+int BST::scanCS(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max)
+{
+    while (p && n < max) {
+        if (p->key > lo)
+            n = scanCS(p->left, lo, hi, buf, n, max);
+        if (p->key >= lo && p->key <= hi && n < max)
+            buf[n++] = p->key;
+        if (p->key >= hi)
+            break;
+        p = p->right;
+    }
+    return n;
+}
+
+//
+// removeRangeCS
+//
+// repeatedly find a node with a key in [lo, hi] and remove it
+// returns # keys removed
+//
+int BST::removeRangeCS(INT64 lo, INT64 hi)
+{
+    int n = 0;
+    while (1) {
+        Node* volatile p = root;
+        while (p && (p->key < lo || p->key > hi))
+            p = (p->key < lo) ? p->right : p->left;
+        if (p == NULL)
+            return n;
+        n += removeCS(p->key);
+    }
+}
+
+//
+// scan
+//
+// scans and range removes hold the lock for the whole range so they are atomic
+//
+int BST::scan(INT64 lo, INT64 hi, INT64 *buf, int max)
+{
+    acquireHLE();
+    int n = scanCS(root, lo, hi, buf, 0, max);
+    releaseHLE();
+    return n;
+}
+
+//
+// removeRange
+//
+int BST::removeRange(INT64 lo, INT64 hi)
+{
+    acquireHLE();
+    int n = removeRangeCS(lo, hi);
+    releaseHLE();
+    return n;
+}
+
+//
+// applyBatch
+//
+// sort a thread local batch of ops by key and apply them all in one critical section
+// ops on the same key keep their original order (stable sort)
+// op[i].result is set to 1 if op i changed the tree
+//
+void BST::applyBatch(BatchOp *op, int n)
+{
+    stable_sort(op, op + n, batchOpLess);
+    acquireHLE();
+    for (int i = 0; i < n; i++)
+        op[i].result = op[i].add ? addCS(op[i].n) : removeCS(op[i].key);
+    releaseHLE();
+}
+
+//
+// probe
+//
+// walk the search path of key without the lock recording # nodes and # distinct cache lines
+// visited (a node may straddle two lines). Racy but safe as removed nodes are retired rather
+// than freed during a run, and bounded in case it races a writer.
+//
+void BST::probe(INT64 key, int &depth, int &lines)
+{
+    size_t line[2*MAXDEPTH];
+    depth = lines = 0;
+    Node* volatile p = root;
+    while (p && depth < MAXDEPTH) {
+        size_t l0 = (size_t) p / lineSz;
+        size_t l1 = ((size_t) p + sizeof(Node) - 1) / lineSz;
+        for (size_t l = l0; l <= l1; l++) {
+            int i = 0;
+            while (i < lines && line[i] != l)
+                i++;
+            if (i == lines)
+                line[lines++] = l;
+        }
+        depth++;
+        if (p->key == key)
+            break;
+        p = (key < p->key) ? p->left : p->right;
+    }
+}
+
+//
+// shapeCS
+//
+// caller must hold the lock
+//
+int BST::shapeCS(Node *p, int depth, ShapeStats *s)
+{
+    if (p == NULL)
+        return depth;
+    s->nodes++;
+    s->hist[min(depth, MAXDEPTH - 1)]++;
+    return max(shapeCS(p->left, depth + 1, s), shapeCS(p->right, depth + 1, s));
 }
 
 void BST::destroy(volatile Node *nextNode)
@@ -178,31 +557,199 @@ void BST::releaseHLE() {
     _Store_HLERelease(&lock, 0);
 }
 
+//
+// prefill
+//
+// bulk load PREFILL% of the keys in [0, range), evenly spaced so the shape is the same every run
+//
+void prefill(UINT range)
+{
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    INT64 *key = new INT64[n];
+    for (int i = 0; i < n; i++)
+        key[i] = (UINT64) i * range / n;
+    BinarySearchTree->bulkLoad(key, n, ncpu);
+    delete[] key;
+}
+
+//
+// shapeWorker
+//
+// out of band tree shape sampling, every SHAPEMS ms take the lock and walk the whole tree
+// the last sample of the run is reported
+//
+WORKER shapeWorker(void *)
+{
+    ShapeStats s;
+    while ((getWallClockMS() - tstart) + SHAPEMS < NSECONDS*1000) {
+        Sleep(SHAPEMS);
+        memset(&s, 0, sizeof(s));
+        BinarySearchTree->acquireHLE();
+        s.height = BinarySearchTree->shapeCS(BinarySearchTree->root, 0, &s);
+        BinarySearchTree->releaseHLE();
+        shape = s;
+    }
+    return 0;
+}
+
 typedef struct {
     int sharing;                                // sharing
     int nt;                                     // # threads
     UINT64 rt;                                  // run time (ms)
     UINT64 ops;                                 // ops
-    UINT64 incs;                                // should be equal ops
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+    double depth;                               // mean search path length of sampled ops
+    double lines;                               // mean distinct cache lines of sampled ops
+    UINT64 nodes;                               // # nodes at last shape sample
+    int height;                                 // height at last shape sample
+    UINT64 faults;                              // page faults
+    UINT64 dtlb;                                // DTLB load misses
 } Result;
 
 Result *r;                                      // results
 UINT indx;                                      // results index
 
-volatile VINT *g;                               // NB: position of volatile
+//
+// OpStats
+//
+// per thread op counts by type, own cache line
+// an op is effective if it inserts, removes or finds a key, or is a range op that hits at least
+// one key, so op - eff counts duplicate adds, removes of absent keys and lookup misses
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this thread's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "add/s", "get/s", "scan/s", "rdel/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s", "hit/s", "hit/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+thread_local BatchOp *batch;                     // thread local batch of ops
+thread_local INT64 *scanBuf;                    // keys returned by scan
+thread_local PathStats *path;                   // search path samples
+thread_local int nsample;                       // ops since last sample
+thread_local int nbatch;                        // # ops in batch
+
+//
+// flushBatch
+//
+// apply the queued ops and free the nodes of adds that found their key already present
+//
+void flushBatch() {
+    if (nbatch == 0)
+        return;
+    BinarySearchTree->applyBatch(batch, nbatch);
+    for (int i = 0; i < nbatch; i++) {
+        if (batch[i].add && batch[i].result == 0)
+            delete batch[i].n;
+        countOp(batch[i].add, batch[i].result);
+    }
+    nbatch = 0;
+}
 
 void runOp(UINT randomValue, UINT randomBit) {
+#if SAMPLE > 0
+    if (++nsample == SAMPLE) {
+        int depth, lines;
+        nsample = 0;
+        BinarySearchTree->probe(randomValue, depth, lines);
+        path->n++;
+        path->depth += depth;
+        path->lines += lines;
+    }
+#endif
+    if (randomBit == LOOKUP) {
+        flushBatch(); // this thread's queued adds and removes take effect before its lookup
+        countOp(LOOKUP, BinarySearchTree->contains(randomValue));
+        return;
+    }
+    if (randomBit == SCAN || randomBit == RDEL)
+        flushBatch(); // range ops see, and aren't undone by, this thread's earlier queued ops
+    if (randomBit == SCAN) {
+        countOp(SCAN, BinarySearchTree->scan(randomValue, randomValue + SCANLEN - 1, scanBuf, SCANLEN));
+        return;
+    }
+    if (randomBit == RDEL) {
+        countOp(RDEL, BinarySearchTree->removeRange(randomValue, randomValue + SCANLEN - 1));
+        return;
+    }
+#if BATCHSZ > 1
+    BatchOp *op = &batch[nbatch];
+    op->key = randomValue;
+    op->add = randomBit;
+    op->n = NULL;
+    if (randomBit) {
+        op->n = new Node;
+        op->n->key = randomValue;
+    }
+    if (++nbatch == BATCHSZ)
+        flushBatch();
+#else
     if (randomBit) {
         Node *addNode = new Node;
         addNode->key = randomValue;
         addNode->left = NULL;
         addNode->right = NULL;
-        BinarySearchTree->add(addNode);
+        int r = BinarySearchTree->add(addNode);
+        if (r == 0)
+            delete addNode;
+        countOp(1, r);
     }
     else {
-        BinarySearchTree->remove(randomValue);
+        countOp(0, BinarySearchTree->remove(randomValue));
     }
+#endif
 }
+#if TRACE == 2
+TraceOp **trace;                                // mapped trace files, thread t replays trace[t % ntrace]
+size_t *ntraceOp;                               // # records in each trace
+int ntrace;                                     // # trace files
+
+//
+// loadTrace
+//
+// map trace files 0, 1, 2, ... up to the first missing one
+//
+void loadTrace()
+{
+    char fn[64];
+    trace = new TraceOp*[maxThread];
+    ntraceOp = new size_t[maxThread];
+    for (ntrace = 0; ntrace < maxThread; ntrace++) {
+        sprintf(fn, TRACEFILE, ntrace);
+        if ((trace[ntrace] = mapTrace(fn, ntraceOp[ntrace])) == NULL)
+            break;
+        for (size_t i = 0; i < ntraceOp[ntrace]; i++) {
+            if (trace[ntrace][i].op >= NOPTYPE) {
+                cout << fn << ": bad op " << trace[ntrace][i].op << " in record " << i << endl;
+                quit(1);
+            }
+        }
+    }
+    if (ntrace == 0) {
+        cout << "no trace file " << fn << endl;
+        quit(1);
+    }
+}
+#endif
+
 //
 // worker
 //
@@ -214,44 +761,75 @@ WORKER worker(void *vthread)
 
     runThreadOnCPU(thread % ncpu);
 
-    UINT *chooseRandom  = new UINT;
+    Rng rng;
+    seedRng(rng, SEED, thread);
     UINT randomValue;
     UINT randomBit;
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+#if TRACE == 1
+    char fn[64];
+    sprintf(fn, TRACEFILE, thread);
+    TraceWriter *tw = new TraceWriter;
+    openTrace(*tw, fn);
+#elif TRACE == 2
+    TraceOp *tp = trace[thread % ntrace];
+    TraceOp *te = tp + ntraceOp[thread % ntrace];
+#endif
+
+    batch = new BatchOp[BATCHSZ];
+    nbatch = 0;
+    scanBuf = new INT64[SCANLEN];
+    path = &pathStats[thread];
+    nsample = 0;
 
     while (1) {
         for(int y=0; y<NOPS; y++) {
-            randomBit = 0;
-            *chooseRandom = rand(*chooseRandom);
-            randomBit = *chooseRandom % 2;
-            switch (sharing) {
-                case 0:
-                    runOp(*chooseRandom % 16, randomBit);
-                    break;
-                case 1:
-                    randomValue = *chooseRandom % 256;
-                    runOp(randomValue, randomBit);
-                    break;
-                case 2:
-                    randomValue = *chooseRandom % 4096;
-                    runOp(randomValue, randomBit);
-                    break;
-                case 3:
-                    randomValue = *chooseRandom % 65536;
-                    runOp(randomValue, randomBit);
-                    break;
-                case 4:
-                    randomValue = *chooseRandom % 1048576;
-                    runOp(randomValue, randomBit);
-                    break;
-            }
+#if TRACE == 2
+            randomValue = tp->key & keyMask;            // fold recorded key into key range
+            randomBit = tp->op;
+            if (++tp == te)
+                tp = trace[thread % ntrace];            // wrap
+#else
+            UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+            randomBit = (UINT) (r >> 63);
+#if READPCT + SCANPCT + RDELPCT > 0
+            UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+            if (pct < READPCT)
+                randomBit = LOOKUP;
+            else if (pct < READPCT + SCANPCT)
+                randomBit = SCAN;
+            else if (pct < READPCT + SCANPCT + RDELPCT)
+                randomBit = RDEL;
+#endif
+            randomValue = (UINT) r & keyMask;
+#if TRACE == 1
+            recordOp(*tw, randomValue, randomBit);
+#endif
+#endif
+            runOp(randomValue, randomBit);
+#if GAPS
+            recordGap(*gap);
+#endif
         }
         n += NOPS;
+        recordSeries(series[thread], NOPS);
         //
         // check if runtime exceeded
         //
         if ((getWallClockMS() - tstart) > NSECONDS*1000)
             break;
     }
+    flushBatch();
+    delete[] batch;
+    delete[] scanBuf;
+#if TRACE == 1
+    closeTrace(*tw);
+    delete tw;
+#endif
     ops[thread] = n;
     BinarySearchTree->destroy(BinarySearchTree->root); //Recursively destroy BST
     BinarySearchTree->root = NULL;
@@ -264,6 +842,9 @@ int main()
 {
     ncpu = getNumberOfCPUs();   // number of logical CPUs
     maxThread = 2 * ncpu;       // max number of threads
+#if TRACE == 2
+    loadTrace();                // replay traces
+#endif
     //
     // get date
     //
@@ -276,21 +857,32 @@ int main()
     //
     // allocate global variable
     //
-    // NB: each element in g is stored in a different cache line to stop false sharing
+    // NB: per thread counts are cache line aligned to stop false sharing
     //
     threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
     ops = (UINT64*) ALIGNED_MALLOC(maxThread*sizeof(UINT64), lineSz);                   // for ops per thread
+    pathStats = (PathStats*) ALIGNED_MALLOC(maxThread*sizeof(PathStats), 64);           // search path samples per thread
 
-    g = (VINT*) ALIGNED_MALLOC((maxThread + 1)*lineSz, lineSz);                         // local and shared global variables
+    opStats = (OpStats*) ALIGNED_MALLOC(maxThread*sizeof(OpStats), 64);                 // op counts per thread
+    series = (Series*) ALIGNED_MALLOC(maxThread*sizeof(Series), 64);                    // time series per thread
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+    gaps = (Gap*) ALIGNED_MALLOC(maxThread*sizeof(Gap), 64);                            // op-free intervals per thread
 
     r = (Result*) ALIGNED_MALLOC(5*maxThread*sizeof(Result), lineSz);                   // for results
     memset(r, 0, 5*maxThread*sizeof(Result));                                        // zero
 
     indx = 0;
     //
+    // node pool, pre-faulted here so runs don't take first touch faults
+    //
+    int pages = poolInit(sizeof(Node), (size_t) POOLMB*K*K, PAGES);
+    int dtlbFd = openDTLBMissCounter();
+    //
     // use thousands comma separator
     //
     setCommaLocale();
+    cout << "node pool " << POOLMB << "MB " << (pages < 0 ? "unavailable" : pagesName[pages]) << " pages";
+    cout << (dtlbFd < 0 ? ", DTLB miss counter unavailable" : "") << endl << endl;
     //
     // header
     //
@@ -299,6 +891,31 @@ int main()
     cout << setw(10) << "rt";
     cout << setw(20) << "ops";
     cout << setw(10) << "rel";
+    cout << setw(10) << "faults";
+    cout << setw(10) << "dtlb/op";
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+#if SAMPLE > 0
+    cout << setw(8) << "depth";
+    cout << setw(8) << "lines";
+    cout << setw(12) << "nodes";
+    cout << setw(8) << "height";
+#endif
     cout << endl;
 
     cout << setw(13) << "---";       // random count
@@ -306,6 +923,31 @@ int main()
     cout << setw(10) << "--";        // rt
     cout << setw(20) << "---";       // ops
     cout << setw(10) << "---";       // rel
+    cout << setw(10) << "------";    // faults
+    cout << setw(10) << "-------";   // dtlb/op
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+#if SAMPLE > 0
+    cout << setw(8) << "-----";      // depth
+    cout << setw(8) << "-----";      // lines
+    cout << setw(12) << "-----";     // nodes
+    cout << setw(8) << "------";     // height
+#endif
     cout << endl;
 
     //
@@ -318,43 +960,118 @@ int main()
             //
             //  zero shared memory
             //
-            for (int thread = 0; thread < nt; thread++)
-                *(GINDX(thread)) = 0;   // thread local
-            *(GINDX(maxThread)) = 0;    // shared
+            memset(opStats, 0, nt*sizeof(OpStats));
+#if PREFILL > 0
+            prefill((UINT) pow(16, sharing+1));
+#endif
             //
             // get start time
             //
+            memset(pathStats, 0, nt*sizeof(PathStats));
+            memset(&shape, 0, sizeof(shape));
+            UINT64 faults = getPageFaults();
+            startCounter(dtlbFd);
+            resetSeries(series, nt, BUCKETMS);
+#if GAPS
+            resetGaps(gaps, nt);
+#endif
             tstart = getWallClockMS();
             //
             // create worker threads
             //
             for (int thread = 0; thread < nt; thread++)
                 createThread(&threadH[thread], worker, (void*)(size_t)thread);
+#if SAMPLE > 0
+            THREADH shapeH;
+            createThread(&shapeH, shapeWorker, NULL);
+#endif
             //
             // wait for ALL worker threads to finish
             //
             waitForThreadsToFinish(nt, threadH);
             UINT64 rt = getWallClockMS() - tstart;
+            int nb = mergeSeries(series, nt, merged);
+            seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+            r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+            closeGaps(gaps, nt, NSECONDS*1000);
+            for (int thread = 0; thread < nt; thread++)
+                r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+            r[indx].dtlb = stopCounter(dtlbFd);
+            r[indx].faults = getPageFaults() - faults;
+#if SAMPLE > 0
+            waitForThreadsToFinish(1, &shapeH);
+            closeThread(shapeH);
+#endif
+            BinarySearchTree->reclaim();    // quiescent, free nodes retired by remove
+            BinarySearchTree->root = NULL;  // every node back to the pool
+            poolReset();
 
             //
             // save results and output summary to console
             //
             for (int thread = 0; thread < nt; thread++) {
                 r[indx].ops += ops[thread];
-                r[indx].incs += *(GINDX(thread));
+                for (int op = 0; op < NOPTYPE; op++) {
+                    r[indx].op[op] += opStats[thread].op[op];
+                    r[indx].eff[op] += opStats[thread].eff[op];
+                }
             }
-            r[indx].incs += *(GINDX(maxThread));
             if ((sharing == 0) && (nt == 1))
                 ops1 = r[indx].ops;
             r[indx].sharing = sharing;
             r[indx].nt = nt;
             r[indx].rt = rt;
+            UINT64 nsampled = 0;
+            for (int thread = 0; thread < nt; thread++) {
+                nsampled += pathStats[thread].n;
+                r[indx].depth += pathStats[thread].depth;
+                r[indx].lines += pathStats[thread].lines;
+            }
+            if (nsampled) {
+                r[indx].depth /= nsampled;
+                r[indx].lines /= nsampled;
+            }
+            r[indx].nodes = shape.nodes;
+            r[indx].height = shape.height;
 
             cout << setw(13) << pow(16,sharing+1);
             cout << setw(10) << nt;
             cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
             cout << setw(20) << r[indx].ops;
             cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+            cout << setw(10) << r[indx].faults;
+            if (dtlbFd < 0)
+                cout << setw(10) << "-";
+            else
+                cout << setw(10) << fixed << setprecision(2) << (double) r[indx].dtlb / r[indx].ops;
+            UINT64 eff = 0;
+            for (int op = 0; op < NOPTYPE; op++)
+                eff += r[indx].eff[op];
+            cout << setw(14) << r[indx].ops * 1000 / rt;
+            cout << setw(14) << eff * 1000 / rt;
+            cout << setw(14) << (UINT64) r[indx].steady;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+            cout << setw(12) << r[indx].minOps;
+            cout << setw(12) << r[indx].maxOps;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+            cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            cout << setw(10) << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++) {
+                if (OPCOLS & (1 << op)) {
+                    cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                    cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                }
+            }
+#if SAMPLE > 0
+            cout << setw(8) << fixed << setprecision(2) << r[indx].depth;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].lines;
+            cout << setw(12) << r[indx].nodes;
+            cout << setw(8) << r[indx].height;
+#endif
             cout << endl;
 
             ofstream metrics;
@@ -365,10 +1082,66 @@ int main()
             metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
             metrics << r[indx].ops << ", ";
             metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1;
+            metrics << ", " << eff;
+            metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+            metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+            metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            metrics << ", " << r[indx].maxGap;
+#endif
+            metrics << ", " << r[indx].faults << ", " << r[indx].dtlb;
+            for (int op = 0; op < NOPTYPE; op++)
+                metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+#if SAMPLE > 0
+            metrics << ", " << fixed << setprecision(2) << r[indx].depth;
+            metrics << ", " << fixed << setprecision(2) << r[indx].lines;
+            metrics << ", " << r[indx].nodes;
+            metrics << ", " << r[indx].height;
+#endif
             metrics << endl;
 
             metrics.close();
 
+            ofstream buckets;
+            buckets.open("seriesHLE.txt", ios_base::app);
+            buckets << pow(16,sharing+1) << ", ";
+            buckets << nt << ", " << BUCKETMS;
+            for (int b = 0; b < nb; b++)
+                buckets << ", " << merged[b];
+            buckets << endl;
+            buckets.close();
+
+            ofstream fair;
+            fair.open("fairHLE.txt", ios_base::app);
+            fair << pow(16,sharing+1) << ", ";
+            fair << nt;
+            for (int thread = 0; thread < nt; thread++) {
+                fair << ", " << ops[thread];
+#if GAPS
+                fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+            }
+            fair << endl;
+            fair.close();
+
+            if (r[indx].jain < MINJAIN) {
+                cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                quit(1);
+            }
+
+#if SAMPLE > 0
+            //
+            // depth histogram: # nodes at depth 0, 1, ...
+            //
+            ofstream hist;
+            hist.open("shapeHLE.txt", ios_base::app);
+            hist << (UINT) pow(16,sharing+1) << ", " << nt;
+            for (int d = 0; d < min(shape.height, MAXDEPTH); d++)
+                hist << ", " << shape.hist[d];
+            hist << endl;
+            hist.close();
+#endif
+
             //
             // delete thread handles
             //
@@ -0,0 +1,784 @@
+//
+// sharing.cpp
+//
+// Copyright (C) 2013 - 2015 jones@scss.tcd.ie
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software Foundation;
+// either version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// 19/11/12 first version
+// 19/11/12 works with Win32 and x64
+// 21/11/12 works with Character Set: Not Set, Unicode Character Set or Multi-Byte Character
+// 21/11/12 output results so they can be easily pasted into a spreadsheet from console
+// 24/12/12 increment using (0) non atomic increment (1) InterlockedIncrement64 (2) InterlockedCompareExchange
+// 12/07/13 increment using (3) RTM (restricted transactional memory)
+// 18/07/13 added performance counters
+// 27/08/13 choice of 32 or 64 bit counters (32 bit can oveflow if run time longer than a couple of seconds)
+// 28/08/13 extended struct Result
+// 16/09/13 linux support (needs g++ 4.8 or later)
+// 21/09/13 added getWallClockMS()
+// 12/10/13 Visual Studio 2013 RC
+// 12/10/13 added FALSESHARING
+// 14/10/14 added USEPMS
+//
+
+//
+// NB: hints for pasting from console window
+// NB: Edit -> Select All followed by Edit -> Copy
+// NB: paste into Excel using paste "Use Text Import Wizard" option and select "/" as the delimiter
+//
+
+#include "stdafx.h"                             // pre-compiled headers
+#include <iostream>
+#include <iomanip>                              // setprecision
+#include "helper.h"
+#include <math.h>
+#include <fstream>
+
+using namespace std;
+
+#define K           1024
+#define GB          (K*K*K)
+#define NOPS        1000
+#define NSECONDS    1                           // run each test for NSECONDS
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define PREFILL     50                          // % of key range loaded before each run
+#define GETPCT      50                          // % of ops that are gets
+#define UPDPCT      20                          // % of ops that are updates, the rest are puts and removes
+#define GET         2                           // op: 0 remove, 1 put, 2 get, 3 update
+#define UPDATE      3
+#define NOPTYPE     4                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | ((GETPCT > 0) << GET) | ((UPDPCT > 0) << UPDATE))
+#define MAXATTEMPTS 8                           // transactional attempts before taking the lock
+
+#define LOCK        0                           // modes
+#define HLE         1
+#define RTM         2
+#define NMODE       3
+#define MODES       ((1 << LOCK) | (1 << HLE) | (1 << RTM)) // modes swept, RTM is skipped if the CPU doesn't have it
+
+#define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
+
+UINT64 tstart;                                  // start of test in ms
+int sharing;
+int mode;                                       // mode of current run
+int lineSz;                                     // cache line size
+int maxThread;                                  // max # of threads
+
+THREADH *threadH;                               // thread handles
+UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+const char *modeName[NMODE] = {"lock", "hle", "rtm"};
+
+//
+// Payload
+//
+// N byte value (N a multiple of 8). A put or update copies all N bytes into the node, so
+// the payload is part of the write set of a transaction.
+//
+template <int N> class Payload {
+    public:
+        UINT64 w[N / 8];
+        void set(UINT64 x) {for (int i = 0; i < N / 8; i++) w[i] = x + i;}
+};
+
+template <> class Payload<0> {
+    public:
+        void set(UINT64) {}
+};
+
+//
+// Node
+//
+// the value is held in the node, so nodes grow with the payload
+//
+template <class V> class Node {
+    public:
+        INT64 volatile key;
+        Node* volatile left;
+        Node* volatile right;
+        V value;
+        Node() {key = 0; right = left = NULL;} // default constructor
+};
+
+//
+// TxStats
+//
+// per thread transaction counts, own cache line
+//
+class TxStats {
+    public:
+        ALIGN(64) UINT64 starts;                // _xbegin calls
+        UINT64 aborts;                          // all aborts
+        UINT64 capacity;                        // aborts with _XABORT_CAPACITY set
+        UINT64 locked;                          // RTM ops run with the lock held
+};
+
+TxStats *txStats;                               // [thread]
+thread_local TxStats *tx;                       // this thread's transaction counts
+
+//
+// BST
+//
+// ordered map of INT64 keys to values of type V, one lock synchronised as set by mode:
+//
+// LOCK - TATAS lock
+// HLE  - TATAS lock with elided acquire and release
+// RTM  - op runs in a transaction that reads lock, taking lock after MAXATTEMPTS aborts
+//
+// a put needs a node: it is allocated before the op (spare) as a transaction can't allocate,
+// and a node unlinked by a remove (garbage) is freed after the op
+//
+template <class V> class BST {
+    public:
+        Node<V>* volatile root; // root of BST, initially NULL
+        ALIGN(64) volatile long lock;
+        static BST *tree; // map being tested
+        static thread_local Node<V> *spare; // node for the next put
+        static thread_local Node<V> *garbage; // node unlinked by the current op
+        BST() {root = NULL; lock = 0;} // default constructor
+        int put(INT64 key, V &v); // insert key or overwrite its value, returns 1 if key inserted
+        int get(INT64 key, V &v); // copy value of key to v, returns 0 if key not present
+        int update(INT64 key, V &v); // overwrite value of key, returns 0 if key not present
+        int remove(INT64 key); // remove key, returns 0 if key not present
+        int execute(int op, INT64 key, V &v); // run op in current mode
+        int apply(int op, INT64 key, V &v); // op body, caller has synchronised
+        Node<V>* volatile *findCS(INT64 key); // link to node of key, or to where it would go
+        void removeCS(Node<V>* volatile *pp); // unlink node pp points to
+        void acquire(); // TATAS
+        void acquireHLE();
+        void destroy(Node<V> *p); // free sub tree
+};
+
+template <class V> BST<V> *BST<V>::tree;
+template <class V> thread_local Node<V> *BST<V>::spare;
+template <class V> thread_local Node<V> *BST<V>::garbage;
+
+//
+// findCS
+//
+template <class V> Node<V>* volatile *BST<V>::findCS(INT64 key)
+{
+    Node<V>* volatile *pp = &root;
+    Node<V> *p = *pp;
+    while (p && p->key != key) {
+        pp = (key < p->key) ? &p->left : &p->right;
+        p = *pp;
+    }
+    return pp;
+}
+
+//
+// removeCS
+//
+// a node with two children is replaced by its successor node, relinking the successor
+// rather than copying its key and value keeps the write set independent of the payload size
+//
+template <class V> void BST<V>::removeCS(Node<V>* volatile *pp)
+{
+    Node<V> *q = *pp;
+    if (q->left == NULL) {
+        *pp = q->right;
+    } else if (q->right == NULL) {
+        *pp = q->left;
+    } else {
+        Node<V>* volatile *sp = &q->right;
+        Node<V> *s = q->right;
+        while (s->left) {
+            sp = &s->left;
+            s = s->left;
+        }
+        *sp = s->right;
+        s->left = q->left;
+        s->right = q->right;
+        *pp = s;
+    }
+    garbage = q;
+}
+
+//
+// apply
+//
+template <class V> int BST<V>::apply(int op, INT64 key, V &v)
+{
+    Node<V>* volatile *pp = findCS(key);
+    Node<V> *p = *pp;
+    switch (op) {
+        case 0:
+            if (p == NULL)
+                return 0;
+            removeCS(pp);
+            return 1;
+        case 1:
+            if (p) {
+                p->value = v;
+                return 0;
+            }
+            p = spare;
+            spare = NULL;
+            p->key = key;
+            p->left = NULL;
+            p->right = NULL;
+            p->value = v;
+            *pp = p;
+            return 1;
+        case GET:
+            if (p == NULL)
+                return 0;
+            v = p->value;
+            return 1;
+        case UPDATE:
+            if (p == NULL)
+                return 0;
+            p->value = v;
+            return 1;
+    }
+    return 0;
+}
+
+//
+// execute
+//
+template <class V> int BST<V>::execute(int op, INT64 key, V &v)
+{
+    int r;
+    garbage = NULL;
+    if (mode == RTM) {
+        int attempts = 0;
+        while (attempts++ < MAXATTEMPTS) {
+            tx->starts++;
+            UINT status = _xbegin();
+            if (status == _XBEGIN_STARTED) {
+                if (lock)
+                    _xabort(0xA0);
+                r = apply(op, key, v);
+                _xend();
+                goto done;
+            }
+            tx->aborts++;
+            tx->capacity += (status & _XABORT_CAPACITY) != 0;
+            while (lock)
+                _mm_pause();
+        }
+        tx->locked++;
+    }
+    if (mode == HLE) {
+        acquireHLE();
+        r = apply(op, key, v);
+        _Store_HLERelease(&lock, 0);
+    } else {
+        acquire();
+        r = apply(op, key, v);
+        lock = 0;
+    }
+done:
+    delete garbage;
+    return r;
+}
+
+template <class V> int BST<V>::put(INT64 key, V &v)
+{
+    if (spare == NULL)
+        spare = new Node<V>;
+    return execute(1, key, v);
+}
+
+template <class V> int BST<V>::get(INT64 key, V &v)
+{
+    return execute(GET, key, v);
+}
+
+template <class V> int BST<V>::update(INT64 key, V &v)
+{
+    return execute(UPDATE, key, v);
+}
+
+template <class V> int BST<V>::remove(INT64 key)
+{
+    V v;
+    return execute(0, key, v);
+}
+
+template <class V> void BST<V>::acquire()
+{
+    while (InterlockedExchange(&lock, 1) == 1) {
+        do {
+            _mm_pause();
+        } while (lock == 1);
+    }
+}
+
+template <class V> void BST<V>::acquireHLE()
+{
+    while (_InterlockedExchange_HLEAcquire(&lock, 1) == 1) {
+        do {
+            _mm_pause();
+        } while (lock == 1);
+    }
+}
+
+template <class V> void BST<V>::destroy(Node<V> *p)
+{
+    if (p) {
+        destroy(p->left);
+        destroy(p->right);
+        delete p;
+    }
+}
+
+//
+// buildBalanced
+//
+// link sorted keys into a balanced sub tree
+//
+template <class V> Node<V> *buildBalanced(INT64 *key, int lo, int hi)
+{
+    if (lo > hi)
+        return NULL;
+    int mid = lo + (hi - lo) / 2;
+    Node<V> *n = new Node<V>;
+    n->key = key[mid];
+    n->value.set(key[mid]);
+    n->left = buildBalanced<V>(key, lo, mid - 1);
+    n->right = buildBalanced<V>(key, mid + 1, hi);
+    return n;
+}
+
+//
+// prefill
+//
+// load PREFILL% of the keys in [0, range), evenly spaced so the shape is the same every run
+//
+template <class V> void prefill(UINT range)
+{
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    INT64 *key = new INT64[n];
+    for (int i = 0; i < n; i++)
+        key[i] = (UINT64) i * range / n;
+    BST<V>::tree->root = buildBalanced<V>(key, 0, n - 1);
+    delete[] key;
+}
+
+typedef struct {
+    int bytes;                                  // payload bytes
+    int mode;                                   // mode
+    int sharing;                                // sharing
+    int nt;                                     // # threads
+    UINT64 rt;                                  // run time (ms)
+    UINT64 ops;                                 // ops
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+    UINT64 starts;                              // transactions started
+    UINT64 aborts;                              // transactions aborted
+    UINT64 capacity;                            // capacity aborts
+    UINT64 locked;                              // RTM ops run with the lock held
+} Result;
+
+Result *r;                                      // results
+UINT indx;                                      // results index
+UINT64 ops1 = 1;                                // ops of first run
+
+//
+// OpStats
+//
+// per thread op counts by type, own cache line
+// an op is effective if it inserts, removes, finds or updates a key, so a put of a key already
+// present (an overwrite) is not effective
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this thread's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "put/s", "get/s", "upd/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s", "updated/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+template <class V> void runOp(UINT randomValue, UINT randomBit, V &v) {
+    BST<V> *t = BST<V>::tree;
+    if (randomBit == GET) {
+        countOp(GET, t->get(randomValue, v));
+    } else if (randomBit == UPDATE) {
+        v.set(randomValue);
+        countOp(UPDATE, t->update(randomValue, v));
+    } else if (randomBit) {
+        v.set(randomValue);
+        countOp(1, t->put(randomValue, v));
+    } else {
+        countOp(0, t->remove(randomValue));
+    }
+}
+
+//
+// worker
+//
+template <class V> WORKER worker(void *vthread)
+{
+    int thread = (int)((size_t) vthread);
+
+    UINT64 n = 0;
+
+    runThreadOnCPU(thread % ncpu);
+
+    Rng rng;
+    seedRng(rng, SEED, thread);
+    UINT randomValue;
+    UINT randomBit;
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+    tx = &txStats[thread];
+    V v;
+
+    while (1) {
+        for(int y=0; y<NOPS; y++) {
+            UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+            randomBit = (UINT) (r >> 63);
+            UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+            if (pct < GETPCT)
+                randomBit = GET;
+            else if (pct < GETPCT + UPDPCT)
+                randomBit = UPDATE;
+            randomValue = (UINT) r & keyMask;
+            runOp(randomValue, randomBit, v);
+#if GAPS
+            recordGap(*gap);
+#endif
+        }
+        n += NOPS;
+        recordSeries(series[thread], NOPS);
+        //
+        // check if runtime exceeded
+        //
+        if ((getWallClockMS() - tstart) > NSECONDS*1000)
+            break;
+    }
+    delete BST<V>::spare;
+    BST<V>::spare = NULL;
+    ops[thread] = n;
+    return 0;
+}
+
+//
+// sweep
+//
+// run every mode, tree size and thread count with values of type V
+//
+template <class V> void sweep(int bytes)
+{
+    BST<V>::tree = new BST<V>;
+    for (mode = 0; mode < NMODE; mode++) {
+        if ((MODES & (1 << mode)) == 0 || (mode == RTM && !rtmSupported()))
+            continue;
+        for (sharing = 0; sharing < 5; sharing++) {
+            for (int nt = 1; nt <= maxThread; nt+=1, indx++) {
+                //
+                //  zero shared memory
+                //
+                memset(opStats, 0, nt*sizeof(OpStats));
+                memset(txStats, 0, nt*sizeof(TxStats));
+#if PREFILL > 0
+                prefill<V>((UINT) pow(16, sharing+1));
+#endif
+                //
+                // get start time
+                //
+                resetSeries(series, nt, BUCKETMS);
+#if GAPS
+                resetGaps(gaps, nt);
+#endif
+                tstart = getWallClockMS();
+                //
+                // create worker threads
+                //
+                for (int thread = 0; thread < nt; thread++)
+                    createThread(&threadH[thread], worker<V>, (void*)(size_t)thread);
+                //
+                // wait for ALL worker threads to finish
+                //
+                waitForThreadsToFinish(nt, threadH);
+                UINT64 rt = getWallClockMS() - tstart;
+                int nb = mergeSeries(series, nt, merged);
+                seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+                r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+                closeGaps(gaps, nt, NSECONDS*1000);
+                for (int thread = 0; thread < nt; thread++)
+                    r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+                BST<V>::tree->destroy(BST<V>::tree->root);
+                BST<V>::tree->root = NULL;
+
+                //
+                // save results and output summary to console
+                //
+                for (int thread = 0; thread < nt; thread++) {
+                    r[indx].ops += ops[thread];
+                    for (int op = 0; op < NOPTYPE; op++) {
+                        r[indx].op[op] += opStats[thread].op[op];
+                        r[indx].eff[op] += opStats[thread].eff[op];
+                    }
+                    r[indx].starts += txStats[thread].starts;
+                    r[indx].aborts += txStats[thread].aborts;
+                    r[indx].capacity += txStats[thread].capacity;
+                    r[indx].locked += txStats[thread].locked;
+                }
+                if (indx == 0)
+                    ops1 = r[indx].ops;
+                r[indx].bytes = bytes;
+                r[indx].mode = mode;
+                r[indx].sharing = sharing;
+                r[indx].nt = nt;
+                r[indx].rt = rt;
+
+                cout << setw(6) << bytes;
+                cout << setw(6) << sizeof(Node<V>);
+                cout << setw(6) << modeName[mode];
+                cout << setw(13) << (UINT64) pow(16,sharing+1);
+                cout << setw(10) << nt;
+                cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
+                cout << setw(20) << r[indx].ops;
+                cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+                UINT64 eff = 0;
+                for (int op = 0; op < NOPTYPE; op++)
+                    eff += r[indx].eff[op];
+                cout << setw(14) << r[indx].ops * 1000 / rt;
+                cout << setw(14) << eff * 1000 / rt;
+                cout << setw(14) << (UINT64) r[indx].steady;
+                cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+                cout << setw(12) << r[indx].minOps;
+                cout << setw(12) << r[indx].maxOps;
+                cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+                cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+                cout << setw(10) << r[indx].maxGap;
+#endif
+                for (int op = 0; op < NOPTYPE; op++) {
+                    if (OPCOLS & (1 << op)) {
+                        cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                        cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                    }
+                }
+                if (mode == RTM) {
+                    double starts = r[indx].starts ? (double) r[indx].starts : 1;
+                    cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].aborts / starts;
+                    cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].capacity / starts;
+                    cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].locked / r[indx].ops;
+                } else {
+                    cout << setw(8) << "-" << setw(8) << "-" << setw(8) << "-";
+                }
+                cout << endl;
+
+                ofstream metrics;
+                metrics.open("metricsKV.txt", ios_base::app);
+
+                metrics << bytes << ", " << sizeof(Node<V>) << ", " << modeName[mode] << ", ";
+                metrics << (UINT64) pow(16,sharing+1) << ", ";
+                metrics << nt << ", ";
+                metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
+                metrics << r[indx].ops << ", ";
+                metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1;
+                metrics << ", " << eff;
+                metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+                metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+                metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+                metrics << ", " << r[indx].maxGap;
+#endif
+                for (int op = 0; op < NOPTYPE; op++)
+                    metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+                metrics << ", " << r[indx].starts << ", " << r[indx].aborts;
+                metrics << ", " << r[indx].capacity << ", " << r[indx].locked;
+                metrics << endl;
+
+                metrics.close();
+
+                ofstream buckets;
+                buckets.open("seriesKV.txt", ios_base::app);
+                buckets << bytes << ", " << sizeof(Node<V>) << ", " << modeName[mode] << ", ";
+                buckets << (UINT64) pow(16,sharing+1) << ", ";
+                buckets << nt << ", " << BUCKETMS;
+                for (int b = 0; b < nb; b++)
+                    buckets << ", " << merged[b];
+                buckets << endl;
+                buckets.close();
+
+                ofstream fair;
+                fair.open("fairKV.txt", ios_base::app);
+                fair << bytes << ", " << sizeof(Node<V>) << ", " << modeName[mode] << ", ";
+                fair << (UINT64) pow(16,sharing+1) << ", ";
+                fair << nt;
+                for (int thread = 0; thread < nt; thread++) {
+                    fair << ", " << ops[thread];
+#if GAPS
+                    fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+                }
+                fair << endl;
+                fair.close();
+
+                if (r[indx].jain < MINJAIN) {
+                    cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                    quit(1);
+                }
+
+                //
+                // delete thread handles
+                //
+                for (int thread = 0; thread < nt; thread++) {
+                    closeThread(threadH[thread]);
+                }
+            }
+        }
+    }
+    delete BST<V>::tree;
+}
+
+//
+// main
+//
+int main()
+{
+    ncpu = getNumberOfCPUs();   // number of logical CPUs
+    maxThread = 2 * ncpu;       // max number of threads
+    //
+    // get date
+    //
+    char dateAndTime[256];
+    getDateAndTime(dateAndTime, sizeof(dateAndTime));
+    //
+    // get cache info
+    //
+    lineSz = getCacheLineSz();
+    //
+    // allocate global variable
+    //
+    // NB: per thread counts are cache line aligned to stop false sharing
+    //
+    threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
+    ops = (UINT64*) ALIGNED_MALLOC(maxThread*sizeof(UINT64), lineSz);                   // for ops per thread
+
+    opStats = (OpStats*) ALIGNED_MALLOC(maxThread*sizeof(OpStats), 64);                 // op counts per thread
+    series = (Series*) ALIGNED_MALLOC(maxThread*sizeof(Series), 64);                    // time series per thread
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+    gaps = (Gap*) ALIGNED_MALLOC(maxThread*sizeof(Gap), 64);                            // op-free intervals per thread
+    txStats = (TxStats*) ALIGNED_MALLOC(maxThread*sizeof(TxStats), 64);                 // transaction counts per thread
+
+    int nrun = 4*NMODE*5*maxThread;                                                     // payloads x modes x sizes x threads
+    r = (Result*) ALIGNED_MALLOC(nrun*sizeof(Result), lineSz);                          // for results
+    memset(r, 0, nrun*sizeof(Result));                                                  // zero
+
+    indx = 0;
+    //
+    // use thousands comma separator
+    //
+    setCommaLocale();
+    //
+    // header
+    //
+    cout << setw(6) << "value";
+    cout << setw(6) << "node";
+    cout << setw(6) << "mode";
+    cout << setw(13) << "BST";
+    cout << setw(10) << "nt";
+    cout << setw(10) << "rt";
+    cout << setw(20) << "ops";
+    cout << setw(10) << "rel";
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+    cout << setw(8) << "abort%";
+    cout << setw(8) << "cap%";
+    cout << setw(8) << "lock%";
+    cout << endl;
+
+    cout << setw(6) << "-----";      // value
+    cout << setw(6) << "----";       // node
+    cout << setw(6) << "----";       // mode
+    cout << setw(13) << "---";       // random count
+    cout << setw(10) << "--";        // nt
+    cout << setw(10) << "--";        // rt
+    cout << setw(20) << "---";       // ops
+    cout << setw(10) << "---";       // rel
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+    cout << setw(8) << "------";     // abort%
+    cout << setw(8) << "----";       // cap%
+    cout << setw(8) << "-----";      // lock%
+    cout << endl;
+
+    //
+    // run tests, one sweep per payload size
+    //
+    sweep<Payload<0> >(0);
+    sweep<Payload<8> >(8);
+    sweep<Payload<64> >(64);
+    sweep<Payload<256> >(256);
+
+    cout << endl;
+    quit();
+
+    return 0;
+
+}
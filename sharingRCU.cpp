@@ -0,0 +1,1021 @@
+//
+// sharing.cpp
+//
+// Copyright (C) 2013 - 2015 jones@scss.tcd.ie
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software Foundation;
+// either version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// 19/11/12 first version
+// 19/11/12 works with Win32 and x64
+// 21/11/12 works with Character Set: Not Set, Unicode Character Set or Multi-Byte Character
+// 21/11/12 output results so they can be easily pasted into a spreadsheet from console
+// 24/12/12 increment using (0) non atomic increment (1) InterlockedIncrement64 (2) InterlockedCompareExchange
+// 12/07/13 increment using (3) RTM (restricted transactional memory)
+// 18/07/13 added performance counters
+// 27/08/13 choice of 32 or 64 bit counters (32 bit can oveflow if run time longer than a couple of seconds)
+// 28/08/13 extended struct Result
+// 16/09/13 linux support (needs g++ 4.8 or later)
+// 21/09/13 added getWallClockMS()
+// 12/10/13 Visual Studio 2013 RC
+// 12/10/13 added FALSESHARING
+// 14/10/14 added USEPMS
+//
+
+//
+// NB: hints for pasting from console window
+// NB: Edit -> Select All followed by Edit -> Copy
+// NB: paste into Excel using paste "Use Text Import Wizard" option and select "/" as the delimiter
+//
+
+#include "stdafx.h"                             // pre-compiled headers
+#include <iostream>
+#include <iomanip>                              // setprecision
+#include "helper.h"
+#include <math.h>
+#include <fstream> 
+
+using namespace std;
+
+#define K           1024
+#define GB          (K*K*K)
+#define NOPS        1000
+#define NSECONDS    1                           // run each test for NSECONDS
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define TRACE       0                           // 0 generate ops, 1 generate and record ops, 2 replay ops from trace files
+#define TRACEFILE   "trace%d.bin"               // trace file of thread %d
+#define PREFILL     0                           // % of key range bulk loaded before each run
+#define READPCT     99                          // % of ops that are lookups
+#define SCANPCT     0                           // % of ops that are range scans
+#define RDELPCT     0                           // % of ops that are range removes
+#define SCANLEN     16                          // key range covered by a scan or range remove
+#define LOOKUP      2                           // runOp op: 0 remove, 1 add, 2 lookup, 3 scan, 4 range remove
+#define SCAN        3
+#define RDEL        4
+#define NOPTYPE     5                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | ((READPCT > 0 || TRACE == 2) << LOOKUP) | ((SCANPCT > 0 || TRACE == 2) << SCAN) | ((RDELPCT > 0 || TRACE == 2) << RDEL))
+#define RCUBATCH    64                          // retired nodes per thread before waiting for a grace period
+
+#define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
+
+UINT64 tstart;                                  // start of test in ms
+int sharing;
+int lineSz;                                     // cache line size
+int maxThread;                                  // max # of threads
+
+THREADH *threadH;                               // thread handles
+UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+//
+// RCUStats
+//
+// per thread counters, one cache line each
+//
+class RCUStats {
+    public:
+        ALIGN(64) UINT64 reads;                 // lookups and scans
+        UINT64 writes;                          // adds, removes and range removes
+        UINT64 gp;                              // grace periods waited for
+        UINT64 gpUS;                            // total time waiting for grace periods (us)
+};
+
+RCUStats *stats;                                // stats per thread
+
+//ALIGN(64) volatile long lock = 0;
+
+//
+// Node
+//
+// immutable once reachable from root, writers copy nodes instead of changing them
+//
+class Node {
+    public:
+        INT64 key;
+        Node *left;
+        Node *right;
+        Node(INT64 k, Node *l, Node *r) {key = k; left = l; right = r;}
+};
+
+//
+// RCUReader
+//
+// per thread quiescent state, one cache line each so readers only write their own line
+//
+class RCUReader {
+    public:
+        ALIGN(64) volatile UINT64 qs;           // value of gp seen at last quiescent point
+};
+
+#define RCU_OFFLINE MAXUINT64                   // thread not reading, ignored by synchronize
+
+class BST {
+    public:
+        Node* volatile root; // root of current version, initially NULL
+        ALIGN(64) volatile long lock; // serialises writers
+        ALIGN(64) volatile UINT64 gp; // grace period counter
+        RCUReader *reader; // quiescent state per thread
+        int nreader;
+        Node *bulk; // node block of last bulkLoad
+        int nbulk;
+        BST() {root = NULL, lock = 0; gp = 0; reader = NULL; nreader = 0; bulk = NULL; nbulk = 0;} // default constructor
+        void bulkLoad(INT64 *key, int n, int nt); // replace tree with balanced tree of sorted keys
+        int inBulk(Node *p) {return p >= bulk && p < bulk + nbulk;} // node in bulk block, not individually freed
+        void init(int n); // allocate quiescent state for n threads
+        int add(int thread, INT64 key); // add key to tree
+        int remove(int thread, INT64 key); // remove key from tree
+        int contains(int thread, INT64 key); // wait free lookup
+        int scan(int thread, INT64 lo, INT64 hi, INT64 *buf, int max); // copy keys in [lo, hi] to buf in order
+        int removeRange(int thread, INT64 lo, INT64 hi); // remove keys in [lo, hi]
+        void quiescent(int thread); // thread holds no references to nodes
+        void online(int nt); // threads 0..nt-1 about to start reading
+        void offline(int thread); // thread has stopped reading
+        void synchronize(int thread); // wait until every reader has passed a quiescent point
+        void destroy(Node *nextNode);
+        void releaseTATAS();
+        void acquireTATAS();
+};
+
+BST *BinarySearchTree = new BST;
+
+//
+// BulkTask
+//
+// sub tree of a bulk load built by one thread
+//
+typedef struct {
+    INT64 *key;                                 // sorted keys
+    Node *node;                                 // node[i] holds key[i]
+    int lo;                                     // sub tree holds key[lo] .. key[hi-1]
+    int hi;
+    Node* volatile *pp;                         // where to link the sub tree's root
+} BulkTask;
+
+//
+// buildBalanced
+//
+// returns root of a perfectly balanced tree of key[lo] .. key[hi-1]
+//
+Node *buildBalanced(INT64 *key, Node *node, int lo, int hi)
+{
+    if (lo >= hi)
+        return NULL;
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    p->left = buildBalanced(key, node, lo, mid);
+    p->right = buildBalanced(key, node, mid + 1, hi);
+    return p;
+}
+
+//
+// splitBulk
+//
+// build the top levels of the tree and queue the sub trees below them as tasks
+//
+void splitBulk(INT64 *key, Node *node, int lo, int hi, Node* volatile *pp, int levels, BulkTask *task, int &ntask)
+{
+    if (lo >= hi) {
+        *pp = NULL;
+        return;
+    }
+    if (levels == 0) {
+        BulkTask *t = &task[ntask++];
+        t->key = key;
+        t->node = node;
+        t->lo = lo;
+        t->hi = hi;
+        t->pp = pp;
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    *pp = p;
+    splitBulk(key, node, lo, mid, &p->left, levels - 1, task, ntask);
+    splitBulk(key, node, mid + 1, hi, &p->right, levels - 1, task, ntask);
+}
+
+//
+// bulkWorker
+//
+WORKER bulkWorker(void *vtask)
+{
+    BulkTask *t = (BulkTask*) vtask;
+    *t->pp = buildBalanced(t->key, t->node, t->lo, t->hi);
+    return 0;
+}
+
+//
+// bulkLoad
+//
+// replace the tree with a perfectly balanced tree of n sorted distinct keys in O(n)
+// nodes come from one contiguous block (node i holds key i, so in order is memory order)
+// which is freed by the next bulkLoad, sub trees below the top levels are built by nt threads
+// no other thread may be using the tree
+//
+void BST::bulkLoad(INT64 *key, int n, int nt)
+{
+    if (bulk)
+        AFREE(bulk);
+    bulk = n ? (Node*) AMALLOC(n*sizeof(Node), 64) : NULL;
+    nbulk = n;
+    int levels = 0;
+    while ((1 << levels) < nt)
+        levels++;
+    BulkTask *task = new BulkTask[1 << levels];
+    THREADH *h = new THREADH[1 << levels];
+    int ntask = 0;
+    splitBulk(key, bulk, 0, n, &root, levels, task, ntask);
+    for (int i = 0; i < ntask; i++)
+        createThread(&h[i], bulkWorker, &task[i]);
+    waitForThreadsToFinish(ntask, h);
+    for (int i = 0; i < ntask; i++)
+        closeThread(h[i]);
+    delete[] h;
+    delete[] task;
+}
+
+thread_local Node **retired;                    // nodes replaced by this thread's writes
+thread_local int nretired;
+thread_local int maxRetired;
+
+//
+// init
+//
+void BST::init(int n)
+{
+    reader = (RCUReader*) ALIGNED_MALLOC(n*sizeof(RCUReader), 64);
+    for (int i = 0; i < n; i++)
+        reader[i].qs = RCU_OFFLINE;
+    nreader = n;
+}
+
+//
+// quiescent
+//
+// reading gp before root is read means the next root read sees at least the version
+// published before gp was incremented
+//
+inline void BST::quiescent(int thread)
+{
+    reader[thread].qs = gp;
+}
+
+//
+// online
+//
+// called before the threads are created so no grace period can miss a thread
+//
+void BST::online(int nt)
+{
+    for (int thread = 0; thread < nt; thread++)
+        reader[thread].qs = gp;
+}
+
+//
+// offline
+//
+void BST::offline(int thread)
+{
+    reader[thread].qs = RCU_OFFLINE;
+}
+
+//
+// synchronize
+//
+// start a new grace period and wait for every online thread to pass a quiescent point
+// the caller is itself quiescent and keeps saying so while it waits so that two threads
+// synchronizing at the same time don't wait for each other
+//
+void BST::synchronize(int thread)
+{
+    UINT64 g = InterlockedIncrement64(&gp) + 1;
+    reader[thread].qs = g;
+    for (int i = 0; i < nreader; i++) {
+        while (reader[i].qs < g) {
+            reader[thread].qs = gp;
+            _mm_pause();
+        }
+    }
+}
+
+//
+// retire
+//
+// node unreachable from the new root, freed after the next grace period
+//
+inline void retire(Node *p)
+{
+    if (nretired == maxRetired) {
+        maxRetired *= 2;
+        retired = (Node**) realloc(retired, maxRetired*sizeof(Node*));
+    }
+    retired[nretired++] = p;
+}
+
+//
+// reclaim
+//
+// wait for a grace period then free the thread's retired nodes
+//
+void reclaim(int thread)
+{
+    UINT64 t0 = getWallClockUS();
+    BinarySearchTree->synchronize(thread);
+    stats[thread].gpUS += getWallClockUS() - t0;
+    stats[thread].gp++;
+    for (int i = 0; i < nretired; i++)
+        if (!BinarySearchTree->inBulk(retired[i]))
+            delete retired[i];
+    nretired = 0;
+}
+
+//
+// copyAdd
+//
+// return the root of a copy of sub tree p with key added, copying the search path
+// returns p itself if key already present
+//
+Node *copyAdd(Node *p, INT64 key)
+{
+    Node *c;
+    if (p == NULL)
+        return new Node(key, NULL, NULL);
+    if (key < p->key) {
+        if ((c = copyAdd(p->left, key)) == p->left)
+            return p;
+        c = new Node(p->key, c, p->right);
+    } else if (key > p->key) {
+        if ((c = copyAdd(p->right, key)) == p->right)
+            return p;
+        c = new Node(p->key, p->left, c);
+    } else {
+        return p;
+    }
+    retire(p);
+    return c;
+}
+
+//
+// copyRemoveMin
+//
+// return the root of a copy of sub tree p without its min key
+//
+Node *copyRemoveMin(Node *p)
+{
+    retire(p);
+    if (p->left == NULL)
+        return p->right;
+    return new Node(p->key, copyRemoveMin(p->left), p->right);
+}
+
+//
+// copyRemove
+//
+// return the root of a copy of sub tree p with key removed, copying the search path
+// returns p itself if key not present
+//
+Node *copyRemove(Node *p, INT64 key)
+{
+    Node *c;
+    if (p == NULL)
+        return NULL;
+    if (key < p->key) {
+        if ((c = copyRemove(p->left, key)) == p->left)
+            return p;
+        c = new Node(p->key, c, p->right);
+    } else if (key > p->key) {
+        if ((c = copyRemove(p->right, key)) == p->right)
+            return p;
+        c = new Node(p->key, p->left, c);
+    } else if (p->left == NULL) {
+        c = p->right; // NO or ONE child
+    } else if (p->right == NULL) {
+        c = p->left; // ONE child
+    } else {
+        Node *r = p->right; // TWO children, replace with min key in right sub tree
+        while (r->left)
+            r = r->left;
+        c = new Node(r->key, p->left, copyRemoveMin(p->right));
+    }
+    retire(p);
+    return c;
+}
+
+//
+// add
+//
+// writers are serialised by the lock, the new version is published with one atomic
+// pointer swap so readers see either the old or the new version
+//
+int BST::add(int thread, INT64 key)
+{
+    acquireTATAS();
+    Node *r = root;
+    Node *n = copyAdd(r, key);
+    if (n != r)
+        (void) InterlockedExchangePointer(&root, n);
+    releaseTATAS();
+    if (nretired >= RCUBATCH)
+        reclaim(thread);
+    return n != r;
+}
+
+//
+// remove
+//
+int BST::remove(int thread, INT64 key)
+{
+    acquireTATAS();
+    Node *r = root;
+    Node *n = copyRemove(r, key);
+    if (n != r)
+        (void) InterlockedExchangePointer(&root, n);
+    releaseTATAS();
+    if (nretired >= RCUBATCH)
+        reclaim(thread);
+    return n != r;
+}
+
+//
+// contains
+//
+// wait free, reads an immutable version
+//
+int BST::contains(int thread, INT64 key)
+{
+    quiescent(thread);
+    Node *p = root;
+    while (p && p->key != key)
+        p = (key < p->key) ? p->left : p->right;
+    return p != NULL;
+}
+
+//
+// scanNodes
+//
+// in order walk of the part of sub tree p that can hold keys in [lo, hi]
+// keys are appended to buf starting at buf[n], returns new n (at most max)
+//
+int scanNodes(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max)
+{
+    while (p && n < max) {
+        if (p->key > lo)
+            n = scanNodes(p->left, lo, hi, buf, n, max);
+        if (p->key >= lo && p->key <= hi && n < max)
+            buf[n++] = p->key;
+        if (p->key >= hi)
+            break;
+        p = p->right;
+    }
+    return n;
+}
+
+//
+// scan
+//
+// wait free, walks one immutable version so the result is a consistent snapshot
+//
+int BST::scan(int thread, INT64 lo, INT64 hi, INT64 *buf, int max)
+{
+    quiescent(thread);
+    return scanNodes(root, lo, hi, buf, 0, max);
+}
+
+//
+// removeRange
+//
+// removes keys one at a time from a private working version and publishes the result
+// once, so readers see either none or all of the range removed
+// nodes copied by an earlier removal and replaced by a later one were never published
+// but are retired along with the rest
+//
+int BST::removeRange(int thread, INT64 lo, INT64 hi)
+{
+    int n = 0;
+    acquireTATAS();
+    Node *r = root;
+    Node *w = r;
+    while (1) {
+        Node *p = w;
+        while (p && (p->key < lo || p->key > hi))
+            p = (p->key < lo) ? p->right : p->left;
+        if (p == NULL)
+            break;
+        w = copyRemove(w, p->key);
+        n++;
+    }
+    if (w != r)
+        (void) InterlockedExchangePointer(&root, w);
+    releaseTATAS();
+    if (nretired >= RCUBATCH)
+        reclaim(thread);
+    return n;
+}
+
+//
+// destroy
+//
+// free all nodes, no thread may be in the tree
+//
+void BST::destroy(Node *nextNode)
+{
+    if (nextNode != NULL)
+    {
+        destroy(nextNode->left);
+        destroy(nextNode->right);
+        if (!inBulk(nextNode))
+            delete nextNode;
+    }
+}
+
+void BST::acquireTATAS() {
+    while (InterlockedExchange(&lock, 1) == 1){
+        do {
+            _mm_pause();
+        } while (lock == 1);
+    }
+}
+
+void BST::releaseTATAS() {
+    lock = 0;
+}
+
+//
+// prefill
+//
+// bulk load PREFILL% of the keys in [0, range), evenly spaced so the shape is the same every run
+//
+void prefill(UINT range)
+{
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    INT64 *key = new INT64[n];
+    for (int i = 0; i < n; i++)
+        key[i] = (UINT64) i * range / n;
+    BinarySearchTree->bulkLoad(key, n, ncpu);
+    delete[] key;
+}
+
+typedef struct {
+    int sharing;                                // sharing
+    int nt;                                     // # threads
+    UINT64 rt;                                  // run time (ms)
+    UINT64 ops;                                 // ops
+    UINT64 reads;                               // lookups
+    UINT64 writes;                              // adds and removes
+    UINT64 gp;                                  // grace periods
+    UINT64 gpUS;                                // time waiting for grace periods (us)
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+} Result;
+
+Result *r;                                      // results
+UINT indx;                                      // results index
+
+//
+// OpStats
+//
+// per thread op counts by type, own cache line
+// an op is effective if it inserts, removes or finds a key, or is a range op that hits at least
+// one key, so op - eff counts duplicate adds, removes of absent keys and lookup misses
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this thread's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "add/s", "get/s", "scan/s", "rdel/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s", "hit/s", "hit/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+thread_local INT64 *scanBuf;                    // keys returned by scan
+
+void runOp(int thread, UINT randomValue, UINT randomBit) {
+    if (randomBit == LOOKUP) {
+        countOp(LOOKUP, BinarySearchTree->contains(thread, randomValue));
+        stats[thread].reads++;
+        return;
+    }
+    if (randomBit == SCAN) {
+        countOp(SCAN, BinarySearchTree->scan(thread, randomValue, randomValue + SCANLEN - 1, scanBuf, SCANLEN));
+        stats[thread].reads++;
+        return;
+    }
+    BinarySearchTree->quiescent(thread);
+    if (randomBit == RDEL) {
+        countOp(RDEL, BinarySearchTree->removeRange(thread, randomValue, randomValue + SCANLEN - 1));
+    }
+    else if (randomBit) {
+        countOp(1, BinarySearchTree->add(thread, randomValue));
+    }
+    else {
+        countOp(0, BinarySearchTree->remove(thread, randomValue));
+    }
+    stats[thread].writes++;
+}
+#if TRACE == 2
+TraceOp **trace;                                // mapped trace files, thread t replays trace[t % ntrace]
+size_t *ntraceOp;                               // # records in each trace
+int ntrace;                                     // # trace files
+
+//
+// loadTrace
+//
+// map trace files 0, 1, 2, ... up to the first missing one
+//
+void loadTrace()
+{
+    char fn[64];
+    trace = new TraceOp*[maxThread];
+    ntraceOp = new size_t[maxThread];
+    for (ntrace = 0; ntrace < maxThread; ntrace++) {
+        sprintf(fn, TRACEFILE, ntrace);
+        if ((trace[ntrace] = mapTrace(fn, ntraceOp[ntrace])) == NULL)
+            break;
+        for (size_t i = 0; i < ntraceOp[ntrace]; i++) {
+            if (trace[ntrace][i].op >= NOPTYPE) {
+                cout << fn << ": bad op " << trace[ntrace][i].op << " in record " << i << endl;
+                quit(1);
+            }
+        }
+    }
+    if (ntrace == 0) {
+        cout << "no trace file " << fn << endl;
+        quit(1);
+    }
+}
+#endif
+
+//
+// worker
+//
+WORKER worker(void *vthread)
+{
+    int thread = (int)((size_t) vthread);
+
+    UINT64 n = 0;
+
+    runThreadOnCPU(thread % ncpu);
+
+    Rng rng;
+    seedRng(rng, SEED, thread);
+    UINT randomValue;
+    UINT randomBit;
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+#if TRACE == 1
+    char fn[64];
+    sprintf(fn, TRACEFILE, thread);
+    TraceWriter *tw = new TraceWriter;
+    openTrace(*tw, fn);
+#elif TRACE == 2
+    TraceOp *tp = trace[thread % ntrace];
+    TraceOp *te = tp + ntraceOp[thread % ntrace];
+#endif
+
+    maxRetired = 2*RCUBATCH;
+    retired = (Node**) malloc(maxRetired*sizeof(Node*));
+    nretired = 0;
+    scanBuf = new INT64[SCANLEN];
+    memset(&stats[thread], 0, sizeof(RCUStats));
+
+    while (1) {
+        for(int y=0; y<NOPS; y++) {
+#if TRACE == 2
+            randomValue = tp->key & keyMask;            // fold recorded key into key range
+            randomBit = tp->op;
+            if (++tp == te)
+                tp = trace[thread % ntrace];            // wrap
+#else
+            UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+            randomBit = (UINT) (r >> 63);
+            UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+            if (pct < READPCT)
+                randomBit = LOOKUP;
+            else if (pct < READPCT + SCANPCT)
+                randomBit = SCAN;
+            else if (pct < READPCT + SCANPCT + RDELPCT)
+                randomBit = RDEL;
+            randomValue = (UINT) r & keyMask;
+#if TRACE == 1
+            recordOp(*tw, randomValue, randomBit);
+#endif
+#endif
+            runOp(thread, randomValue, randomBit);
+#if GAPS
+            recordGap(*gap);
+#endif
+        }
+        n += NOPS;
+        recordSeries(series[thread], NOPS);
+        //
+        // check if runtime exceeded
+        //
+        if ((getWallClockMS() - tstart) > NSECONDS*1000)
+            break;
+    }
+    reclaim(thread);
+    BinarySearchTree->offline(thread);
+    free(retired);
+    delete[] scanBuf;
+#if TRACE == 1
+    closeTrace(*tw);
+    delete tw;
+#endif
+    ops[thread] = n;
+    return 0;
+}
+//
+// main
+//
+int main()
+{
+    ncpu = getNumberOfCPUs();   // number of logical CPUs
+    maxThread = 2 * ncpu;       // max number of threads
+#if TRACE == 2
+    loadTrace();                // replay traces
+#endif
+    BinarySearchTree->init(maxThread);  // quiescent state per thread
+    //
+    // get date
+    //
+    char dateAndTime[256];
+    getDateAndTime(dateAndTime, sizeof(dateAndTime));
+    //
+    // get cache info
+    //
+    lineSz = getCacheLineSz();
+    //
+    // allocate global variable
+    //
+    // NB: per thread counts are cache line aligned to stop false sharing
+    //
+    threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
+    ops = (UINT64*) ALIGNED_MALLOC(maxThread*sizeof(UINT64), lineSz);                   // for ops per thread
+    stats = (RCUStats*) ALIGNED_MALLOC(maxThread*sizeof(RCUStats), 64);                 // RCU stats per thread
+
+    opStats = (OpStats*) ALIGNED_MALLOC(maxThread*sizeof(OpStats), 64);                 // op counts per thread
+    series = (Series*) ALIGNED_MALLOC(maxThread*sizeof(Series), 64);                    // time series per thread
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+    gaps = (Gap*) ALIGNED_MALLOC(maxThread*sizeof(Gap), 64);                            // op-free intervals per thread
+
+    r = (Result*) ALIGNED_MALLOC(5*maxThread*sizeof(Result), lineSz);                   // for results
+    memset(r, 0, 5*maxThread*sizeof(Result));                                        // zero
+
+    indx = 0;
+    //
+    // use thousands comma separator
+    //
+    setCommaLocale();
+    //
+    // header
+    //
+    cout << setw(13) << "BST";
+    cout << setw(10) << "nt";
+    cout << setw(10) << "rt";
+    cout << setw(20) << "ops";
+    cout << setw(10) << "rel";
+    cout << setw(16) << "reads/s";
+    cout << setw(16) << "writes/s";
+    cout << setw(10) << "gp us";
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+    cout << endl;
+
+    cout << setw(13) << "---";       // random count
+    cout << setw(10) << "--";        // nt
+    cout << setw(10) << "--";        // rt
+    cout << setw(20) << "---";       // ops
+    cout << setw(10) << "---";       // rel
+    cout << setw(16) << "-------";   // reads/s
+    cout << setw(16) << "--------";  // writes/s
+    cout << setw(10) << "-----";     // gp us
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+    cout << endl;
+
+    //
+    // run tests
+    //
+    UINT64 ops1 = 1;
+
+    for (sharing = 0; sharing < 5; sharing++) {
+        for (int nt = 1; nt <= maxThread; nt+=1, indx++) {
+            //
+            //  zero shared memory
+            //
+            memset(opStats, 0, nt*sizeof(OpStats));
+#if PREFILL > 0
+            prefill((UINT) pow(16, sharing+1));
+#endif
+            //
+            // get start time
+            //
+            resetSeries(series, nt, BUCKETMS);
+#if GAPS
+            resetGaps(gaps, nt);
+#endif
+            tstart = getWallClockMS();
+            //
+            // create worker threads
+            //
+            BinarySearchTree->online(nt);
+            for (int thread = 0; thread < nt; thread++)
+                createThread(&threadH[thread], worker, (void*)(size_t)thread);
+            //
+            // wait for ALL worker threads to finish
+            //
+            waitForThreadsToFinish(nt, threadH);
+            UINT64 rt = getWallClockMS() - tstart;
+            int nb = mergeSeries(series, nt, merged);
+            seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+            r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+            closeGaps(gaps, nt, NSECONDS*1000);
+            for (int thread = 0; thread < nt; thread++)
+                r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+            BinarySearchTree->destroy(BinarySearchTree->root); //Recursively destroy BST
+            BinarySearchTree->root = NULL;
+
+            //
+            // save results and output summary to console
+            //
+            for (int thread = 0; thread < nt; thread++) {
+                r[indx].ops += ops[thread];
+                for (int op = 0; op < NOPTYPE; op++) {
+                    r[indx].op[op] += opStats[thread].op[op];
+                    r[indx].eff[op] += opStats[thread].eff[op];
+                }
+                r[indx].reads += stats[thread].reads;
+                r[indx].writes += stats[thread].writes;
+                r[indx].gp += stats[thread].gp;
+                r[indx].gpUS += stats[thread].gpUS;
+            }
+            if ((sharing == 0) && (nt == 1))
+                ops1 = r[indx].ops;
+            r[indx].sharing = sharing;
+            r[indx].nt = nt;
+            r[indx].rt = rt;
+
+            cout << setw(13) << pow(16,sharing+1);
+            cout << setw(10) << nt;
+            cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
+            cout << setw(20) << r[indx].ops;
+            cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+            cout << setw(16) << (UINT64) (r[indx].reads * 1000 / rt);
+            cout << setw(16) << (UINT64) (r[indx].writes * 1000 / rt);
+            cout << setw(10) << fixed << setprecision(2) << (r[indx].gp ? (double) r[indx].gpUS / r[indx].gp : 0.0);
+            UINT64 eff = 0;
+            for (int op = 0; op < NOPTYPE; op++)
+                eff += r[indx].eff[op];
+            cout << setw(14) << r[indx].ops * 1000 / rt;
+            cout << setw(14) << eff * 1000 / rt;
+            cout << setw(14) << (UINT64) r[indx].steady;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+            cout << setw(12) << r[indx].minOps;
+            cout << setw(12) << r[indx].maxOps;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+            cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            cout << setw(10) << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++) {
+                if (OPCOLS & (1 << op)) {
+                    cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                    cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                }
+            }
+            cout << endl;
+
+            ofstream metrics;
+            metrics.open("metricsRCU.txt", ios_base::app);
+
+            metrics << pow(16,sharing+1) << ", ";
+            metrics << nt << ", ";
+            metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
+            metrics << r[indx].ops << ", ";
+            metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1 << ", ";
+            metrics << r[indx].reads * 1000 / rt << ", ";
+            metrics << r[indx].writes * 1000 / rt << ", ";
+            metrics << fixed << setprecision(2) << (r[indx].gp ? (double)r[indx].gpUS / r[indx].gp : 0.0);
+            metrics << ", " << eff;
+            metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+            metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+            metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            metrics << ", " << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++)
+                metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+            metrics << endl;
+
+            metrics.close();
+
+            ofstream buckets;
+            buckets.open("seriesRCU.txt", ios_base::app);
+            buckets << pow(16,sharing+1) << ", ";
+            buckets << nt << ", " << BUCKETMS;
+            for (int b = 0; b < nb; b++)
+                buckets << ", " << merged[b];
+            buckets << endl;
+            buckets.close();
+
+            ofstream fair;
+            fair.open("fairRCU.txt", ios_base::app);
+            fair << pow(16,sharing+1) << ", ";
+            fair << nt;
+            for (int thread = 0; thread < nt; thread++) {
+                fair << ", " << ops[thread];
+#if GAPS
+                fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+            }
+            fair << endl;
+            fair.close();
+
+            if (r[indx].jain < MINJAIN) {
+                cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                quit(1);
+            }
+
+            //
+            // delete thread handles
+            //
+            for (int thread = 0; thread < nt; thread++) {
+                closeThread(threadH[thread]);
+            }
+        }
+    }
+
+    cout << endl;
+    quit();
+
+    return 0;
+
+}
+
+// eof
\ No newline at end of file
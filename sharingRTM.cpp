@@ -43,6 +43,7 @@
 #include "helper.h"
 #include <math.h>
 #include <fstream> 
+#include <algorithm>                            // stable_sort, min
 
 using namespace std;
 
@@ -50,20 +51,31 @@ using namespace std;
 #define GB          (K*K*K)
 #define NOPS        1000
 #define NSECONDS    1                           // run each test for NSECONDS
-
-#define COUNTER64                               // comment for 32 bit counter
-
-#ifdef COUNTER64
-#define VINT    UINT64                          //  64 bit counter
-#else
-#define VINT    UINT                            //  32 bit counter
-#endif
-
-#ifdef FALSESHARING
-#define GINDX(n)    (g+n)
-#else
-#define GINDX(n)    (g+n*lineSz/sizeof(VINT))
-#endif
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define TRACE       0                           // 0 generate ops, 1 generate and record ops, 2 replay ops from trace files
+#define TRACEFILE   "trace%d.bin"               // trace file of thread %d
+#define PREFILL     0                           // % of key range bulk loaded before each run
+#define PAGES       PAGESTHP                    // node pool pages: PAGES4K, PAGESTHP or PAGESHUGE
+#define POOLMB      256                         // node pool size, nodes come from the heap once it is used up
+#define SAMPLE      0                           // probe search path of every SAMPLE-th op (0 = off)
+#define SHAPEMS     100                         // ms between tree shape samples when SAMPLE > 0
+#define MAXDEPTH    64                          // depth histogram buckets (last bucket counts deeper nodes)
+#define READPCT     0                           // % of ops that are lookups
+#define SCANPCT     0                           // % of ops that are range scans
+#define RDELPCT     0                           // % of ops that are range removes
+#define SCANLEN     16                          // key range covered by a scan or range remove
+#define LOOKUP      2                           // runOp op: 0 remove, 1 add, 2 lookup, 3 scan, 4 range remove
+#define SCAN        3
+#define RDEL        4
+#define NOPTYPE     5                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | ((READPCT > 0 || TRACE == 2) << LOOKUP) | ((SCANPCT > 0 || TRACE == 2) << SCAN) | ((RDELPCT > 0 || TRACE == 2) << RDEL))
+#define BATCHSZ     1                           // ops per BST::applyBatch (1 = one transaction per op)
+#define MAXATTEMPTS 8                           // transactional attempts before taking the lock
+#define SPLITTX     0                           // 1 = add and remove search outside the transaction, validate and commit in a small one
+#define PREWALK     0                           // bit s set: walk the search path before _xbegin when the key range is 16^(s+1)
 
 #define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
 
@@ -74,237 +86,756 @@ int maxThread;                                  // max # of threads
 
 THREADH *threadH;                               // thread handles
 UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+//
+// PathStats
+//
+// search path samples per thread, one cache line each
+//
+class PathStats {
+    public:
+        ALIGN(64) UINT64 n;                     // # ops sampled
+        UINT64 depth;                           // total nodes visited
+        UINT64 lines;                           // total distinct cache lines visited
+};
+
+//
+// ShapeStats
+//
+// tree shape, sampled out of band
+//
+typedef struct {
+    UINT64 nodes;                               // # nodes
+    int height;                                 // # levels
+    UINT64 hist[MAXDEPTH];                      // # nodes at each depth
+} ShapeStats;
+
+PathStats *pathStats;                           // search path samples per thread
+ShapeStats shape;                               // last tree shape sample of run
 
 class Node {
     public:
         INT64 volatile key;
         Node* volatile left;
         Node* volatile right;
-        Node() {key = 0; right = left = NULL;} // default constructor
+        int volatile dead; // set when unlinked
+        Node() {key = 0; right = left = NULL; dead = 0;} // default constructor
+        void* operator new(size_t sz) {return poolAlloc(sz);}
+        void operator delete(void *p) {poolFree(p);}
 };
 
+typedef struct {
+    INT64 key;                                  // key to add or remove
+    int add;                                    // 1 = add, 0 = remove
+    int result;                                 // set to 1 if op changed the tree
+    Node *n;                                    // node to link in if add
+} BatchOp;
+
+inline bool batchOpLess(const BatchOp &a, const BatchOp &b) {return a.key < b.key;}
+
 class BST {
     public:
         Node* volatile root; // root of BST, initially NULL
         ALIGN(64) volatile long lock;
-        BST() {root = NULL, lock = 0;} // default constructor
-        void add(Node *nn); // add node to tree
+        Node *bulk; // node block of last bulkLoad
+        int nbulk;
+        BST() {root = NULL, lock = 0; bulk = NULL; nbulk = 0;} // default constructor
+        void bulkLoad(INT64 *key, int n, int nt); // replace tree with balanced tree of sorted keys
+        int inBulk(Node *p) {return p >= bulk && p < bulk + nbulk;} // node in bulk block, not individually freed
+        int add(Node *nn); // add node to tree, returns 0 if key already present
         void destroy(volatile Node *nextNode);
-        void remove(INT64 key); // remove key from tree
+        int remove(INT64 key); // remove key from tree, returns 0 if key not present
+        int addCS(Node *nn); // add critical section
+        int removeCS(INT64 key); // remove critical section
+        void unlinkCS(Node* volatile *pp, Node *p); // unlink p from link pp
+        void find(INT64 key, Node* &par, INT64 &parKey, Node* volatile* &pp, Node* &p); // search, no lock
+        int linkValid(Node *par, INT64 parKey, Node* volatile *pp, Node *p); // find result still holds
+        int addSplit(Node *nn); // find outside, validate and link in a transaction
+        int removeSplit(INT64 key); // find outside, validate and unlink in a transaction
+        void applyBatch(BatchOp *op, int n); // apply n ops in as few transactions as possible
+        int contains(INT64 key); // lookup key
+        int containsCS(INT64 key); // lookup critical section
+        int scan(INT64 lo, INT64 hi, INT64 *buf, int max); // copy keys in [lo, hi] to buf in order
+        int scanCS(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max);
+        int removeRange(INT64 lo, INT64 hi); // remove keys in [lo, hi]
+        int removeRangeCS(INT64 lo, INT64 hi);
+        void releaseTATAS(); // fallback lock
+        void acquireTATAS();
+        void probe(INT64 key, int &depth, int &lines); // search path of key, no lock
+        void warmPath(INT64 key); // bring search path of key into the cache, no lock
+        int shapeCS(Node *p, int depth, ShapeStats *s); // add sub tree p to shape, returns height
 };
 
 BST *BinarySearchTree = new BST;
 
-void BST::add (Node *n)
+int prewalk;                                    // pre-walk search paths this run (PREWALK bit of sharing)
+
+//
+// TxStats
+//
+// per thread transaction counts, own cache line
+//
+class TxStats {
+    public:
+        ALIGN(64) UINT64 starts;                // _xbegin calls
+        UINT64 aborts;                          // all aborts
+        UINT64 conflicts;                       // aborts with _XABORT_CONFLICT set
+        UINT64 capacity;                        // aborts with _XABORT_CAPACITY set
+        UINT64 locked;                          // critical sections run with the lock held
+        UINT64 invalid;                         // SPLITTX searches that failed validation
+};
+
+TxStats *txStats;                               // [thread]
+thread_local TxStats *tx;                       // this thread's transaction counts
+
+inline void countAbort(UINT status) {
+    tx->aborts++;
+    tx->conflicts += (status & _XABORT_CONFLICT) != 0;
+    tx->capacity += (status & _XABORT_CAPACITY) != 0;
+}
+
+//
+// BulkTask
+//
+// sub tree of a bulk load built by one thread
+//
+typedef struct {
+    INT64 *key;                                 // sorted keys
+    Node *node;                                 // node[i] holds key[i]
+    int lo;                                     // sub tree holds key[lo] .. key[hi-1]
+    int hi;
+    Node* volatile *pp;                         // where to link the sub tree's root
+} BulkTask;
+
+//
+// buildBalanced
+//
+// returns root of a perfectly balanced tree of key[lo] .. key[hi-1]
+//
+Node *buildBalanced(INT64 *key, Node *node, int lo, int hi)
+{
+    if (lo >= hi)
+        return NULL;
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    p->dead = 0;
+    p->left = buildBalanced(key, node, lo, mid);
+    p->right = buildBalanced(key, node, mid + 1, hi);
+    return p;
+}
+
+//
+// splitBulk
+//
+// build the top levels of the tree and queue the sub trees below them as tasks
+//
+void splitBulk(INT64 *key, Node *node, int lo, int hi, Node* volatile *pp, int levels, BulkTask *task, int &ntask)
+{
+    if (lo >= hi) {
+        *pp = NULL;
+        return;
+    }
+    if (levels == 0) {
+        BulkTask *t = &task[ntask++];
+        t->key = key;
+        t->node = node;
+        t->lo = lo;
+        t->hi = hi;
+        t->pp = pp;
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    *pp = p;
+    splitBulk(key, node, lo, mid, &p->left, levels - 1, task, ntask);
+    splitBulk(key, node, mid + 1, hi, &p->right, levels - 1, task, ntask);
+}
+
+//
+// bulkWorker
+//
+WORKER bulkWorker(void *vtask)
+{
+    BulkTask *t = (BulkTask*) vtask;
+    *t->pp = buildBalanced(t->key, t->node, t->lo, t->hi);
+    return 0;
+}
+
+//
+// bulkLoad
+//
+// replace the tree with a perfectly balanced tree of n sorted distinct keys in O(n)
+// nodes come from one contiguous block (node i holds key i, so in order is memory order)
+// which is freed by the next bulkLoad, sub trees below the top levels are built by nt threads
+// no other thread may be using the tree
+//
+void BST::bulkLoad(INT64 *key, int n, int nt)
+{
+    if (bulk)
+        AFREE(bulk);
+    bulk = n ? (Node*) AMALLOC(n*sizeof(Node), 64) : NULL;
+    nbulk = n;
+    int levels = 0;
+    while ((1 << levels) < nt)
+        levels++;
+    BulkTask *task = new BulkTask[1 << levels];
+    THREADH *h = new THREADH[1 << levels];
+    int ntask = 0;
+    splitBulk(key, bulk, 0, n, &root, levels, task, ntask);
+    for (int i = 0; i < ntask; i++)
+        createThread(&h[i], bulkWorker, &task[i]);
+    waitForThreadsToFinish(ntask, h);
+    for (int i = 0; i < ntask; i++)
+        closeThread(h[i]);
+    delete[] h;
+    delete[] task;
+}
+
+//
+// addCS
+//
+// add critical section, run inside a transaction or with the lock held
+// returns 1 if n was linked into the tree, 0 if key already present
+//
+int BST::addCS(Node *n)
+{
+    Node* volatile* volatile pp = &root;
+    Node* volatile p = root;
+    while (p) {
+        if (n->key < p->key) {
+            pp = &p->left;
+        } else if (n->key > p->key) {
+            pp = &p->right;
+        } else {
+            return 0;
+        }
+        p = *pp;
+    }
+    *pp = n;
+    return 1;
+}
+
+//
+// removeCS
+//
+// remove critical section, run inside a transaction or with the lock held
+// returns 1 if key was removed, 0 if key not present
+//
+int BST::removeCS(INT64 key)
+{
+    Node* volatile* volatile pp = &root;
+    Node* volatile p = root;
+    while (p) {
+        if (key < p->key) {
+            pp = &p->left;
+        } else if (key > p->key) {
+            pp = &p->right;
+        } else {
+            break;
+        }
+        p = *pp;
+    }
+    if (p == NULL)
+        return 0;
+    unlinkCS(pp, p);
+    return 1;
+}
+
+//
+// unlinkCS
+//
+// unlink p, reached through link pp, and mark the node taken out of the tree dead
+// (p itself, or its successor whose key p takes if p has two children)
+//
+void BST::unlinkCS(Node* volatile *pp, Node *p)
 {
-    // transactionState = 1 TRANSACTIONAL... transactionState = 0 NON TRANSACTIONAL
-    int transactionState = 1;
-    UINT status;
+    if (p->left == NULL && p->right == NULL) {
+        *pp = NULL; // NO children
+    } else if (p->left == NULL) {
+        *pp = p->right; // ONE child
+    } else if (p->right == NULL) {
+        *pp = p->left; // ONE child
+    } else {
+        Node *r = p->right; // TWO children
+        Node* volatile* volatile ppr = &p->right; // find min key in right sub tree
+        while (r->left) {
+            ppr = &r->left;
+            r = r->left;
+        }
+        p->key = r->key; // could move...
+        p = r; // node instead
+        *ppr = r->right;
+    }
+    p->dead = 1;
+}
+
+//
+// find
+//
+// search for key with no lock and outside any transaction. On return p is the node holding key
+// (NULL if none), pp the link that pointed to p, and par the node holding that link (NULL if pp
+// is &root) with parKey its key when it was passed. Racy, so the result must be checked with
+// linkValid inside a transaction. Safe as removed nodes are never freed or reused during a run,
+// and the walk ends as nodes are only ever moved up the tree, so it can't follow a cycle.
+//
+void BST::find(INT64 key, Node* &par, INT64 &parKey, Node* volatile* &pp, Node* &p)
+{
+    par = NULL;
+    parKey = 0;
+    pp = &root;
+    p = root;
+    while (p) {
+        INT64 k = p->key;
+        if (k == key)
+            break;
+        par = p;
+        parKey = k;
+        pp = (key < k) ? &p->left : &p->right;
+        p = *pp;
+    }
+}
+
+//
+// linkValid
+//
+// run inside the validating transaction. The link found by find still leads to the right place
+// if par is still in the tree with the same key and the link still points to p. Inserts only add
+// leaves and a one child remove moves a sub tree up without changing the key range below it. A two
+// child remove changes a key and unlinks the successor, both caught here: a search that passed
+// the changed key ends up at the dead successor or at the node whose key changed.
+//
+int BST::linkValid(Node *par, INT64 parKey, Node* volatile *pp, Node *p)
+{
+    if (par && (par->dead || par->key != parKey))
+        return 0;
+    return *pp == p;
+}
+
+//
+// addSplit
+//
+// the transaction reads par, the link and p (one to three cache lines) instead of the whole search
+// path, so updates elsewhere on the path no longer abort it. A failed validation commits the empty
+// transaction and searches again.
+//
+int BST::addSplit(Node *n)
+{
+    Node *par, *p;
+    Node* volatile *pp;
+    INT64 parKey;
+    int r;
     int attempts = 0;
-    int MAXATTEMPTS = 8;
-    while(1) {
-        if (transactionState == 1) {
-            status = _xbegin();
-            if (status == _XBEGIN_STARTED) {
-                transactionState = 1;
-            }
-            else {
-                transactionState = 0;
-                // Locking path
-                while (InterlockedExchange(&lock, 1) == 1){
-                    do {
-                        _mm_pause();
-                    } while (lock == 1);
-                }
-                //      ***      //
-                // CRITICAL SECTION
-                //      ***      //
-                Node* volatile* volatile pp = &root;
-                Node* volatile p = root;
-                while (p) {
-                    if (n->key < p->key) {
-                    pp = &p->left;
-                    } else if (n->key > p->key) {
-                        pp = &p->right;
-                        } else {
-                            if(transactionState){
-                                _xend();
-                            } else {
-                                lock = 0;
-                            }
-                            return;
-                        }
-                    p = *pp;
+    while (attempts++ < MAXATTEMPTS) {
+        find(n->key, par, parKey, pp, p);
+        tx->starts++;
+        UINT status = _xbegin();
+        if (status == _XBEGIN_STARTED) {
+            if (lock)
+                _xabort(0xA0);
+            r = -1;
+            if (linkValid(par, parKey, pp, p)) {
+                if (p == NULL) {
+                    *pp = n;
+                    r = 1;
+                } else if (!p->dead && p->key == n->key) {
+                    r = 0;
                 }
-                *pp = n;
-                lock = 0;
-                return;
             }
+            _xend();
+            if (r >= 0)
+                return r;
+            tx->invalid++;
+            continue;
         }
+        countAbort(status);
+        while (lock)
+            _mm_pause();
+    }
+    tx->locked++;
+    acquireTATAS();
+    r = addCS(n);
+    releaseTATAS();
+    return r;
+}
+
+//
+// removeSplit
+//
+// as addSplit, a two child remove still walks p's right sub tree to the successor in the transaction
+//
+int BST::removeSplit(INT64 key)
+{
+    Node *par, *p;
+    Node* volatile *pp;
+    INT64 parKey;
+    int r;
+    int attempts = 0;
+    while (attempts++ < MAXATTEMPTS) {
+        find(key, par, parKey, pp, p);
+        tx->starts++;
+        UINT status = _xbegin();
         if (status == _XBEGIN_STARTED) {
-            if(lock) {
+            if (lock)
                 _xabort(0xA0);
-                break;
-            }
-            //      ***      //
-            // CRITICAL SECTION
-            //      ***      //
-            Node* volatile* volatile pp = &root;
-            Node* volatile p = root;
-            while (p) {
-                if (n->key < p->key) {
-                pp = &p->left;
-                } else if (n->key > p->key) {
-                    pp = &p->right;
-                    } else {
-                        _xend();
-                        return;
-                    }
-                p = *pp;
+            r = -1;
+            if (linkValid(par, parKey, pp, p)) {
+                if (p == NULL) {
+                    r = 0;
+                } else if (!p->dead && p->key == key) {
+                    unlinkCS(pp, p);
+                    r = 1;
+                }
             }
-            *pp = n;
+            _xend();
+            if (r >= 0)
+                return r;
+            tx->invalid++;
+            continue;
+        }
+        countAbort(status);
+        while (lock)
+            _mm_pause();
+    }
+    tx->locked++;
+    acquireTATAS();
+    r = removeCS(key);
+    releaseTATAS();
+    return r;
+}
 
-            if(transactionState){
-                    _xend();
-            } else {
-                lock = 0;
-            }
-            return;
+//
+// add
+//
+// try the critical section transactionally, abort if the lock is set (lock is then in the
+// read set so a thread taking the lock aborts us), take the lock after MAXATTEMPTS aborts
+// if prewalk is set the search path is warmed first so the transaction doesn't start cold
+//
+int BST::add(Node *n)
+{
+#if SPLITTX
+    return addSplit(n);
+#endif
+    int r;
+    int attempts = 0;
+    if (prewalk)
+        warmPath(n->key);
+    while (attempts++ < MAXATTEMPTS) {
+        tx->starts++;
+        UINT status = _xbegin();
+        if (status == _XBEGIN_STARTED) {
+            if (lock)
+                _xabort(0xA0);
+            r = addCS(n);
+            _xend();
+            return r;
         }
-        else {
-            if((lock) || ((attempts++)>=MAXATTEMPTS)) {
-                transactionState = 0;
-                while (InterlockedExchange(&lock, 1) == 1){
-                    do {
-                        _mm_pause();
-                    } while (lock == 1);
-                }
-            }
+        countAbort(status);
+        while (lock)
+            _mm_pause();
+    }
+    tx->locked++;
+    acquireTATAS();
+    r = addCS(n);
+    releaseTATAS();
+    return r;
+}
+
+//
+// remove
+//
+int BST::remove(INT64 key)
+{
+#if SPLITTX
+    return removeSplit(key);
+#endif
+    int r;
+    int attempts = 0;
+    if (prewalk)
+        warmPath(key);
+    while (attempts++ < MAXATTEMPTS) {
+        tx->starts++;
+        UINT status = _xbegin();
+        if (status == _XBEGIN_STARTED) {
+            if (lock)
+                _xabort(0xA0);
+            r = removeCS(key);
+            _xend();
+            return r;
         }
+        countAbort(status);
+        while (lock)
+            _mm_pause();
     }
+    tx->locked++;
+    acquireTATAS();
+    r = removeCS(key);
+    releaseTATAS();
+    return r;
 }
 
-void BST::remove(INT64 key)
+//
+// containsCS
+//
+int BST::containsCS(INT64 key)
+{
+    Node* volatile p = root;
+    while (p && p->key != key)
+        p = (key < p->key) ? p->left : p->right;
+    return p != NULL;
+}
+
+//
+// contains
+//
+// read only transaction, only the search path and lock are in the read set
+//
+int BST::contains(INT64 key)
 {
-    int transactionState = 1;
-    UINT status;
     int attempts = 0;
-    int MAXATTEMPTS = 8;
-    while(1) {
-        if (transactionState == 1) {
-            status = _xbegin();
-            if (status == _XBEGIN_STARTED) {
-                transactionState = 1;
-            }
-            else {
-                transactionState = 0;
-                // Locking path
-                while (InterlockedExchange(&lock, 1) == 1){
-                    do {
-                        _mm_pause();
-                    } while (lock == 1);
-                }
-                //      ***      // 
-                // CRITICAL SECTION
-                //      ***      //
-                Node* volatile* volatile pp = &root;
-                Node* volatile p = root;
-                while (p) {
-                    if (key < p->key) {
-                        pp = &p->left;
-                    } else if (key > p->key) {
-                        pp = &p->right;
-                        } else {
-                            lock = 0;
-                            return;
-                        }
-                    p = *pp;
-                }
-                if (p == NULL) {
-                    lock = 0;
-                    return;
-                }
-                if (p->left == NULL && p->right == NULL) {
-                    *pp = NULL; // NO children
-                } else if (p->left == NULL) {
-                    *pp = p->right; // ONE child
-                } else if (p->right == NULL) {
-                    *pp = p->left; // ONE child
-                } else {
-                    Node *r = p->right; // TWO children
-                    Node* volatile* volatile ppr = &p->right; // find min key in right sub tree
-                    while (r->left) {
-                        ppr = &r->left;
-                        r = r->left;
-                    }
-                    p->key = r->key; // could move...
-                    p = r; // node instead
-                    *ppr = r->right;
-                }
-                
-                lock = 0;
-                return;
-            }
+    if (prewalk)
+        warmPath(key);
+    while (attempts++ < MAXATTEMPTS) {
+        tx->starts++;
+        UINT status = _xbegin();
+        if (status == _XBEGIN_STARTED) {
+            if (lock)
+                _xabort(0xA0);
+            int found = containsCS(key);
+            _xend();
+            return found;
+        }
+        countAbort(status);
+        while (lock)
+            _mm_pause();
+    }
+    tx->locked++;
+    acquireTATAS();
+    int found = containsCS(key);
+    releaseTATAS();
+    return found;
+}
+
+//
+// scanCS
+//
+// in order walk of the part of sub tree p that can hold keys in [lo, hi]
+// keys are appended to buf starting at buf[n], returns new n (at most max)
+//
+int BST::scanCS(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max)
+{
+    while (p && n < max) {
+        if (p->key > lo)
+            n = scanCS(p->left, lo, hi, buf, n, max);
+        if (p->key >= lo && p->key <= hi && n < max)
+            buf[n++] = p->key;
+        if (p->key >= hi)
+            break;
+        p = p->right;
+    }
+    return n;
+}
+
+//
+// removeRangeCS
+//
+// repeatedly find a node with a key in [lo, hi] and remove it
+// returns # keys removed
+//
+int BST::removeRangeCS(INT64 lo, INT64 hi)
+{
+    int n = 0;
+    while (1) {
+        Node* volatile p = root;
+        while (p && (p->key < lo || p->key > hi))
+            p = (p->key < lo) ? p->right : p->left;
+        if (p == NULL)
+            return n;
+        n += removeCS(p->key);
+    }
+}
+
+//
+// scan
+//
+// one transaction for the whole range so the read set grows with the scan length and
+// long scans end up taking the lock after capacity aborts
+//
+int BST::scan(INT64 lo, INT64 hi, INT64 *buf, int max)
+{
+    int attempts = 0;
+    while (attempts++ < MAXATTEMPTS) {
+        tx->starts++;
+        UINT status = _xbegin();
+        if (status == _XBEGIN_STARTED) {
+            if (lock)
+                _xabort(0xA0);
+            int n = scanCS(root, lo, hi, buf, 0, max);
+            _xend();
+            return n;
         }
+        countAbort(status);
+        if (status & _XABORT_CAPACITY)
+            break;
+        while (lock)
+            _mm_pause();
+    }
+    tx->locked++;
+    acquireTATAS();
+    int n = scanCS(root, lo, hi, buf, 0, max);
+    releaseTATAS();
+    return n;
+}
+
+//
+// removeRange
+//
+int BST::removeRange(INT64 lo, INT64 hi)
+{
+    int attempts = 0;
+    while (attempts++ < MAXATTEMPTS) {
+        tx->starts++;
+        UINT status = _xbegin();
         if (status == _XBEGIN_STARTED) {
-            if(lock) {
+            if (lock)
                 _xabort(0xA0);
-                transactionState = 0;
+            int n = removeRangeCS(lo, hi);
+            _xend();
+            return n;
+        }
+        countAbort(status);
+        if (status & _XABORT_CAPACITY)
+            break;
+        while (lock)
+            _mm_pause();
+    }
+    tx->locked++;
+    acquireTATAS();
+    int n = removeRangeCS(lo, hi);
+    releaseTATAS();
+    return n;
+}
+
+//
+// applyBatch
+//
+// sort a thread local batch of ops by key and apply it in transaction sized chunks
+// ops on the same key keep their original order (stable sort)
+// op[i].result is set to 1 if op i changed the tree
+//
+// the chunk size adapts per thread: halved on a capacity abort and increased by one after
+// each commit of a full chunk (up to BATCHSZ); a chunk that keeps aborting for other
+// reasons is applied with the lock held
+//
+void BST::applyBatch(BatchOp *op, int n)
+{
+    static thread_local int chunk = BATCHSZ;
+
+    stable_sort(op, op + n, batchOpLess);
+    int i = 0;
+    while (i < n) {
+        int m = min(chunk, n - i);
+        int attempts = 0;
+        while (1) {
+            tx->starts++;
+            UINT status = _xbegin();
+            if (status == _XBEGIN_STARTED) {
+                if (lock)
+                    _xabort(0xA0);
+                for (int j = i; j < i + m; j++)
+                    op[j].result = op[j].add ? addCS(op[j].n) : removeCS(op[j].key);
+                _xend();
+                if (m == chunk && chunk < BATCHSZ)
+                    chunk++;
                 break;
             }
-            //      ***      //
-            // CRITICAL SECTION
-            //      ***      //
-            Node* volatile* volatile pp = &root;
-            Node* volatile p = root;
-            while (p) {
-                if (key < p->key) {
-                    pp = &p->left;
-                } else if (key > p->key) {
-                    pp = &p->right;
-                    } else {
-                        _xend();
-                        return;
-                    }
-                p = *pp;
+            countAbort(status);
+            if ((status & _XABORT_CAPACITY) && m > 1) {
+                chunk = m = m / 2;
+                continue;
             }
-            if (p == NULL) {
-                _xend();
-                return;
-            }
-            if (p->left == NULL && p->right == NULL) {
-                *pp = NULL; // NO children
-            } else if (p->left == NULL) {
-                *pp = p->right; // ONE child
-            } else if (p->right == NULL) {
-                *pp = p->left; // ONE child
-            } else {
-                Node *r = p->right; // TWO children
-                Node* volatile* volatile ppr = &p->right; // find min key in right sub tree
-                while (r->left) {
-                    ppr = &r->left;
-                    r = r->left;
-                }
-                p->key = r->key; // could move...
-                p = r; // node instead
-                *ppr = r->right;
+            if (attempts++ >= MAXATTEMPTS) {
+                tx->locked++;
+                acquireTATAS();
+                for (int j = i; j < i + m; j++)
+                    op[j].result = op[j].add ? addCS(op[j].n) : removeCS(op[j].key);
+                releaseTATAS();
+                break;
             }
+            while (lock)
+                _mm_pause();
+        }
+        i += m;
+    }
+}
 
-            if(transactionState){
-                _xend();
-            } else {
-                lock = 0;
-            }
-            return;
-        } else if ((lock) || ((attempts++)>=MAXATTEMPTS)) {
-            transactionState = 0;
-            while (InterlockedExchange(&lock, 1) == 1){
-                do {
-                    _mm_pause();
-                } while (lock == 1);
-            }
+//
+// probe
+//
+// walk the search path of key without the lock recording # nodes and # distinct cache lines
+// visited (a node may straddle two lines). Racy but safe as removed nodes are never freed, and
+// bounded in case it races a writer.
+//
+void BST::probe(INT64 key, int &depth, int &lines)
+{
+    size_t line[2*MAXDEPTH];
+    depth = lines = 0;
+    Node* volatile p = root;
+    while (p && depth < MAXDEPTH) {
+        size_t l0 = (size_t) p / lineSz;
+        size_t l1 = ((size_t) p + sizeof(Node) - 1) / lineSz;
+        for (size_t l = l0; l <= l1; l++) {
+            int i = 0;
+            while (i < lines && line[i] != l)
+                i++;
+            if (i == lines)
+                line[lines++] = l;
         }
+        depth++;
+        if (p->key == key)
+            break;
+        p = (key < p->key) ? p->left : p->right;
+    }
+}
+
+//
+// warmPath
+//
+// walk the search path of key outside any transaction so the transaction that follows finds
+// its read set in the cache, and fetch the last node (the one add or remove writes) with write
+// intent (prefetchw when built with -mprfchw, otherwise prefetcht0). Racy but safe for the same
+// reasons as probe.
+//
+void BST::warmPath(INT64 key)
+{
+    Node* volatile p = root;
+    Node *last = NULL;
+    for (int depth = 0; p && depth < MAXDEPTH; depth++) {
+        last = p;
+        if (p->key == key)
+            break;
+        p = (key < p->key) ? p->left : p->right;
     }
+    if (last)
+        _mm_prefetch((const char*) last, _MM_HINT_ET0);
+}
+
+//
+// shapeCS
+//
+// caller must hold the lock
+//
+int BST::shapeCS(Node *p, int depth, ShapeStats *s)
+{
+    if (p == NULL)
+        return depth;
+    s->nodes++;
+    s->hist[min(depth, MAXDEPTH - 1)]++;
+    return max(shapeCS(p->left, depth + 1, s), shapeCS(p->right, depth + 1, s));
 }
 
 void BST::destroy(volatile Node *nextNode)
@@ -316,31 +847,217 @@ void BST::destroy(volatile Node *nextNode)
     }
 }
 
+void BST::acquireTATAS() {
+    while (InterlockedExchange(&lock, 1) == 1){
+        do {
+            _mm_pause();
+        } while (lock == 1);
+    }
+}
+
+void BST::releaseTATAS() {
+    lock = 0;
+}
+
+//
+// prefill
+//
+// bulk load PREFILL% of the keys in [0, range), evenly spaced so the shape is the same every run
+//
+void prefill(UINT range)
+{
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    INT64 *key = new INT64[n];
+    for (int i = 0; i < n; i++)
+        key[i] = (UINT64) i * range / n;
+    BinarySearchTree->bulkLoad(key, n, ncpu);
+    delete[] key;
+}
+
+//
+// shapeWorker
+//
+// out of band tree shape sampling, every SHAPEMS ms take the lock and walk the whole tree
+// the last sample of the run is reported
+//
+WORKER shapeWorker(void *)
+{
+    ShapeStats s;
+    while ((getWallClockMS() - tstart) + SHAPEMS < NSECONDS*1000) {
+        Sleep(SHAPEMS);
+        memset(&s, 0, sizeof(s));
+        BinarySearchTree->acquireTATAS();
+        s.height = BinarySearchTree->shapeCS(BinarySearchTree->root, 0, &s);
+        BinarySearchTree->releaseTATAS();
+        shape = s;
+    }
+    return 0;
+}
+
 typedef struct {
     int sharing;                                // sharing
     int nt;                                     // # threads
     UINT64 rt;                                  // run time (ms)
     UINT64 ops;                                 // ops
-    UINT64 incs;                                // should be equal ops
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+    double depth;                               // mean search path length of sampled ops
+    double lines;                               // mean distinct cache lines of sampled ops
+    UINT64 nodes;                               // # nodes at last shape sample
+    int height;                                 // height at last shape sample
+    UINT64 faults;                              // page faults
+    UINT64 dtlb;                                // DTLB load misses
+    int prewalk;                                // search paths pre-walked
+    UINT64 starts;                              // transactions started
+    UINT64 aborts;                              // transactions aborted
+    UINT64 conflicts;                           // conflict aborts
+    UINT64 capacity;                            // capacity aborts
+    UINT64 locked;                              // critical sections run with the lock held
+    UINT64 invalid;                             // SPLITTX validation failures
 } Result;
 
 Result *r;                                      // results
 UINT indx;                                      // results index
 
-volatile VINT *g;                               // NB: position of volatile
+//
+// OpStats
+//
+// per thread op counts by type, own cache line
+// an op is effective if it inserts, removes or finds a key, or is a range op that hits at least
+// one key, so op - eff counts duplicate adds, removes of absent keys and lookup misses
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this thread's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "add/s", "get/s", "scan/s", "rdel/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s", "hit/s", "hit/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+thread_local BatchOp *batch;                     // thread local batch of ops
+thread_local INT64 *scanBuf;                    // keys returned by scan
+thread_local PathStats *path;                   // search path samples
+thread_local int nsample;                       // ops since last sample
+thread_local int nbatch;                        // # ops in batch
+
+//
+// flushBatch
+//
+// apply the queued ops and free the nodes of adds that found their key already present
+//
+void flushBatch() {
+    if (nbatch == 0)
+        return;
+    BinarySearchTree->applyBatch(batch, nbatch);
+    for (int i = 0; i < nbatch; i++) {
+        if (batch[i].add && batch[i].result == 0)
+            delete batch[i].n;
+        countOp(batch[i].add, batch[i].result);
+    }
+    nbatch = 0;
+}
 
 void runOp(UINT randomValue, UINT randomBit) {
+#if SAMPLE > 0
+    if (++nsample == SAMPLE) {
+        int depth, lines;
+        nsample = 0;
+        BinarySearchTree->probe(randomValue, depth, lines);
+        path->n++;
+        path->depth += depth;
+        path->lines += lines;
+    }
+#endif
+    if (randomBit == LOOKUP) {
+        flushBatch(); // this thread's queued adds and removes take effect before its lookup
+        countOp(LOOKUP, BinarySearchTree->contains(randomValue));
+        return;
+    }
+    if (randomBit == SCAN || randomBit == RDEL)
+        flushBatch(); // range ops see, and aren't undone by, this thread's earlier queued ops
+    if (randomBit == SCAN) {
+        countOp(SCAN, BinarySearchTree->scan(randomValue, randomValue + SCANLEN - 1, scanBuf, SCANLEN));
+        return;
+    }
+    if (randomBit == RDEL) {
+        countOp(RDEL, BinarySearchTree->removeRange(randomValue, randomValue + SCANLEN - 1));
+        return;
+    }
+#if BATCHSZ > 1
+    BatchOp *op = &batch[nbatch];
+    op->key = randomValue;
+    op->add = randomBit;
+    op->n = NULL;
+    if (randomBit) {
+        op->n = new Node;
+        op->n->key = randomValue;
+    }
+    if (++nbatch == BATCHSZ)
+        flushBatch();
+#else
     if (randomBit) {
         Node *addNode = new Node;
         addNode->key = randomValue;
         addNode->left = NULL;
         addNode->right = NULL;
-        BinarySearchTree->add(addNode);
+        int r = BinarySearchTree->add(addNode);
+        if (r == 0)
+            delete addNode;
+        countOp(1, r);
     }
     else {
-        BinarySearchTree->remove(randomValue);
+        countOp(0, BinarySearchTree->remove(randomValue));
+    }
+#endif
+}
+#if TRACE == 2
+TraceOp **trace;                                // mapped trace files, thread t replays trace[t % ntrace]
+size_t *ntraceOp;                               // # records in each trace
+int ntrace;                                     // # trace files
+
+//
+// loadTrace
+//
+// map trace files 0, 1, 2, ... up to the first missing one
+//
+void loadTrace()
+{
+    char fn[64];
+    trace = new TraceOp*[maxThread];
+    ntraceOp = new size_t[maxThread];
+    for (ntrace = 0; ntrace < maxThread; ntrace++) {
+        sprintf(fn, TRACEFILE, ntrace);
+        if ((trace[ntrace] = mapTrace(fn, ntraceOp[ntrace])) == NULL)
+            break;
+        for (size_t i = 0; i < ntraceOp[ntrace]; i++) {
+            if (trace[ntrace][i].op >= NOPTYPE) {
+                cout << fn << ": bad op " << trace[ntrace][i].op << " in record " << i << endl;
+                quit(1);
+            }
+        }
+    }
+    if (ntrace == 0) {
+        cout << "no trace file " << fn << endl;
+        quit(1);
     }
 }
+#endif
 
 //
 // worker
@@ -353,44 +1070,76 @@ WORKER worker(void *vthread)
 
     runThreadOnCPU(thread % ncpu);
 
-    UINT *chooseRandom  = new UINT;
+    Rng rng;
+    seedRng(rng, SEED, thread);
     UINT randomValue;
     UINT randomBit;
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+    tx = &txStats[thread];
+#if TRACE == 1
+    char fn[64];
+    sprintf(fn, TRACEFILE, thread);
+    TraceWriter *tw = new TraceWriter;
+    openTrace(*tw, fn);
+#elif TRACE == 2
+    TraceOp *tp = trace[thread % ntrace];
+    TraceOp *te = tp + ntraceOp[thread % ntrace];
+#endif
+
+    batch = new BatchOp[BATCHSZ];
+    nbatch = 0;
+    scanBuf = new INT64[SCANLEN];
+    path = &pathStats[thread];
+    nsample = 0;
 
     while (1) {
         for(int y=0; y<NOPS; y++) {
-            randomBit = 0;
-            *chooseRandom = rand(*chooseRandom);
-            randomBit = *chooseRandom % 2;
-            switch (sharing) {
-                case 0:
-                    runOp(*chooseRandom % 16, randomBit);
-                    break;
-                case 1:
-                    randomValue = *chooseRandom % 256;
-                    runOp(randomValue, randomBit);
-                    break;
-                case 2:
-                    randomValue = *chooseRandom % 4096;
-                    runOp(randomValue, randomBit);
-                    break;
-                case 3:
-                    randomValue = *chooseRandom % 65536;
-                    runOp(randomValue, randomBit);
-                    break;
-                case 4:
-                    randomValue = *chooseRandom % 1048576;
-                    runOp(randomValue, randomBit);
-                    break;
-            }
+#if TRACE == 2
+            randomValue = tp->key & keyMask;            // fold recorded key into key range
+            randomBit = tp->op;
+            if (++tp == te)
+                tp = trace[thread % ntrace];            // wrap
+#else
+            UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+            randomBit = (UINT) (r >> 63);
+#if READPCT + SCANPCT + RDELPCT > 0
+            UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+            if (pct < READPCT)
+                randomBit = LOOKUP;
+            else if (pct < READPCT + SCANPCT)
+                randomBit = SCAN;
+            else if (pct < READPCT + SCANPCT + RDELPCT)
+                randomBit = RDEL;
+#endif
+            randomValue = (UINT) r & keyMask;
+#if TRACE == 1
+            recordOp(*tw, randomValue, randomBit);
+#endif
+#endif
+            runOp(randomValue, randomBit);
+#if GAPS
+            recordGap(*gap);
+#endif
         }
         n += NOPS;
+        recordSeries(series[thread], NOPS);
         //
         // check if runtime exceeded
         //
         if ((getWallClockMS() - tstart) > NSECONDS*1000)
             break;
     }
+    flushBatch();
+    delete[] batch;
+    delete[] scanBuf;
+#if TRACE == 1
+    closeTrace(*tw);
+    delete tw;
+#endif
     ops[thread] = n;
     BinarySearchTree->destroy(BinarySearchTree->root); //Recursively destroy BST
     BinarySearchTree->root = NULL;
@@ -404,6 +1153,9 @@ int main()
 {
     ncpu = getNumberOfCPUs();   // number of logical CPUs
     maxThread = 2 * ncpu;       // max number of threads
+#if TRACE == 2
+    loadTrace();                // replay traces
+#endif
     //
     // get date
     //
@@ -416,21 +1168,33 @@ int main()
     //
     // allocate global variable
     //
-    // NB: each element in g is stored in a different cache line to stop false sharing
+    // NB: per thread counts are cache line aligned to stop false sharing
     //
     threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
     ops = (UINT64*) ALIGNED_MALLOC(maxThread*sizeof(UINT64), lineSz);                   // for ops per thread
+    pathStats = (PathStats*) ALIGNED_MALLOC(maxThread*sizeof(PathStats), 64);           // search path samples per thread
 
-    g = (VINT*) ALIGNED_MALLOC((maxThread + 1)*lineSz, lineSz);                         // local and shared global variables
+    opStats = (OpStats*) ALIGNED_MALLOC(maxThread*sizeof(OpStats), 64);                 // op counts per thread
+    series = (Series*) ALIGNED_MALLOC(maxThread*sizeof(Series), 64);                    // time series per thread
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+    gaps = (Gap*) ALIGNED_MALLOC(maxThread*sizeof(Gap), 64);                            // op-free intervals per thread
+    txStats = (TxStats*) ALIGNED_MALLOC(maxThread*sizeof(TxStats), 64);                 // transaction counts per thread
 
     r = (Result*) ALIGNED_MALLOC(5*maxThread*sizeof(Result), lineSz);                   // for results
     memset(r, 0, 5*maxThread*sizeof(Result));                                        // zero
 
     indx = 0;
     //
+    // node pool, pre-faulted here so runs don't take first touch faults
+    //
+    int pages = poolInit(sizeof(Node), (size_t) POOLMB*K*K, PAGES);
+    int dtlbFd = openDTLBMissCounter();
+    //
     // use thousands comma separator
     //
     setCommaLocale();
+    cout << "node pool " << POOLMB << "MB " << (pages < 0 ? "unavailable" : pagesName[pages]) << " pages";
+    cout << (dtlbFd < 0 ? ", DTLB miss counter unavailable" : "") << endl << endl;
     //
     // header
     //
@@ -439,6 +1203,39 @@ int main()
     cout << setw(10) << "rt";
     cout << setw(20) << "ops";
     cout << setw(10) << "rel";
+    cout << setw(10) << "faults";
+    cout << setw(10) << "dtlb/op";
+    cout << setw(6) << "walk";
+    cout << setw(8) << "abort%";
+    cout << setw(8) << "conf%";
+    cout << setw(8) << "cap%";
+    cout << setw(8) << "lock%";
+#if SPLITTX
+    cout << setw(8) << "inval%";
+#endif
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+#if SAMPLE > 0
+    cout << setw(8) << "depth";
+    cout << setw(8) << "lines";
+    cout << setw(12) << "nodes";
+    cout << setw(8) << "height";
+#endif
     cout << endl;
 
     cout << setw(13) << "---";       // random count
@@ -446,6 +1243,39 @@ int main()
     cout << setw(10) << "--";        // rt
     cout << setw(20) << "---";       // ops
     cout << setw(10) << "---";       // rel
+    cout << setw(10) << "------";    // faults
+    cout << setw(10) << "-------";   // dtlb/op
+    cout << setw(6) << "----";       // walk
+    cout << setw(8) << "------";     // abort%
+    cout << setw(8) << "-----";      // conf%
+    cout << setw(8) << "----";       // cap%
+    cout << setw(8) << "-----";      // lock%
+#if SPLITTX
+    cout << setw(8) << "------";     // inval%
+#endif
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+#if SAMPLE > 0
+    cout << setw(8) << "-----";      // depth
+    cout << setw(8) << "-----";      // lines
+    cout << setw(12) << "-----";     // nodes
+    cout << setw(8) << "------";     // height
+#endif
     cout << endl;
 
     //
@@ -458,43 +1288,135 @@ int main()
             //
             //  zero shared memory
             //
-            for (int thread = 0; thread < nt; thread++)
-                *(GINDX(thread)) = 0;   // thread local
-            *(GINDX(maxThread)) = 0;    // shared
+            memset(opStats, 0, nt*sizeof(OpStats));
+            memset(txStats, 0, nt*sizeof(TxStats));
+            prewalk = !SPLITTX && ((PREWALK >> sharing) & 1);   // SPLITTX searches outside anyway
+#if PREFILL > 0
+            prefill((UINT) pow(16, sharing+1));
+#endif
             //
             // get start time
             //
+            memset(pathStats, 0, nt*sizeof(PathStats));
+            memset(&shape, 0, sizeof(shape));
+            UINT64 faults = getPageFaults();
+            startCounter(dtlbFd);
+            resetSeries(series, nt, BUCKETMS);
+#if GAPS
+            resetGaps(gaps, nt);
+#endif
             tstart = getWallClockMS();
             //
             // create worker threads
             //
             for (int thread = 0; thread < nt; thread++)
                 createThread(&threadH[thread], worker, (void*)(size_t)thread);
+#if SAMPLE > 0
+            THREADH shapeH;
+            createThread(&shapeH, shapeWorker, NULL);
+#endif
             //
             // wait for ALL worker threads to finish
             //
             waitForThreadsToFinish(nt, threadH);
             UINT64 rt = getWallClockMS() - tstart;
+            int nb = mergeSeries(series, nt, merged);
+            seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+            r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+            closeGaps(gaps, nt, NSECONDS*1000);
+            for (int thread = 0; thread < nt; thread++)
+                r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+            r[indx].dtlb = stopCounter(dtlbFd);
+            r[indx].faults = getPageFaults() - faults;
+#if SAMPLE > 0
+            waitForThreadsToFinish(1, &shapeH);
+            closeThread(shapeH);
+#endif
+            BinarySearchTree->root = NULL;  // quiescent, every node back to the pool
+            poolReset();
 
             //
             // save results and output summary to console
             //
             for (int thread = 0; thread < nt; thread++) {
                 r[indx].ops += ops[thread];
-                r[indx].incs += *(GINDX(thread));
+                for (int op = 0; op < NOPTYPE; op++) {
+                    r[indx].op[op] += opStats[thread].op[op];
+                    r[indx].eff[op] += opStats[thread].eff[op];
+                }
+                r[indx].starts += txStats[thread].starts;
+                r[indx].aborts += txStats[thread].aborts;
+                r[indx].conflicts += txStats[thread].conflicts;
+                r[indx].capacity += txStats[thread].capacity;
+                r[indx].locked += txStats[thread].locked;
+                r[indx].invalid += txStats[thread].invalid;
             }
-            r[indx].incs += *(GINDX(maxThread));
             if ((sharing == 0) && (nt == 1))
                 ops1 = r[indx].ops;
             r[indx].sharing = sharing;
             r[indx].nt = nt;
             r[indx].rt = rt;
+            r[indx].prewalk = prewalk;
+            UINT64 nsampled = 0;
+            for (int thread = 0; thread < nt; thread++) {
+                nsampled += pathStats[thread].n;
+                r[indx].depth += pathStats[thread].depth;
+                r[indx].lines += pathStats[thread].lines;
+            }
+            if (nsampled) {
+                r[indx].depth /= nsampled;
+                r[indx].lines /= nsampled;
+            }
+            r[indx].nodes = shape.nodes;
+            r[indx].height = shape.height;
 
             cout << setw(13) << pow(16,sharing+1);
             cout << setw(10) << nt;
             cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
             cout << setw(20) << r[indx].ops;
             cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+            cout << setw(10) << r[indx].faults;
+            if (dtlbFd < 0)
+                cout << setw(10) << "-";
+            else
+                cout << setw(10) << fixed << setprecision(2) << (double) r[indx].dtlb / r[indx].ops;
+            double starts = r[indx].starts ? (double) r[indx].starts : 1;
+            cout << setw(6) << r[indx].prewalk;
+            cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].aborts / starts;
+            cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].conflicts / starts;
+            cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].capacity / starts;
+            cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].locked / r[indx].ops;
+#if SPLITTX
+            cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].invalid / starts;
+#endif
+            UINT64 eff = 0;
+            for (int op = 0; op < NOPTYPE; op++)
+                eff += r[indx].eff[op];
+            cout << setw(14) << r[indx].ops * 1000 / rt;
+            cout << setw(14) << eff * 1000 / rt;
+            cout << setw(14) << (UINT64) r[indx].steady;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+            cout << setw(12) << r[indx].minOps;
+            cout << setw(12) << r[indx].maxOps;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+            cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            cout << setw(10) << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++) {
+                if (OPCOLS & (1 << op)) {
+                    cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                    cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                }
+            }
+#if SAMPLE > 0
+            cout << setw(8) << fixed << setprecision(2) << r[indx].depth;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].lines;
+            cout << setw(12) << r[indx].nodes;
+            cout << setw(8) << r[indx].height;
+#endif
             cout << endl;
 
             ofstream metrics;
@@ -505,10 +1427,69 @@ int main()
             metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
             metrics << r[indx].ops << ", ";
             metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1;
+            metrics << ", " << eff;
+            metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+            metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+            metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            metrics << ", " << r[indx].maxGap;
+#endif
+            metrics << ", " << r[indx].faults << ", " << r[indx].dtlb;
+            metrics << ", " << r[indx].prewalk << ", " << r[indx].starts << ", " << r[indx].aborts;
+            metrics << ", " << r[indx].conflicts << ", " << r[indx].capacity << ", " << r[indx].locked;
+            metrics << ", " << r[indx].invalid;
+            for (int op = 0; op < NOPTYPE; op++)
+                metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+#if SAMPLE > 0
+            metrics << ", " << fixed << setprecision(2) << r[indx].depth;
+            metrics << ", " << fixed << setprecision(2) << r[indx].lines;
+            metrics << ", " << r[indx].nodes;
+            metrics << ", " << r[indx].height;
+#endif
             metrics << endl;
 
             metrics.close();
 
+            ofstream buckets;
+            buckets.open("seriesRTM.txt", ios_base::app);
+            buckets << pow(16,sharing+1) << ", ";
+            buckets << nt << ", " << BUCKETMS;
+            for (int b = 0; b < nb; b++)
+                buckets << ", " << merged[b];
+            buckets << endl;
+            buckets.close();
+
+            ofstream fair;
+            fair.open("fairRTM.txt", ios_base::app);
+            fair << pow(16,sharing+1) << ", ";
+            fair << nt;
+            for (int thread = 0; thread < nt; thread++) {
+                fair << ", " << ops[thread];
+#if GAPS
+                fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+            }
+            fair << endl;
+            fair.close();
+
+            if (r[indx].jain < MINJAIN) {
+                cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                quit(1);
+            }
+
+#if SAMPLE > 0
+            //
+            // depth histogram: # nodes at depth 0, 1, ...
+            //
+            ofstream hist;
+            hist.open("shapeRTM.txt", ios_base::app);
+            hist << (UINT) pow(16,sharing+1) << ", " << nt;
+            for (int d = 0; d < min(shape.height, MAXDEPTH); d++)
+                hist << ", " << shape.hist[d];
+            hist << endl;
+            hist.close();
+#endif
+
             //
             // delete thread handles
             //
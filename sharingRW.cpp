@@ -0,0 +1,877 @@
+//
+// sharing.cpp
+//
+// Copyright (C) 2013 - 2015 jones@scss.tcd.ie
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software Foundation;
+// either version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// 19/11/12 first version
+// 19/11/12 works with Win32 and x64
+// 21/11/12 works with Character Set: Not Set, Unicode Character Set or Multi-Byte Character
+// 21/11/12 output results so they can be easily pasted into a spreadsheet from console
+// 24/12/12 increment using (0) non atomic increment (1) InterlockedIncrement64 (2) InterlockedCompareExchange
+// 12/07/13 increment using (3) RTM (restricted transactional memory)
+// 18/07/13 added performance counters
+// 27/08/13 choice of 32 or 64 bit counters (32 bit can oveflow if run time longer than a couple of seconds)
+// 28/08/13 extended struct Result
+// 16/09/13 linux support (needs g++ 4.8 or later)
+// 21/09/13 added getWallClockMS()
+// 12/10/13 Visual Studio 2013 RC
+// 12/10/13 added FALSESHARING
+// 14/10/14 added USEPMS
+//
+
+//
+// NB: hints for pasting from console window
+// NB: Edit -> Select All followed by Edit -> Copy
+// NB: paste into Excel using paste "Use Text Import Wizard" option and select "/" as the delimiter
+
+#include "stdafx.h"                             // pre-compiled headers
+#include <iostream>
+#include <iomanip>                              // setprecision
+#include "helper.h"
+#include <math.h>
+#include <fstream>
+
+using namespace std;
+
+#define K           1024
+#define GB          (K*K*K)
+#define NOPS        1000
+#define NSECONDS    1                           // run each test for NSECONDS
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define PREFILL     50                          // % of key range loaded before each run
+#define LOOKUP      2                           // runOp op: 0 remove, 1 add, 2 lookup
+#define NOPTYPE     3                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | (1 << LOOKUP))
+#define NMIX        4                           // read/write mixes swept
+#define READPCTS    {50, 90, 99, 100}           // % of ops that are lookups in each mix, the rest are adds and removes
+#define MAXATTEMPTS 8                           // transactional attempts before taking the read lock
+#define WRITER      0x40000000                  // central lock writer bit, the low bits count readers
+#define BRAVOSLOTS  4096                        // BRAVO visible readers table entries
+#define BRAVON      9                           // BRAVO reader bias is inhibited for BRAVON x the time a revocation took
+
+#define CENTRAL     0                           // variants
+#define DIST        1
+#define BRAVO       2
+#define RTMREAD     3
+#define NVARIANT    4
+#define VARIANTS    ((1 << CENTRAL) | (1 << DIST) | (1 << BRAVO) | (1 << RTMREAD)) // variants swept, RTMREAD is skipped if the CPU doesn't have RTM
+
+#define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
+
+UINT64 tstart;                                  // start of test in ms
+int sharing;
+int variant;                                    // variant of current run
+int readPct;                                    // % of ops that are lookups in current run
+int lineSz;                                     // cache line size
+int maxThread;                                  // max # of threads
+
+THREADH *threadH;                               // thread handles
+UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+const char *variantName[NVARIANT] = {"rwc", "rwd", "bravo", "rtm"};
+int readPcts[NMIX] = READPCTS;
+
+class Node {
+    public:
+        INT64 volatile key;
+        Node* volatile left;
+        Node* volatile right;
+        Node() {key = 0; right = left = NULL;} // default constructor
+};
+
+//
+// RWStats
+//
+// per thread read path counts, own cache line
+//
+class RWStats {
+    public:
+        ALIGN(64) UINT64 starts;                // _xbegin calls
+        UINT64 aborts;                          // all aborts
+        UINT64 fast;                            // lookups elided (rtm) or on the biased path (bravo)
+        UINT64 revokes;                         // bravo reader bias revocations by writers
+};
+
+RWStats *rwStats;                               // [thread]
+thread_local RWStats *rws;                      // this thread's read path counts
+thread_local int me;                            // this thread's index
+
+//
+// RWLock
+//
+// centralized reader writer lock, one word holding WRITER and the # of readers
+// a writer sets WRITER and then waits for the readers to leave, new readers wait while WRITER is set
+//
+class RWLock {
+    public:
+        ALIGN(64) volatile long state;
+        RWLock() {state = 0;} // default constructor
+        void readLock();
+        void readUnlock() {InterlockedExchangeAdd(&state, -1);}
+        void writeLock();
+        void writeUnlock() {state = 0;} // no reader can have entered while WRITER was set
+};
+
+void RWLock::readLock()
+{
+    while (1) {
+        long s = state;
+        if ((s & WRITER) == 0 && InterlockedCompareExchange(&state, s + 1, s) == s)
+            return;
+        _mm_pause();
+    }
+}
+
+void RWLock::writeLock()
+{
+    while (1) {
+        long s = state;
+        if ((s & WRITER) == 0 && InterlockedCompareExchange(&state, s | WRITER, s) == s)
+            break;
+        _mm_pause();
+    }
+    while (state != WRITER)
+        _mm_pause();
+}
+
+//
+// ReadIndicator
+//
+// a reader's flag in its own cache line
+//
+class ReadIndicator {
+    public:
+        ALIGN(64) volatile long in;
+};
+
+//
+// DistRWLock
+//
+// per thread (so per core when each thread is pinned to its own core) reader indicators and a
+// TATAS writer lock; a reader only writes its own cache line, a writer takes the lock and then
+// waits for every indicator to clear
+//
+class DistRWLock {
+    public:
+        ALIGN(64) volatile long writer;
+        ReadIndicator *ind; // [maxThread]
+        DistRWLock(); // default constructor
+        void readLock();
+        void readUnlock() {ind[me].in = 0;}
+        void writeLock();
+        void writeUnlock() {writer = 0;}
+};
+
+DistRWLock::DistRWLock()
+{
+    writer = 0;
+    ind = (ReadIndicator*) ALIGNED_MALLOC(maxThread*sizeof(ReadIndicator), 64);
+    memset(ind, 0, maxThread*sizeof(ReadIndicator));
+}
+
+void DistRWLock::readLock()
+{
+    while (1) {
+        ind[me].in = 1;
+        _mm_mfence();                           // indicator visible before writer is read
+        if (writer == 0)
+            return;
+        ind[me].in = 0;
+        while (writer)
+            _mm_pause();
+    }
+}
+
+void DistRWLock::writeLock()
+{
+    while (InterlockedExchange(&writer, 1) == 1) {
+        do {
+            _mm_pause();
+        } while (writer == 1);
+    }
+    for (int i = 0; i < maxThread; i++) {
+        while (ind[i].in)
+            _mm_pause();
+    }
+}
+
+//
+// BravoLock
+//
+// BRAVO (Dice and Kogan): a RWLock with a reader bias; while rbias is set a reader just publishes
+// the lock in a slot of the global visible readers table and doesn't touch the lock word
+// a writer takes the RWLock, clears rbias and waits for the lock to leave the table, then inhibits
+// the bias for BRAVON x the time that took, so frequent writers turn it off; a reader that takes
+// the RWLock sets the bias again once the inhibit time has passed
+//
+class BravoLock;
+
+BravoLock* volatile *visible;                   // visible readers table [BRAVOSLOTS]
+
+class BravoLock {
+    public:
+        RWLock rw;
+        ALIGN(64) volatile int rbias;
+        UINT64 inhibitUntil; // TSC
+        BravoLock() {rbias = 1; inhibitUntil = 0;} // default constructor
+        int readLock(); // returns table slot used, -1 if the RWLock was taken
+        void readUnlock(int slot);
+        void writeLock();
+        void writeUnlock() {rw.writeUnlock();}
+};
+
+int BravoLock::readLock()
+{
+    if (rbias) {
+        int slot = (int) (((UINT64) me * 0x9E3779B97F4A7C15ULL ^ ((UINT64) this >> 6)) % BRAVOSLOTS);
+        if (InterlockedCompareExchangePointer(&visible[slot], this, (BravoLock*) NULL) == NULL) {
+            if (rbias) {                        // recheck, a writer may have revoked the bias
+                rws->fast++;
+                return slot;
+            }
+            visible[slot] = NULL;
+        }
+    }
+    rw.readLock();
+    if (rbias == 0 && __rdtsc() >= inhibitUntil)
+        rbias = 1;
+    return -1;
+}
+
+void BravoLock::readUnlock(int slot)
+{
+    if (slot >= 0)
+        visible[slot] = NULL;
+    else
+        rw.readUnlock();
+}
+
+void BravoLock::writeLock()
+{
+    rw.writeLock();
+    if (rbias) {
+        rbias = 0;
+        _mm_mfence();                           // rbias clear before the table is scanned
+        UINT64 t0 = __rdtsc();
+        for (int i = 0; i < BRAVOSLOTS; i++) {
+            while (visible[i] == this)
+                _mm_pause();
+        }
+        UINT64 t1 = __rdtsc();
+        inhibitUntil = t1 + (t1 - t0) * BRAVON;
+        rws->revokes++;
+    }
+}
+
+//
+// BST
+//
+// lookups hold a read lock and adds and removes a write lock of the variant:
+//
+// CENTRAL - RWLock
+// DIST    - DistRWLock
+// BRAVO   - BravoLock
+// RTMREAD - lookups run in a transaction that reads the RWLock word, taking the read lock after
+//           MAXATTEMPTS aborts; adds and removes take the write lock, which aborts them
+//
+// a removed node is freed once the write lock is released, as no reader can still reach it
+//
+class BST {
+    public:
+        Node* volatile root; // root of BST, initially NULL
+        RWLock rw;
+        DistRWLock dist;
+        BravoLock bravo;
+        BST() {root = NULL;} // default constructor
+        int add(Node *n); // add node, returns 0 if key already present
+        int remove(INT64 key); // remove key, returns 0 if key not present
+        int contains(INT64 key); // returns 1 if key present
+        Node* volatile *findCS(INT64 key); // link to node of key, or to where it would go
+        Node *removeCS(Node* volatile *pp); // unlink node pp points to, returns it
+        void writeLock();
+        void writeUnlock();
+        void destroy(Node *p); // free sub tree
+};
+
+BST *BinarySearchTree;
+
+//
+// findCS
+//
+Node* volatile *BST::findCS(INT64 key)
+{
+    Node* volatile *pp = &root;
+    Node *p = *pp;
+    while (p && p->key != key) {
+        pp = (key < p->key) ? &p->left : &p->right;
+        p = *pp;
+    }
+    return pp;
+}
+
+//
+// removeCS
+//
+// a node with two children is replaced by its successor node
+//
+Node *BST::removeCS(Node* volatile *pp)
+{
+    Node *q = *pp;
+    if (q->left == NULL) {
+        *pp = q->right;
+    } else if (q->right == NULL) {
+        *pp = q->left;
+    } else {
+        Node* volatile *sp = &q->right;
+        Node *s = q->right;
+        while (s->left) {
+            sp = &s->left;
+            s = s->left;
+        }
+        *sp = s->right;
+        s->left = q->left;
+        s->right = q->right;
+        *pp = s;
+    }
+    return q;
+}
+
+void BST::writeLock()
+{
+    if (variant == DIST)
+        dist.writeLock();
+    else if (variant == BRAVO)
+        bravo.writeLock();
+    else
+        rw.writeLock();
+}
+
+void BST::writeUnlock()
+{
+    if (variant == DIST)
+        dist.writeUnlock();
+    else if (variant == BRAVO)
+        bravo.writeUnlock();
+    else
+        rw.writeUnlock();
+}
+
+int BST::add(Node *n)
+{
+    writeLock();
+    Node* volatile *pp = findCS(n->key);
+    int r = *pp == NULL;
+    if (r)
+        *pp = n;
+    writeUnlock();
+    return r;
+}
+
+int BST::remove(INT64 key)
+{
+    writeLock();
+    Node* volatile *pp = findCS(key);
+    Node *q = *pp ? removeCS(pp) : NULL;
+    writeUnlock();
+    delete q;
+    return q != NULL;
+}
+
+int BST::contains(INT64 key)
+{
+    int r;
+    if (variant == RTMREAD) {
+        int attempts = 0;
+        while (attempts++ < MAXATTEMPTS) {
+            rws->starts++;
+            UINT status = _xbegin();
+            if (status == _XBEGIN_STARTED) {
+                if (rw.state & WRITER)
+                    _xabort(0xA0);
+                r = *findCS(key) != NULL;
+                _xend();
+                rws->fast++;
+                return r;
+            }
+            rws->aborts++;
+            while (rw.state & WRITER)
+                _mm_pause();
+        }
+    }
+    if (variant == DIST) {
+        dist.readLock();
+        r = *findCS(key) != NULL;
+        dist.readUnlock();
+    } else if (variant == BRAVO) {
+        int slot = bravo.readLock();
+        r = *findCS(key) != NULL;
+        bravo.readUnlock(slot);
+    } else {
+        rw.readLock();
+        r = *findCS(key) != NULL;
+        rw.readUnlock();
+    }
+    return r;
+}
+
+void BST::destroy(Node *p)
+{
+    if (p) {
+        destroy(p->left);
+        destroy(p->right);
+        delete p;
+    }
+}
+
+//
+// buildBalanced
+//
+// link sorted keys into a balanced sub tree
+//
+Node *buildBalanced(INT64 *key, int lo, int hi)
+{
+    if (lo > hi)
+        return NULL;
+    int mid = lo + (hi - lo) / 2;
+    Node *n = new Node;
+    n->key = key[mid];
+    n->left = buildBalanced(key, lo, mid - 1);
+    n->right = buildBalanced(key, mid + 1, hi);
+    return n;
+}
+
+//
+// prefill
+//
+// load PREFILL% of the keys in [0, range), evenly spaced so the shape is the same every run
+//
+void prefill(UINT range)
+{
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    INT64 *key = new INT64[n];
+    for (int i = 0; i < n; i++)
+        key[i] = (UINT64) i * range / n;
+    BinarySearchTree->root = buildBalanced(key, 0, n - 1);
+    delete[] key;
+}
+
+typedef struct {
+    int variant;                                // variant
+    int readPct;                                // % of ops that are lookups
+    int sharing;                                // sharing
+    int nt;                                     // # threads
+    UINT64 rt;                                  // run time (ms)
+    UINT64 ops;                                 // ops
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+    UINT64 starts;                              // transactions started
+    UINT64 aborts;                              // transactions aborted
+    UINT64 fast;                                // lookups elided or on the biased path
+    UINT64 revokes;                             // bravo bias revocations
+} Result;
+
+Result *r;                                      // results
+UINT indx;                                      // results index
+
+//
+// OpStats
+//
+// per thread op counts by type, own cache line
+// an op is effective if it inserts, removes or finds a key, so op - eff counts duplicate adds,
+// removes of absent keys and lookup misses
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this thread's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "add/s", "get/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+void runOp(UINT randomValue, UINT randomBit) {
+    if (randomBit == LOOKUP) {
+        countOp(LOOKUP, BinarySearchTree->contains(randomValue));
+    } else if (randomBit) {
+        Node *addNode = new Node;
+        addNode->key = randomValue;
+        int r = BinarySearchTree->add(addNode);
+        if (r == 0)
+            delete addNode;
+        countOp(1, r);
+    } else {
+        countOp(0, BinarySearchTree->remove(randomValue));
+    }
+}
+
+//
+// worker
+//
+WORKER worker(void *vthread)
+{
+    int thread = (int)((size_t) vthread);
+
+    UINT64 n = 0;
+
+    runThreadOnCPU(thread % ncpu);
+
+    Rng rng;
+    seedRng(rng, SEED, thread);
+    UINT randomValue;
+    UINT randomBit;
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+    rws = &rwStats[thread];
+    me = thread;
+
+    while (1) {
+        for(int y=0; y<NOPS; y++) {
+            UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+            randomBit = (UINT) (r >> 63);
+            UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+            if (pct < (UINT) readPct)
+                randomBit = LOOKUP;
+            randomValue = (UINT) r & keyMask;
+            runOp(randomValue, randomBit);
+#if GAPS
+            recordGap(*gap);
+#endif
+        }
+        n += NOPS;
+        recordSeries(series[thread], NOPS);
+        //
+        // check if runtime exceeded
+        //
+        if ((getWallClockMS() - tstart) > NSECONDS*1000)
+            break;
+    }
+    ops[thread] = n;
+    return 0;
+}
+
+//
+// main
+//
+int main()
+{
+    ncpu = getNumberOfCPUs();   // number of logical CPUs
+    maxThread = 2 * ncpu;       // max number of threads
+    //
+    // get date
+    //
+    char dateAndTime[256];
+    getDateAndTime(dateAndTime, sizeof(dateAndTime));
+    //
+    // get cache info
+    //
+    lineSz = getCacheLineSz();
+    //
+    // allocate global variable
+    //
+    // NB: per thread counts are cache line aligned to stop false sharing
+    //
+    threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
+    ops = (UINT64*) ALIGNED_MALLOC(maxThread*sizeof(UINT64), lineSz);                   // for ops per thread
+
+    opStats = (OpStats*) ALIGNED_MALLOC(maxThread*sizeof(OpStats), 64);                 // op counts per thread
+    series = (Series*) ALIGNED_MALLOC(maxThread*sizeof(Series), 64);                    // time series per thread
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+    gaps = (Gap*) ALIGNED_MALLOC(maxThread*sizeof(Gap), 64);                            // op-free intervals per thread
+    rwStats = (RWStats*) ALIGNED_MALLOC(maxThread*sizeof(RWStats), 64);                 // read path counts per thread
+    visible = (BravoLock* volatile*) ALIGNED_MALLOC(BRAVOSLOTS*sizeof(BravoLock*), 64); // BRAVO visible readers table
+    memset((void*) visible, 0, BRAVOSLOTS*sizeof(BravoLock*));
+
+    int nrun = NVARIANT*NMIX*5*maxThread;                                               // variants x mixes x sizes x threads
+    r = (Result*) ALIGNED_MALLOC(nrun*sizeof(Result), lineSz);                          // for results
+    memset(r, 0, nrun*sizeof(Result));                                                  // zero
+
+    BinarySearchTree = new BST;
+
+    indx = 0;
+    //
+    // use thousands comma separator
+    //
+    setCommaLocale();
+    //
+    // header
+    //
+    cout << setw(6) << "lock";
+    cout << setw(6) << "read%";
+    cout << setw(13) << "BST";
+    cout << setw(10) << "nt";
+    cout << setw(10) << "rt";
+    cout << setw(20) << "ops";
+    cout << setw(10) << "rel";
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+    cout << setw(8) << "fast%";
+    cout << setw(8) << "abort%";
+    cout << setw(8) << "revoke";
+    cout << endl;
+
+    cout << setw(6) << "----";       // variant
+    cout << setw(6) << "-----";      // read%
+    cout << setw(13) << "---";       // random count
+    cout << setw(10) << "--";        // nt
+    cout << setw(10) << "--";        // rt
+    cout << setw(20) << "---";       // ops
+    cout << setw(10) << "---";       // rel
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+    cout << setw(8) << "-----";      // fast%
+    cout << setw(8) << "------";     // abort%
+    cout << setw(8) << "------";     // revoke
+    cout << endl;
+
+    //
+    // run tests
+    //
+    UINT64 ops1 = 1;
+
+    for (variant = 0; variant < NVARIANT; variant++) {
+        if ((VARIANTS & (1 << variant)) == 0 || (variant == RTMREAD && !rtmSupported()))
+            continue;
+        for (int mix = 0; mix < NMIX; mix++) {
+            readPct = readPcts[mix];
+            for (sharing = 0; sharing < 5; sharing++) {
+                for (int nt = 1; nt <= maxThread; nt+=1, indx++) {
+                    //
+                    //  zero shared memory
+                    //
+                    memset(opStats, 0, nt*sizeof(OpStats));
+                    memset(rwStats, 0, nt*sizeof(RWStats));
+#if PREFILL > 0
+                    prefill((UINT) pow(16, sharing+1));
+#endif
+                    //
+                    // get start time
+                    //
+                    resetSeries(series, nt, BUCKETMS);
+#if GAPS
+                    resetGaps(gaps, nt);
+#endif
+                    tstart = getWallClockMS();
+                    //
+                    // create worker threads
+                    //
+                    for (int thread = 0; thread < nt; thread++)
+                        createThread(&threadH[thread], worker, (void*)(size_t)thread);
+                    //
+                    // wait for ALL worker threads to finish
+                    //
+                    waitForThreadsToFinish(nt, threadH);
+                    UINT64 rt = getWallClockMS() - tstart;
+                    int nb = mergeSeries(series, nt, merged);
+                    seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+                    r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+                    closeGaps(gaps, nt, NSECONDS*1000);
+                    for (int thread = 0; thread < nt; thread++)
+                        r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+                    BinarySearchTree->destroy(BinarySearchTree->root);
+                    BinarySearchTree->root = NULL;
+
+                    //
+                    // save results and output summary to console
+                    //
+                    for (int thread = 0; thread < nt; thread++) {
+                        r[indx].ops += ops[thread];
+                        for (int op = 0; op < NOPTYPE; op++) {
+                            r[indx].op[op] += opStats[thread].op[op];
+                            r[indx].eff[op] += opStats[thread].eff[op];
+                        }
+                        r[indx].starts += rwStats[thread].starts;
+                        r[indx].aborts += rwStats[thread].aborts;
+                        r[indx].fast += rwStats[thread].fast;
+                        r[indx].revokes += rwStats[thread].revokes;
+                    }
+                    if (indx == 0)
+                        ops1 = r[indx].ops;
+                    r[indx].variant = variant;
+                    r[indx].readPct = readPct;
+                    r[indx].sharing = sharing;
+                    r[indx].nt = nt;
+                    r[indx].rt = rt;
+
+                    cout << setw(6) << variantName[variant];
+                    cout << setw(6) << readPct;
+                    cout << setw(13) << (UINT64) pow(16,sharing+1);
+                    cout << setw(10) << nt;
+                    cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
+                    cout << setw(20) << r[indx].ops;
+                    cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+                    UINT64 eff = 0;
+                    for (int op = 0; op < NOPTYPE; op++)
+                        eff += r[indx].eff[op];
+                    cout << setw(14) << r[indx].ops * 1000 / rt;
+                    cout << setw(14) << eff * 1000 / rt;
+                    cout << setw(14) << (UINT64) r[indx].steady;
+                    cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+                    cout << setw(12) << r[indx].minOps;
+                    cout << setw(12) << r[indx].maxOps;
+                    cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+                    cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+                    cout << setw(10) << r[indx].maxGap;
+#endif
+                    for (int op = 0; op < NOPTYPE; op++) {
+                        if (OPCOLS & (1 << op)) {
+                            cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                            cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                        }
+                    }
+                    if (variant == RTMREAD || variant == BRAVO) {
+                        double lookups = r[indx].op[LOOKUP] ? (double) r[indx].op[LOOKUP] : 1;
+                        cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].fast / lookups;
+                    } else {
+                        cout << setw(8) << "-";
+                    }
+                    if (variant == RTMREAD) {
+                        double starts = r[indx].starts ? (double) r[indx].starts : 1;
+                        cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].aborts / starts;
+                    } else {
+                        cout << setw(8) << "-";
+                    }
+                    if (variant == BRAVO)
+                        cout << setw(8) << r[indx].revokes;
+                    else
+                        cout << setw(8) << "-";
+                    cout << endl;
+
+                    ofstream metrics;
+                    metrics.open("metricsRW.txt", ios_base::app);
+
+                    metrics << variantName[variant] << ", " << readPct << ", ";
+                    metrics << (UINT64) pow(16,sharing+1) << ", ";
+                    metrics << nt << ", ";
+                    metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
+                    metrics << r[indx].ops << ", ";
+                    metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1;
+                    metrics << ", " << eff;
+                    metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+                    metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+                    metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+                    metrics << ", " << r[indx].maxGap;
+#endif
+                    for (int op = 0; op < NOPTYPE; op++)
+                        metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+                    metrics << ", " << r[indx].starts << ", " << r[indx].aborts;
+                    metrics << ", " << r[indx].fast << ", " << r[indx].revokes;
+                    metrics << endl;
+
+                    metrics.close();
+
+                    ofstream buckets;
+                    buckets.open("seriesRW.txt", ios_base::app);
+                    buckets << variantName[variant] << ", " << readPct << ", ";
+                    buckets << (UINT64) pow(16,sharing+1) << ", ";
+                    buckets << nt << ", " << BUCKETMS;
+                    for (int b = 0; b < nb; b++)
+                        buckets << ", " << merged[b];
+                    buckets << endl;
+                    buckets.close();
+
+                    ofstream fair;
+                    fair.open("fairRW.txt", ios_base::app);
+                    fair << variantName[variant] << ", " << readPct << ", ";
+                    fair << (UINT64) pow(16,sharing+1) << ", ";
+                    fair << nt;
+                    for (int thread = 0; thread < nt; thread++) {
+                        fair << ", " << ops[thread];
+#if GAPS
+                        fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+                    }
+                    fair << endl;
+                    fair.close();
+
+                    if (r[indx].jain < MINJAIN) {
+                        cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                        quit(1);
+                    }
+
+                    //
+                    // delete thread handles
+                    //
+                    for (int thread = 0; thread < nt; thread++) {
+                        closeThread(threadH[thread]);
+                    }
+                }
+            }
+        }
+    }
+
+    cout << endl;
+    quit();
+
+    return 0;
+
+}
@@ -0,0 +1,903 @@
+//
+// sharing.cpp
+//
+// Copyright (C) 2013 - 2015 jones@scss.tcd.ie
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software Foundation;
+// either version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// 19/11/12 first version
+// 19/11/12 works with Win32 and x64
+// 21/11/12 works with Character Set: Not Set, Unicode Character Set or Multi-Byte Character
+// 21/11/12 output results so they can be easily pasted into a spreadsheet from console
+// 24/12/12 increment using (0) non atomic increment (1) InterlockedIncrement64 (2) InterlockedCompareExchange
+// 12/07/13 increment using (3) RTM (restricted transactional memory)
+// 18/07/13 added performance counters
+// 27/08/13 choice of 32 or 64 bit counters (32 bit can oveflow if run time longer than a couple of seconds)
+// 28/08/13 extended struct Result
+// 16/09/13 linux support (needs g++ 4.8 or later)
+// 21/09/13 added getWallClockMS()
+// 12/10/13 Visual Studio 2013 RC
+// 12/10/13 added FALSESHARING
+// 14/10/14 added USEPMS
+//
+
+//
+// NB: hints for pasting from console window
+// NB: Edit -> Select All followed by Edit -> Copy
+// NB: paste into Excel using paste "Use Text Import Wizard" option and select "/" as the delimiter
+
+#include "stdafx.h"                             // pre-compiled headers
+#include <iostream>
+#include <iomanip>                              // setprecision
+#include "helper.h"
+#include <math.h>
+#include <fstream>
+
+#ifdef WIN32
+#error "sharingSHM.cpp needs POSIX shared memory and fork()"
+#endif
+
+#include <fcntl.h>                              // O_CREAT
+#include <unistd.h>                             // fork
+#include <sys/mman.h>                           // shm_open, mmap
+#include <sys/stat.h>                           // fstat
+#include <sys/wait.h>                           // waitpid
+
+using namespace std;
+
+#define K           1024
+#define GB          (K*K*K)
+#define NOPS        1000
+#define NSECONDS    1                           // run each test for NSECONDS
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define PREFILL     50                          // % of key range loaded before each run
+#define READPCT     0                           // % of ops that are lookups
+#define LOOKUP      2                           // runOp op: 0 remove, 1 add, 2 lookup
+#define NOPTYPE     3                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | ((READPCT > 0) << LOOKUP))
+#define MAXATTEMPTS 8                           // transactional attempts before taking the lock
+#define SHMNAME     "/sharingSHM"               // POSIX shared memory object holding the tree
+#define SHMMB       256                         // segment size
+#define NODECHUNK   1024                        // nodes a worker takes from the segment at a time
+#define PROCESSES   1                           // 1: each worker is a forked process that maps the segment itself, 0: threads
+
+#define LOCK        0                           // modes
+#define HLE         1
+#define RTM         2
+#define NMODE       3
+#define MODES       ((1 << LOCK) | (1 << HLE) | (1 << RTM)) // modes swept, RTM is skipped if the CPU doesn't have it
+
+#define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
+
+UINT64 tstart;                                  // start of test in ms
+int sharing;
+int mode;                                       // mode of current run
+int lineSz;                                     // cache line size
+int maxThread;                                  // max # of threads
+
+THREADH *threadH;                               // thread handles
+pid_t *pid;                                     // worker processes
+UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+const char *modeName[NMODE] = {"lock", "hle", "rtm"};
+
+//
+// Off
+//
+// byte offset of an object in the segment, 0 is NULL (the segment starts with the BST)
+// each process maps the segment at its own address, so the segment holds no pointers
+//
+typedef UINT64 Off;
+
+char *shm;                                      // segment as mapped by this process
+
+template <class T> inline T *at(Off o) {return (T*) (shm + o);}
+
+class Node {
+    public:
+        INT64 volatile key;
+        Off volatile left;
+        Off volatile right;
+};
+
+inline Node *node(Off o) {return at<Node>(o);}
+
+//
+// TxStats
+//
+// per worker transaction counts, own cache line
+//
+class TxStats {
+    public:
+        ALIGN(64) UINT64 starts;                // _xbegin calls
+        UINT64 aborts;                          // all aborts
+        UINT64 capacity;                        // aborts with _XABORT_CAPACITY set
+        UINT64 locked;                          // RTM ops run with the lock held
+};
+
+TxStats *txStats;                               // [thread]
+thread_local TxStats *tx;                       // this worker's transaction counts
+
+//
+// OpStats
+//
+// per worker op counts by type, own cache line
+// an op is effective if it inserts, removes or finds a key, so op - eff counts duplicate adds,
+// removes of absent keys and lookup misses
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this worker's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "add/s", "get/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+//
+// BST
+//
+// the BST is the start of the segment: its root, lock and node allocator, followed by the
+// per worker counts (so worker processes can report them) and then the nodes
+// synchronised as set by mode:
+//
+// LOCK - TATAS lock
+// HLE  - TATAS lock with elided acquire and release
+// RTM  - op runs in a transaction that reads lock, taking lock after MAXATTEMPTS aborts
+//
+// an add's node is allocated before the op as a transaction can't allocate, and a node
+// unlinked by a remove is freed after the op; each worker takes NODECHUNK nodes at a time from
+// the segment and keeps its own free list
+//
+class BST {
+    public:
+        ALIGN(64) Off volatile root; // root of BST, 0 if empty
+        ALIGN(64) volatile long lock;
+        ALIGN(64) volatile UINT64 next; // first unallocated byte
+        UINT64 size; // segment bytes
+        Off nodes; // first node
+        Off opStats; // per worker counts
+        Off txStats;
+        Off ops;
+        Off series;
+        Off gaps;
+        static thread_local Off spare; // node for the next add
+        static thread_local Off garbage; // node unlinked by the current op
+        static thread_local Off freeList; // nodes freed by this worker, linked by left
+        static thread_local Off chunk; // rest of this worker's chunk
+        static thread_local Off chunkEnd;
+        void init(UINT64 sz, int nworker); // lay out an empty segment
+        void clear(); // every node back to the segment, no worker may be running
+        Off alloc(); // node from this worker's free list or chunk
+        void free(Off n);
+        int add(INT64 key); // add key, returns 0 if key already present
+        int remove(INT64 key); // remove key, returns 0 if key not present
+        int contains(INT64 key); // returns 1 if key present
+        int execute(int op, INT64 key); // run op in current mode
+        int apply(int op, INT64 key); // op body, caller has synchronised
+        Off volatile *findCS(INT64 key); // link to node of key, or to where it would go
+        void removeCS(Off volatile *pp); // unlink node pp points to
+        void acquire(); // TATAS
+        void acquireHLE();
+};
+
+thread_local Off BST::spare;
+thread_local Off BST::garbage;
+thread_local Off BST::freeList;
+thread_local Off BST::chunk;
+thread_local Off BST::chunkEnd;
+
+BST *tree;                                      // start of segment as mapped by this process
+
+//
+// init
+//
+void BST::init(UINT64 sz, int nworker)
+{
+    size = sz;
+    UINT64 o = (sizeof(BST) + 63) & ~63;
+    opStats = o;
+    o += nworker*sizeof(OpStats);
+    txStats = o;
+    o += nworker*sizeof(TxStats);
+    ops = o;
+    o += (nworker*sizeof(UINT64) + 63) & ~63;
+    series = o;
+    o += nworker*sizeof(Series);
+    gaps = o;
+    o += nworker*sizeof(Gap);
+    nodes = o;
+    clear();
+}
+
+//
+// clear
+//
+void BST::clear()
+{
+    root = 0;
+    lock = 0;
+    next = nodes;
+    chunk = chunkEnd = freeList = 0;
+}
+
+//
+// alloc
+//
+Off BST::alloc()
+{
+    Off n = freeList;
+    if (n) {
+        freeList = node(n)->left;
+        return n;
+    }
+    if (chunk == chunkEnd) {
+        chunk = InterlockedExchangeAdd64(&next, NODECHUNK*sizeof(Node));
+        chunkEnd = chunk + NODECHUNK*sizeof(Node);
+        if (chunkEnd > size) {
+            cout << "segment full, increase SHMMB" << endl;
+            quit(1);
+        }
+    }
+    n = chunk;
+    chunk += sizeof(Node);
+    return n;
+}
+
+//
+// free
+//
+void BST::free(Off n)
+{
+    node(n)->left = freeList;
+    freeList = n;
+}
+
+//
+// findCS
+//
+Off volatile *BST::findCS(INT64 key)
+{
+    Off volatile *pp = &root;
+    Off p = *pp;
+    while (p && node(p)->key != key) {
+        pp = (key < node(p)->key) ? &node(p)->left : &node(p)->right;
+        p = *pp;
+    }
+    return pp;
+}
+
+//
+// removeCS
+//
+// a node with two children is replaced by its successor node
+//
+void BST::removeCS(Off volatile *pp)
+{
+    Node *q = node(*pp);
+    garbage = *pp;
+    if (q->left == 0) {
+        *pp = q->right;
+    } else if (q->right == 0) {
+        *pp = q->left;
+    } else {
+        Off volatile *sp = &q->right;
+        Off s = q->right;
+        while (node(s)->left) {
+            sp = &node(s)->left;
+            s = node(s)->left;
+        }
+        *sp = node(s)->right;
+        node(s)->left = q->left;
+        node(s)->right = q->right;
+        *pp = s;
+    }
+}
+
+//
+// apply
+//
+int BST::apply(int op, INT64 key)
+{
+    Off volatile *pp = findCS(key);
+    switch (op) {
+        case 0:
+            if (*pp == 0)
+                return 0;
+            removeCS(pp);
+            return 1;
+        case 1:
+            if (*pp)
+                return 0;
+            *pp = spare;
+            spare = 0;
+            return 1;
+        case LOOKUP:
+            return *pp != 0;
+    }
+    return 0;
+}
+
+//
+// execute
+//
+int BST::execute(int op, INT64 key)
+{
+    int r;
+    garbage = 0;
+    if (mode == RTM) {
+        int attempts = 0;
+        while (attempts++ < MAXATTEMPTS) {
+            tx->starts++;
+            UINT status = _xbegin();
+            if (status == _XBEGIN_STARTED) {
+                if (lock)
+                    _xabort(0xA0);
+                r = apply(op, key);
+                _xend();
+                goto done;
+            }
+            tx->aborts++;
+            tx->capacity += (status & _XABORT_CAPACITY) != 0;
+            while (lock)
+                _mm_pause();
+        }
+        tx->locked++;
+    }
+    if (mode == HLE) {
+        acquireHLE();
+        r = apply(op, key);
+        _Store_HLERelease(&lock, 0);
+    } else {
+        acquire();
+        r = apply(op, key);
+        lock = 0;
+    }
+done:
+    if (garbage)
+        free(garbage);
+    return r;
+}
+
+//
+// add
+//
+// the node is set up before the op, it is only linked in if key is absent
+//
+int BST::add(INT64 key)
+{
+    if (spare == 0)
+        spare = alloc();
+    Node *n = node(spare);
+    n->key = key;
+    n->left = 0;
+    n->right = 0;
+    return execute(1, key);
+}
+
+int BST::remove(INT64 key)
+{
+    return execute(0, key);
+}
+
+int BST::contains(INT64 key)
+{
+    return execute(LOOKUP, key);
+}
+
+void BST::acquire()
+{
+    while (InterlockedExchange(&lock, 1) == 1) {
+        do {
+            _mm_pause();
+        } while (lock == 1);
+    }
+}
+
+void BST::acquireHLE()
+{
+    while (_InterlockedExchange_HLEAcquire(&lock, 1) == 1) {
+        do {
+            _mm_pause();
+        } while (lock == 1);
+    }
+}
+
+//
+// attach
+//
+// point this process's globals at a mapping of the segment
+//
+void attach(char *p)
+{
+    shm = p;
+    tree = (BST*) p;
+    opStats = at<OpStats>(tree->opStats);
+    txStats = at<TxStats>(tree->txStats);
+    ops = at<UINT64>(tree->ops);
+    series = at<Series>(tree->series);
+    gaps = at<Gap>(tree->gaps);
+}
+
+//
+// mapSegment
+//
+// map the shared memory object, creating it if sz > 0
+//
+char *mapSegment(UINT64 sz)
+{
+    int fd = shm_open(SHMNAME, sz ? O_RDWR | O_CREAT | O_TRUNC : O_RDWR, 0600);
+    if (fd < 0)
+        return NULL;
+    if (sz && ftruncate(fd, sz) < 0) {
+        close(fd);
+        return NULL;
+    }
+    struct stat st;
+    fstat(fd, &st);
+    void *p = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    return p == MAP_FAILED ? NULL : (char*) p;
+}
+
+//
+// buildBalanced
+//
+// link sorted keys into a balanced sub tree of nodes n, n+1, ...
+//
+Off buildBalanced(INT64 *key, Off n, int lo, int hi)
+{
+    if (lo > hi)
+        return 0;
+    int mid = lo + (hi - lo) / 2;
+    Off p = n + mid*sizeof(Node);
+    node(p)->key = key[mid];
+    node(p)->left = buildBalanced(key, n, lo, mid - 1);
+    node(p)->right = buildBalanced(key, n, mid + 1, hi);
+    return p;
+}
+
+//
+// prefill
+//
+// load PREFILL% of the keys in [0, range), evenly spaced so the shape is the same every run
+//
+void prefill(UINT range)
+{
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    INT64 *key = new INT64[n];
+    for (int i = 0; i < n; i++)
+        key[i] = (UINT64) i * range / n;
+    Off base = tree->next;
+    tree->next += n*sizeof(Node);
+    tree->root = buildBalanced(key, base, 0, n - 1);
+    delete[] key;
+}
+
+typedef struct {
+    int mode;                                   // mode
+    int sharing;                                // sharing
+    int nt;                                     // # workers
+    UINT64 rt;                                  // run time (ms)
+    UINT64 ops;                                 // ops
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+    UINT64 starts;                              // transactions started
+    UINT64 aborts;                              // transactions aborted
+    UINT64 capacity;                            // capacity aborts
+    UINT64 locked;                              // RTM ops run with the lock held
+} Result;
+
+Result *r;                                      // results
+UINT indx;                                      // results index
+
+void runOp(UINT randomValue, UINT randomBit) {
+    if (randomBit == LOOKUP) {
+        countOp(LOOKUP, tree->contains(randomValue));
+    } else if (randomBit) {
+        countOp(1, tree->add(randomValue));
+    } else {
+        countOp(0, tree->remove(randomValue));
+    }
+}
+
+//
+// worker
+//
+WORKER worker(void *vthread)
+{
+    int thread = (int)((size_t) vthread);
+
+    UINT64 n = 0;
+
+    runThreadOnCPU(thread % ncpu);
+
+    Rng rng;
+    seedRng(rng, SEED, thread);
+    UINT randomValue;
+    UINT randomBit;
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+    tx = &txStats[thread];
+
+    while (1) {
+        for(int y=0; y<NOPS; y++) {
+            UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+            randomBit = (UINT) (r >> 63);
+#if READPCT > 0
+            UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+            if (pct < READPCT)
+                randomBit = LOOKUP;
+#endif
+            randomValue = (UINT) r & keyMask;
+            runOp(randomValue, randomBit);
+#if GAPS
+            recordGap(*gap);
+#endif
+        }
+        n += NOPS;
+        recordSeries(series[thread], NOPS);
+        //
+        // check if runtime exceeded
+        //
+        if ((getWallClockMS() - tstart) > NSECONDS*1000)
+            break;
+    }
+    ops[thread] = n;
+    return 0;
+}
+
+//
+// workerProcess
+//
+// map the segment again, at another address, drop the mapping inherited from the parent and run
+// the worker; the process's free list and unused chunk are left in the segment until clear()
+//
+void workerProcess(int thread)
+{
+    char *p = mapSegment(0);
+    if (p == NULL)
+        _exit(1);
+    munmap(shm, tree->size);
+    attach(p);
+    BST::chunk = BST::chunkEnd = BST::freeList = BST::spare = 0;
+    worker((void*)(size_t) thread);
+    _exit(0);
+}
+
+//
+// main
+//
+int main()
+{
+    ncpu = getNumberOfCPUs();   // number of logical CPUs
+    maxThread = 2 * ncpu;       // max number of threads
+    //
+    // get date
+    //
+    char dateAndTime[256];
+    getDateAndTime(dateAndTime, sizeof(dateAndTime));
+    //
+    // get cache info
+    //
+    lineSz = getCacheLineSz();
+    //
+    // allocate global variable
+    //
+    // NB: per worker counts are in the segment, cache line aligned to stop false sharing
+    //
+    threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
+    pid = new pid_t[maxThread];                                                         // worker processes
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+
+    shm_unlink(SHMNAME);                                                                // left by an earlier run
+    char *p = mapSegment((UINT64) SHMMB*K*K);
+    if (p == NULL) {
+        cout << "unable to create " << SHMNAME << endl;
+        quit(1);
+    }
+    ((BST*) p)->init((UINT64) SHMMB*K*K, maxThread);
+    attach(p);
+
+    r = (Result*) ALIGNED_MALLOC(NMODE*5*maxThread*sizeof(Result), lineSz);             // for results
+    memset(r, 0, NMODE*5*maxThread*sizeof(Result));                                    // zero
+
+    indx = 0;
+    //
+    // use thousands comma separator
+    //
+    setCommaLocale();
+    cout << "tree in " << SHMMB << "MB shared memory object " << SHMNAME << ", workers are " << (PROCESSES ? "processes" : "threads") << endl;
+    cout << endl;
+    //
+    // header
+    //
+    cout << setw(6) << "mode";
+    cout << setw(13) << "BST";
+    cout << setw(10) << (PROCESSES ? "np" : "nt");
+    cout << setw(10) << "rt";
+    cout << setw(20) << "ops";
+    cout << setw(10) << "rel";
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+    cout << setw(8) << "abort%";
+    cout << setw(8) << "cap%";
+    cout << setw(8) << "lock%";
+    cout << endl;
+
+    cout << setw(6) << "----";       // mode
+    cout << setw(13) << "---";       // random count
+    cout << setw(10) << "--";        // nt
+    cout << setw(10) << "--";        // rt
+    cout << setw(20) << "---";       // ops
+    cout << setw(10) << "---";       // rel
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+    cout << setw(8) << "------";     // abort%
+    cout << setw(8) << "----";       // cap%
+    cout << setw(8) << "-----";      // lock%
+    cout << endl;
+
+    //
+    // run tests
+    //
+    UINT64 ops1 = 1;
+
+    for (mode = 0; mode < NMODE; mode++) {
+        if ((MODES & (1 << mode)) == 0 || (mode == RTM && !rtmSupported()))
+            continue;
+        for (sharing = 0; sharing < 5; sharing++) {
+            for (int nt = 1; nt <= maxThread; nt+=1, indx++) {
+                //
+                //  zero shared memory
+                //
+                memset(opStats, 0, nt*sizeof(OpStats));
+                memset(txStats, 0, nt*sizeof(TxStats));
+                tree->clear();
+#if PREFILL > 0
+                prefill((UINT) pow(16, sharing+1));
+#endif
+                //
+                // get start time
+                //
+                resetSeries(series, nt, BUCKETMS);
+#if GAPS
+                resetGaps(gaps, nt);
+#endif
+                tstart = getWallClockMS();
+                //
+                // create workers
+                //
+#if PROCESSES
+                cout << flush;  // or the children would write the parent's buffered output again
+                for (int thread = 0; thread < nt; thread++) {
+                    pid[thread] = fork();
+                    if (pid[thread] == 0)
+                        workerProcess(thread);
+                }
+                //
+                // wait for ALL worker processes to finish
+                //
+                int failed = 0;
+                for (int thread = 0; thread < nt; thread++) {
+                    int status;
+                    if (pid[thread] < 0 || waitpid(pid[thread], &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status))
+                        failed++;
+                }
+                if (failed) {
+                    cout << failed << " worker processes failed" << endl;
+                    quit(1);
+                }
+#else
+                for (int thread = 0; thread < nt; thread++)
+                    createThread(&threadH[thread], worker, (void*)(size_t)thread);
+                //
+                // wait for ALL worker threads to finish
+                //
+                waitForThreadsToFinish(nt, threadH);
+#endif
+                UINT64 rt = getWallClockMS() - tstart;
+                int nb = mergeSeries(series, nt, merged);
+                seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+                r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+                closeGaps(gaps, nt, NSECONDS*1000);
+                for (int thread = 0; thread < nt; thread++)
+                    r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+
+                //
+                // save results and output summary to console
+                //
+                for (int thread = 0; thread < nt; thread++) {
+                    r[indx].ops += ops[thread];
+                    for (int op = 0; op < NOPTYPE; op++) {
+                        r[indx].op[op] += opStats[thread].op[op];
+                        r[indx].eff[op] += opStats[thread].eff[op];
+                    }
+                    r[indx].starts += txStats[thread].starts;
+                    r[indx].aborts += txStats[thread].aborts;
+                    r[indx].capacity += txStats[thread].capacity;
+                    r[indx].locked += txStats[thread].locked;
+                }
+                if (indx == 0)
+                    ops1 = r[indx].ops;
+                r[indx].mode = mode;
+                r[indx].sharing = sharing;
+                r[indx].nt = nt;
+                r[indx].rt = rt;
+
+                cout << setw(6) << modeName[mode];
+                cout << setw(13) << (UINT64) pow(16,sharing+1);
+                cout << setw(10) << nt;
+                cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
+                cout << setw(20) << r[indx].ops;
+                cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+                UINT64 eff = 0;
+                for (int op = 0; op < NOPTYPE; op++)
+                    eff += r[indx].eff[op];
+                cout << setw(14) << r[indx].ops * 1000 / rt;
+                cout << setw(14) << eff * 1000 / rt;
+                cout << setw(14) << (UINT64) r[indx].steady;
+                cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+                cout << setw(12) << r[indx].minOps;
+                cout << setw(12) << r[indx].maxOps;
+                cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+                cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+                cout << setw(10) << r[indx].maxGap;
+#endif
+                for (int op = 0; op < NOPTYPE; op++) {
+                    if (OPCOLS & (1 << op)) {
+                        cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                        cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                    }
+                }
+                if (mode == RTM) {
+                    double starts = r[indx].starts ? (double) r[indx].starts : 1;
+                    cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].aborts / starts;
+                    cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].capacity / starts;
+                    cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].locked / r[indx].ops;
+                } else {
+                    cout << setw(8) << "-" << setw(8) << "-" << setw(8) << "-";
+                }
+                cout << endl;
+
+                ofstream metrics;
+                metrics.open("metricsSHM.txt", ios_base::app);
+
+                metrics << modeName[mode] << ", ";
+                metrics << (UINT64) pow(16,sharing+1) << ", ";
+                metrics << nt << ", ";
+                metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
+                metrics << r[indx].ops << ", ";
+                metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1;
+                metrics << ", " << eff;
+                metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+                metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+                metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+                metrics << ", " << r[indx].maxGap;
+#endif
+                for (int op = 0; op < NOPTYPE; op++)
+                    metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+                metrics << ", " << r[indx].starts << ", " << r[indx].aborts;
+                metrics << ", " << r[indx].capacity << ", " << r[indx].locked;
+                metrics << endl;
+
+                metrics.close();
+
+                ofstream buckets;
+                buckets.open("seriesSHM.txt", ios_base::app);
+                buckets << modeName[mode] << ", ";
+                buckets << (UINT64) pow(16,sharing+1) << ", ";
+                buckets << nt << ", " << BUCKETMS;
+                for (int b = 0; b < nb; b++)
+                    buckets << ", " << merged[b];
+                buckets << endl;
+                buckets.close();
+
+                ofstream fair;
+                fair.open("fairSHM.txt", ios_base::app);
+                fair << modeName[mode] << ", ";
+                fair << (UINT64) pow(16,sharing+1) << ", ";
+                fair << nt;
+                for (int thread = 0; thread < nt; thread++) {
+                    fair << ", " << ops[thread];
+#if GAPS
+                    fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+                }
+                fair << endl;
+                fair.close();
+
+                if (r[indx].jain < MINJAIN) {
+                    cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                    quit(1);
+                }
+
+#if PROCESSES == 0
+                //
+                // delete thread handles
+                //
+                for (int thread = 0; thread < nt; thread++) {
+                    closeThread(threadH[thread]);
+                }
+#endif
+            }
+        }
+    }
+
+    munmap(shm, tree->size);
+    shm_unlink(SHMNAME);
+
+    cout << endl;
+    quit();
+
+    return 0;
+
+}
@@ -0,0 +1,914 @@
+//
+// sharing.cpp
+//
+// Copyright (C) 2013 - 2015 jones@scss.tcd.ie
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software Foundation;
+// either version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// 19/11/12 first version
+// 19/11/12 works with Win32 and x64
+// 21/11/12 works with Character Set: Not Set, Unicode Character Set or Multi-Byte Character
+// 21/11/12 output results so they can be easily pasted into a spreadsheet from console
+// 24/12/12 increment using (0) non atomic increment (1) InterlockedIncrement64 (2) InterlockedCompareExchange
+// 12/07/13 increment using (3) RTM (restricted transactional memory)
+// 18/07/13 added performance counters
+// 27/08/13 choice of 32 or 64 bit counters (32 bit can oveflow if run time longer than a couple of seconds)
+// 28/08/13 extended struct Result
+// 16/09/13 linux support (needs g++ 4.8 or later)
+// 21/09/13 added getWallClockMS()
+// 12/10/13 Visual Studio 2013 RC
+// 12/10/13 added FALSESHARING
+// 14/10/14 added USEPMS
+//
+
+//
+// NB: hints for pasting from console window
+// NB: Edit -> Select All followed by Edit -> Copy
+// NB: paste into Excel using paste "Use Text Import Wizard" option and select "/" as the delimiter
+
+#include "stdafx.h"                             // pre-compiled headers
+#include <iostream>
+#include <iomanip>                              // setprecision
+#include "helper.h"
+#include <math.h>
+#include <fstream>
+
+#ifdef WIN32
+#error "sharingServer.cpp needs UNIX domain sockets and epoll"
+#endif
+
+#include <errno.h>                              // EAGAIN
+#include <unistd.h>                             // read, close
+#include <sys/socket.h>                         // socket
+#include <sys/un.h>                             // sockaddr_un
+#include <sys/epoll.h>                          // epoll
+
+using namespace std;
+
+#define K           1024
+#define GB          (K*K*K)
+#define NSECONDS    1                           // run each test for NSECONDS
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define PREFILL     50                          // % of key range loaded before each run
+#define READPCT     0                           // % of ops that are lookups
+#define LOOKUP      2                           // op: 0 remove, 1 add, 2 lookup
+#define NOPTYPE     3                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | ((READPCT > 0) << LOOKUP))
+#define SOCKPATH    "/tmp/sharingServer.sock"   // UNIX domain socket the server listens on
+#define NIOTHREAD   0                           // server I/O threads, each pinned to its own CPU (0 = one per CPU)
+#define BATCH       16                          // ops per request message
+#define DEPTH       4                           // request messages a client keeps in flight
+#define MAXEVENT    64                          // events per epoll_wait
+#define INPROC      1                           // 1: also run the op mix in process with the same # of threads for comparison
+
+#define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
+
+UINT64 tstart;                                  // start of test in ms
+int sharing;
+int lineSz;                                     // cache line size
+int maxThread;                                  // max # of threads
+int nio;                                        // # server I/O threads
+
+THREADH *threadH;                               // client thread handles
+THREADH *ioH;                                   // server I/O thread handles
+UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+int listenFd;                                   // server socket
+int *ioEp;                                      // epoll set of each I/O thread
+volatile long nextIo;                           // I/O thread the next accepted connection is handed to
+volatile int serving;                           // cleared to stop the I/O threads
+
+//
+// protocol
+//
+// a request message is BATCH TraceOp records {key, op}, a response is one result byte per op,
+// in order; a connection is a byte stream so records may arrive split across reads and the
+// server answers each complete record it has, so responses are batched too
+//
+
+class Node {
+    public:
+        INT64 volatile key;
+        Node* volatile left;
+        Node* volatile right;
+        Node() {key = 0; right = left = NULL;} // default constructor
+};
+
+//
+// BST
+//
+// TATAS lock around each op
+//
+class BST {
+    public:
+        Node* volatile root; // root of BST, initially NULL
+        ALIGN(64) volatile long lock;
+        BST() {root = NULL; lock = 0;} // default constructor
+        int add(Node *n); // add node, returns 0 if key already present
+        int remove(INT64 key); // remove key, returns 0 if key not present
+        int contains(INT64 key); // returns 1 if key present
+        Node* volatile *findCS(INT64 key); // link to node of key, or to where it would go
+        Node *removeCS(Node* volatile *pp); // unlink node pp points to, returns it
+        void acquire(); // TATAS
+        void destroy(Node *p); // free sub tree
+};
+
+BST *tree = new BST;
+
+//
+// findCS
+//
+Node* volatile *BST::findCS(INT64 key)
+{
+    Node* volatile *pp = &root;
+    Node *p = *pp;
+    while (p && p->key != key) {
+        pp = (key < p->key) ? &p->left : &p->right;
+        p = *pp;
+    }
+    return pp;
+}
+
+//
+// removeCS
+//
+// a node with two children is replaced by its successor node
+//
+Node *BST::removeCS(Node* volatile *pp)
+{
+    Node *q = *pp;
+    if (q->left == NULL) {
+        *pp = q->right;
+    } else if (q->right == NULL) {
+        *pp = q->left;
+    } else {
+        Node* volatile *sp = &q->right;
+        Node *s = q->right;
+        while (s->left) {
+            sp = &s->left;
+            s = s->left;
+        }
+        *sp = s->right;
+        s->left = q->left;
+        s->right = q->right;
+        *pp = s;
+    }
+    return q;
+}
+
+int BST::add(Node *n)
+{
+    acquire();
+    Node* volatile *pp = findCS(n->key);
+    int r = *pp == NULL;
+    if (r)
+        *pp = n;
+    lock = 0;
+    return r;
+}
+
+int BST::remove(INT64 key)
+{
+    acquire();
+    Node* volatile *pp = findCS(key);
+    Node *q = *pp ? removeCS(pp) : NULL;
+    lock = 0;
+    delete q;
+    return q != NULL;
+}
+
+int BST::contains(INT64 key)
+{
+    acquire();
+    int r = *findCS(key) != NULL;
+    lock = 0;
+    return r;
+}
+
+void BST::acquire()
+{
+    while (InterlockedExchange(&lock, 1) == 1) {
+        do {
+            _mm_pause();
+        } while (lock == 1);
+    }
+}
+
+void BST::destroy(Node *p)
+{
+    if (p) {
+        destroy(p->left);
+        destroy(p->right);
+        delete p;
+    }
+}
+
+//
+// buildBalanced
+//
+// link sorted keys into a balanced sub tree
+//
+Node *buildBalanced(INT64 *key, int lo, int hi)
+{
+    if (lo > hi)
+        return NULL;
+    int mid = lo + (hi - lo) / 2;
+    Node *n = new Node;
+    n->key = key[mid];
+    n->left = buildBalanced(key, lo, mid - 1);
+    n->right = buildBalanced(key, mid + 1, hi);
+    return n;
+}
+
+//
+// prefill
+//
+// load PREFILL% of the keys in [0, range), evenly spaced so the shape is the same every run
+//
+void prefill(UINT range)
+{
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    INT64 *key = new INT64[n];
+    for (int i = 0; i < n; i++)
+        key[i] = (UINT64) i * range / n;
+    tree->root = buildBalanced(key, 0, n - 1);
+    delete[] key;
+}
+
+//
+// runOp
+//
+// returns 1 if the op was effective
+//
+int runOp(UINT key, UINT op)
+{
+    if (op == LOOKUP)
+        return tree->contains(key);
+    if (op) {
+        Node *n = new Node;
+        n->key = key;
+        int r = tree->add(n);
+        if (r == 0)
+            delete n;
+        return r;
+    }
+    return tree->remove(key);
+}
+
+//
+// nextOp
+//
+// next op of a client's stream, the same mix as the other engines
+//
+inline void nextOp(Rng &rng, UINT keyMask, TraceOp &t)
+{
+    UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+    t.op = (UINT) (r >> 63);
+#if READPCT > 0
+    UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+    if (pct < READPCT)
+        t.op = LOOKUP;
+#endif
+    t.key = (UINT) r & keyMask;
+}
+
+typedef struct {
+    int sharing;                                // sharing
+    int nt;                                     // # clients
+    UINT64 rt;                                  // run time (ms)
+    UINT64 ops;                                 // ops
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+    double latUS;                               // mean request message round trip (us)
+    UINT64 inproc;                              // in process ops/s with nt threads
+} Result;
+
+Result *r;                                      // results
+UINT indx;                                      // results index
+
+//
+// OpStats
+//
+// per thread op counts by type, own cache line
+// an op is effective if it inserts, removes or finds a key, so op - eff counts duplicate adds,
+// removes of absent keys and lookup misses
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this thread's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "add/s", "get/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+//
+// RttStats
+//
+// per client request message round trips, own cache line
+//
+class RttStats {
+    public:
+        ALIGN(64) UINT64 n;                     // messages answered
+        UINT64 ticks;                           // total TSC ticks from send to last result byte
+};
+
+RttStats *rttStats;                             // [thread]
+
+//
+// Conn
+//
+// server side of a connection, owned by one I/O thread
+// a client has at most DEPTH messages in flight, so in and out never overflow
+//
+typedef struct {
+    int fd;
+    int nin;                                    // request bytes buffered
+    int nout;                                   // result bytes to send
+    int sent;                                   // result bytes sent
+    int blocked;                                // waiting for EPOLLOUT to send the rest of out
+    char in[DEPTH*BATCH*sizeof(TraceOp)];
+    char out[DEPTH*BATCH];
+} Conn;
+
+//
+// closeConn
+//
+void closeConn(int ep, Conn *c)
+{
+    epoll_ctl(ep, EPOLL_CTL_DEL, c->fd, NULL);
+    close(c->fd);
+    delete c;
+}
+
+//
+// flushConn
+//
+// send buffered results, returns 0 if the connection failed
+// while results are left over the connection waits for EPOLLOUT and its requests are not read
+//
+int flushConn(int ep, Conn *c)
+{
+    while (c->sent < c->nout) {
+        ssize_t n = send(c->fd, c->out + c->sent, c->nout - c->sent, MSG_NOSIGNAL);
+        if (n < 0 && errno == EAGAIN)
+            break;
+        if (n <= 0)
+            return 0;
+        c->sent += (int) n;
+    }
+    int blocked = c->sent < c->nout;
+    if (blocked != c->blocked) {
+        epoll_event ev;
+        ev.events = blocked ? EPOLLOUT : EPOLLIN;
+        ev.data.ptr = c;
+        epoll_ctl(ep, EPOLL_CTL_MOD, c->fd, &ev);
+        c->blocked = blocked;
+    }
+    if (!blocked)
+        c->nout = c->sent = 0;
+    return 1;
+}
+
+//
+// serveConn
+//
+// read what has arrived, run each complete request and send its results in one write
+// returns 0 if the connection is closed or failed, or sent an op other than remove, add or lookup
+//
+int serveConn(int ep, Conn *c)
+{
+    if (c->blocked)
+        return flushConn(ep, c);
+    while (1) {
+        ssize_t n = read(c->fd, c->in + c->nin, sizeof(c->in) - c->nin);
+        if (n < 0 && errno == EAGAIN)
+            return 1;
+        if (n <= 0)
+            return 0;
+        c->nin += (int) n;
+        int nop = c->nin / sizeof(TraceOp);
+        TraceOp *t = (TraceOp*) c->in;
+        for (int i = 0; i < nop; i++) {
+            if (t[i].op > LOOKUP)
+                return 0;
+            c->out[c->nout++] = (char) runOp(t[i].key, t[i].op);
+        }
+        c->nin -= nop*sizeof(TraceOp);
+        memmove(c->in, c->in + nop*sizeof(TraceOp), c->nin);
+        if (!flushConn(ep, c))
+            return 0;
+        if (c->blocked)
+            return 1;
+    }
+}
+
+//
+// ioWorker
+//
+// server I/O thread pinned to its own CPU with its own epoll set; every I/O thread waits on the
+// listening socket with EPOLLEXCLUSIVE, so a new connection wakes one of them
+// the thread woken accepts every pending connection and hands them to the I/O threads round robin
+// by adding each to that thread's epoll set, as the same waiter tends to be woken every time and
+// the clients all connect at the start of a run; a connection is then served only by its thread
+//
+WORKER ioWorker(void *vthread)
+{
+    int thread = (int)((size_t) vthread);
+    runThreadOnCPU(thread % ncpu);
+    int ep = ioEp[thread];
+    epoll_event ev;
+    ev.events = EPOLLIN | EPOLLEXCLUSIVE;
+    ev.data.ptr = NULL;                         // NULL is the listening socket
+    epoll_ctl(ep, EPOLL_CTL_ADD, listenFd, &ev);
+    epoll_event *evs = new epoll_event[MAXEVENT];
+    while (serving) {
+        int n = epoll_wait(ep, evs, MAXEVENT, 10);
+        for (int i = 0; i < n; i++) {
+            Conn *c = (Conn*) evs[i].data.ptr;
+            if (c == NULL) {
+                int fd;
+                while ((fd = accept4(listenFd, NULL, NULL, SOCK_NONBLOCK)) >= 0) {
+                    c = new Conn;
+                    c->fd = fd;
+                    c->nin = c->nout = c->sent = c->blocked = 0;
+                    ev.events = EPOLLIN;
+                    ev.data.ptr = c;
+                    epoll_ctl(ioEp[InterlockedExchangeAdd(&nextIo, 1) % nio], EPOLL_CTL_ADD, fd, &ev);
+                }
+            } else if (!serveConn(ep, c)) {
+                closeConn(ep, c);
+            }
+        }
+    }
+    delete[] evs;
+    return 0;
+}
+
+//
+// client
+//
+// closed loop: keep DEPTH request messages in flight and send the next one each time one is
+// answered, until the run time is up and the messages in flight have been answered
+//
+WORKER client(void *vthread)
+{
+    int thread = (int)((size_t) vthread);
+
+    UINT64 n = 0;
+
+    runThreadOnCPU(thread % ncpu);
+
+    Rng rng;
+    seedRng(rng, SEED, thread);
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+    RttStats *rtt = &rttStats[thread];
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, SOCKPATH);
+    if (connect(fd, (sockaddr*) &addr, sizeof(addr)) < 0) {
+        cout << "client " << thread << " can't connect to " << SOCKPATH << endl;
+        quit(1);
+    }
+
+    TraceOp *req = new TraceOp[DEPTH*BATCH];    // ring of messages in flight, so results can be matched to ops
+    UINT64 *sentAt = new UINT64[DEPTH];         // TSC when each message in flight was sent
+    char res[DEPTH*BATCH];
+    int head = 0;                               // op the next result byte answers
+    int inflight = 0;                           // messages in flight
+    int msg = 0;                                // next message slot to send
+    int more = 1;                               // run time not up
+
+    while (more || inflight) {
+        while (more && inflight < DEPTH) {
+            TraceOp *t = &req[msg*BATCH];
+            for (int i = 0; i < BATCH; i++)
+                nextOp(rng, keyMask, t[i]);
+            sentAt[msg] = __rdtsc();
+            if (send(fd, t, BATCH*sizeof(TraceOp), MSG_NOSIGNAL) != BATCH*sizeof(TraceOp)) {
+                cout << "client " << thread << " write failed" << endl;
+                quit(1);
+            }
+            msg = (msg + 1) % DEPTH;
+            inflight++;
+        }
+        ssize_t got = read(fd, res, inflight*BATCH - head % BATCH);
+        if (got <= 0) {
+            cout << "client " << thread << " lost connection" << endl;
+            quit(1);
+        }
+        for (int i = 0; i < got; i++) {
+            countOp(req[head].op, res[i]);
+#if GAPS
+            recordGap(*gap);
+#endif
+            if (++head % BATCH == 0) {
+                rtt->n++;
+                rtt->ticks += __rdtsc() - sentAt[head / BATCH - 1];
+                head %= DEPTH*BATCH;
+                inflight--;
+                n += BATCH;
+                recordSeries(series[thread], BATCH);
+            }
+        }
+        if ((getWallClockMS() - tstart) > NSECONDS*1000)
+            more = 0;
+    }
+    close(fd);
+    delete[] sentAt;
+    delete[] req;
+    ops[thread] = n;
+    return 0;
+}
+
+//
+// inProcess
+//
+// the same op stream run directly against the tree, for comparison
+//
+WORKER inProcess(void *vthread)
+{
+    int thread = (int)((size_t) vthread);
+
+    UINT64 n = 0;
+
+    runThreadOnCPU(thread % ncpu);
+
+    Rng rng;
+    seedRng(rng, SEED, thread);
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    TraceOp t;
+
+    while (1) {
+        for (int y = 0; y < BATCH; y++) {
+            nextOp(rng, keyMask, t);
+            runOp(t.key, t.op);
+        }
+        n += BATCH;
+        //
+        // check if runtime exceeded
+        //
+        if ((getWallClockMS() - tstart) > NSECONDS*1000)
+            break;
+    }
+    ops[thread] = n;
+    return 0;
+}
+
+//
+// main
+//
+int main()
+{
+    ncpu = getNumberOfCPUs();   // number of logical CPUs
+    maxThread = 2 * ncpu;       // max number of threads
+    nio = NIOTHREAD ? NIOTHREAD : ncpu;
+    //
+    // get date
+    //
+    char dateAndTime[256];
+    getDateAndTime(dateAndTime, sizeof(dateAndTime));
+    //
+    // get cache info
+    //
+    lineSz = getCacheLineSz();
+    //
+    // allocate global variable
+    //
+    // NB: per thread counts are cache line aligned to stop false sharing
+    //
+    threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
+    ioH = (THREADH*) ALIGNED_MALLOC(nio*sizeof(THREADH), lineSz);                       // I/O thread handles
+    ops = (UINT64*) ALIGNED_MALLOC(maxThread*sizeof(UINT64), lineSz);                   // for ops per thread
+
+    opStats = (OpStats*) ALIGNED_MALLOC(maxThread*sizeof(OpStats), 64);                 // op counts per thread
+    series = (Series*) ALIGNED_MALLOC(maxThread*sizeof(Series), 64);                    // time series per thread
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+    gaps = (Gap*) ALIGNED_MALLOC(maxThread*sizeof(Gap), 64);                            // op-free intervals per thread
+    rttStats = (RttStats*) ALIGNED_MALLOC(maxThread*sizeof(RttStats), 64);              // round trips per client
+
+    r = (Result*) ALIGNED_MALLOC(5*maxThread*sizeof(Result), lineSz);                   // for results
+    memset(r, 0, 5*maxThread*sizeof(Result));                                        // zero
+
+    //
+    // start server
+    //
+    listenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0);
+    sockaddr_un addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    strcpy(addr.sun_path, SOCKPATH);
+    unlink(SOCKPATH);
+    if (bind(listenFd, (sockaddr*) &addr, sizeof(addr)) < 0 || listen(listenFd, maxThread) < 0) {
+        cout << "unable to listen on " << SOCKPATH << endl;
+        quit(1);
+    }
+    ioEp = new int[nio];
+    for (int thread = 0; thread < nio; thread++)
+        ioEp[thread] = epoll_create1(0);        // all created before any connection is handed out
+    nextIo = 0;
+    serving = 1;
+    for (int thread = 0; thread < nio; thread++)
+        createThread(&ioH[thread], ioWorker, (void*)(size_t)thread);
+
+    indx = 0;
+    //
+    // use thousands comma separator
+    //
+    setCommaLocale();
+    cout << nio << " I/O threads on " << SOCKPATH << ", " << BATCH << " ops per message, " << DEPTH << " messages in flight per client" << endl;
+    cout << endl;
+    //
+    // header
+    //
+    cout << setw(13) << "BST";
+    cout << setw(10) << "nt";
+    cout << setw(10) << "rt";
+    cout << setw(20) << "ops";
+    cout << setw(10) << "rel";
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+    cout << setw(10) << "rtt us";
+#if INPROC
+    cout << setw(14) << "inproc/s";
+    cout << setw(8) << "kept%";
+#endif
+    cout << endl;
+
+    cout << setw(13) << "---";       // random count
+    cout << setw(10) << "--";        // nt
+    cout << setw(10) << "--";        // rt
+    cout << setw(20) << "---";       // ops
+    cout << setw(10) << "---";       // rel
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+    cout << setw(10) << "------";    // rtt us
+#if INPROC
+    cout << setw(14) << "--------";  // inproc/s
+    cout << setw(8) << "-----";      // kept%
+#endif
+    cout << endl;
+
+    //
+    // run tests
+    //
+    UINT64 ops1 = 1;
+
+    for (sharing = 0; sharing < 5; sharing++) {
+        for (int nt = 1; nt <= maxThread; nt+=1, indx++) {
+#if INPROC
+            //
+            // in process run
+            //
+#if PREFILL > 0
+            prefill((UINT) pow(16, sharing+1));
+#endif
+            tstart = getWallClockMS();
+            for (int thread = 0; thread < nt; thread++)
+                createThread(&threadH[thread], inProcess, (void*)(size_t)thread);
+            waitForThreadsToFinish(nt, threadH);
+            UINT64 inrt = getWallClockMS() - tstart;
+            for (int thread = 0; thread < nt; thread++) {
+                r[indx].inproc += ops[thread];
+                closeThread(threadH[thread]);
+            }
+            r[indx].inproc = r[indx].inproc * 1000 / inrt;
+            tree->destroy(tree->root);
+            tree->root = NULL;
+#endif
+            //
+            //  zero shared memory
+            //
+            memset(opStats, 0, nt*sizeof(OpStats));
+            memset(rttStats, 0, nt*sizeof(RttStats));
+#if PREFILL > 0
+            prefill((UINT) pow(16, sharing+1));
+#endif
+            //
+            // get start time
+            //
+            resetSeries(series, nt, BUCKETMS);
+#if GAPS
+            resetGaps(gaps, nt);
+#endif
+            tstart = getWallClockMS();
+            //
+            // create client threads
+            //
+            for (int thread = 0; thread < nt; thread++)
+                createThread(&threadH[thread], client, (void*)(size_t)thread);
+            //
+            // wait for ALL client threads to finish, every op has been answered
+            //
+            waitForThreadsToFinish(nt, threadH);
+            UINT64 rt = getWallClockMS() - tstart;
+            int nb = mergeSeries(series, nt, merged);
+            seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+            r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+            closeGaps(gaps, nt, NSECONDS*1000);
+            for (int thread = 0; thread < nt; thread++)
+                r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+            tree->destroy(tree->root);
+            tree->root = NULL;
+
+            //
+            // save results and output summary to console
+            //
+            UINT64 msgs = 0, ticks = 0;
+            for (int thread = 0; thread < nt; thread++) {
+                r[indx].ops += ops[thread];
+                for (int op = 0; op < NOPTYPE; op++) {
+                    r[indx].op[op] += opStats[thread].op[op];
+                    r[indx].eff[op] += opStats[thread].eff[op];
+                }
+                msgs += rttStats[thread].n;
+                ticks += rttStats[thread].ticks;
+            }
+            if (indx == 0)
+                ops1 = r[indx].ops;
+            r[indx].sharing = sharing;
+            r[indx].nt = nt;
+            r[indx].rt = rt;
+            r[indx].latUS = msgs ? (double) ticksToUS(ticks) / msgs : 0;
+
+            cout << setw(13) << (UINT64) pow(16,sharing+1);
+            cout << setw(10) << nt;
+            cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
+            cout << setw(20) << r[indx].ops;
+            cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+            UINT64 eff = 0;
+            for (int op = 0; op < NOPTYPE; op++)
+                eff += r[indx].eff[op];
+            cout << setw(14) << r[indx].ops * 1000 / rt;
+            cout << setw(14) << eff * 1000 / rt;
+            cout << setw(14) << (UINT64) r[indx].steady;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+            cout << setw(12) << r[indx].minOps;
+            cout << setw(12) << r[indx].maxOps;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+            cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            cout << setw(10) << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++) {
+                if (OPCOLS & (1 << op)) {
+                    cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                    cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                }
+            }
+            cout << setw(10) << fixed << setprecision(1) << r[indx].latUS;
+#if INPROC
+            cout << setw(14) << r[indx].inproc;
+            double inproc = r[indx].inproc ? (double) r[indx].inproc : 1;
+            cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].ops * 1000 / rt / inproc;
+#endif
+            cout << endl;
+
+            ofstream metrics;
+            metrics.open("metricsServer.txt", ios_base::app);
+
+            metrics << (UINT64) pow(16,sharing+1) << ", ";
+            metrics << nt << ", ";
+            metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
+            metrics << r[indx].ops << ", ";
+            metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1;
+            metrics << ", " << eff;
+            metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+            metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+            metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            metrics << ", " << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++)
+                metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+            metrics << ", " << BATCH << ", " << DEPTH << ", " << nio;
+            metrics << ", " << setprecision(1) << r[indx].latUS << ", " << r[indx].inproc;
+            metrics << endl;
+
+            metrics.close();
+
+            ofstream buckets;
+            buckets.open("seriesServer.txt", ios_base::app);
+            buckets << (UINT64) pow(16,sharing+1) << ", ";
+            buckets << nt << ", " << BUCKETMS;
+            for (int b = 0; b < nb; b++)
+                buckets << ", " << merged[b];
+            buckets << endl;
+            buckets.close();
+
+            ofstream fair;
+            fair.open("fairServer.txt", ios_base::app);
+            fair << (UINT64) pow(16,sharing+1) << ", ";
+            fair << nt;
+            for (int thread = 0; thread < nt; thread++) {
+                fair << ", " << ops[thread];
+#if GAPS
+                fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+            }
+            fair << endl;
+            fair.close();
+
+            if (r[indx].jain < MINJAIN) {
+                cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                quit(1);
+            }
+
+            //
+            // delete thread handles
+            //
+            for (int thread = 0; thread < nt; thread++) {
+                closeThread(threadH[thread]);
+            }
+        }
+    }
+
+    //
+    // stop server
+    //
+    serving = 0;
+    waitForThreadsToFinish(nio, ioH);
+    for (int thread = 0; thread < nio; thread++) {
+        closeThread(ioH[thread]);
+        close(ioEp[thread]);
+    }
+    delete[] ioEp;
+    close(listenFd);
+    unlink(SOCKPATH);
+
+    cout << endl;
+    quit();
+
+    return 0;
+
+}
@@ -0,0 +1,925 @@
+//
+// sharing.cpp
+//
+// Copyright (C) 2013 - 2015 jones@scss.tcd.ie
+//
+// This program is free software; you can redistribute it and/or modify it under
+// the terms of the GNU General Public License as published by the Free Software Foundation;
+// either version 2 of the License, or (at your option) any later version.
+//
+// This program is distributed in the hope that it will be useful, but WITHOUT ANY WARRANTY;
+// without even the implied warranty of MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+// See the GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with this program; if not, write to the Free Software Foundation Inc.,
+// 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301, USA.
+//
+// 19/11/12 first version
+// 19/11/12 works with Win32 and x64
+// 21/11/12 works with Character Set: Not Set, Unicode Character Set or Multi-Byte Character
+// 21/11/12 output results so they can be easily pasted into a spreadsheet from console
+// 24/12/12 increment using (0) non atomic increment (1) InterlockedIncrement64 (2) InterlockedCompareExchange
+// 12/07/13 increment using (3) RTM (restricted transactional memory)
+// 18/07/13 added performance counters
+// 27/08/13 choice of 32 or 64 bit counters (32 bit can oveflow if run time longer than a couple of seconds)
+// 28/08/13 extended struct Result
+// 16/09/13 linux support (needs g++ 4.8 or later)
+// 21/09/13 added getWallClockMS()
+// 12/10/13 Visual Studio 2013 RC
+// 12/10/13 added FALSESHARING
+// 14/10/14 added USEPMS
+//
+
+//
+// NB: hints for pasting from console window
+// NB: Edit -> Select All followed by Edit -> Copy
+// NB: paste into Excel using paste "Use Text Import Wizard" option and select "/" as the delimiter
+//
+
+#include "stdafx.h"                             // pre-compiled headers
+#include <iostream>
+#include <iomanip>                              // setprecision
+#include "helper.h"
+#include <math.h>
+#include <fstream>
+
+using namespace std;
+
+#define K           1024
+#define GB          (K*K*K)
+#define NOPS        1000
+#define NSECONDS    1                           // run each test for NSECONDS
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define PREFILL     0                           // % of key range loaded before each run
+#define READPCT     0                           // % of ops that are lookups
+#define LOOKUP      2                           // op: 0 remove, 1 add, 2 lookup (3 scan and 4 range remove not supported)
+#define NOPTYPE     5                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | ((READPCT > 0) << LOOKUP))
+#define MAXLEVEL    24                          // max tower height, enough for 2^24 keys
+#define MAXATTEMPTS 8                           // transactional attempts before taking the lock
+
+#define LOCKFREE    0                           // variants
+#define RTM         1
+#define NVARIANT    2
+#define VARIANTS    ((1 << LOCKFREE) | (1 << RTM)) // variants swept, RTM is skipped if the CPU doesn't have it
+
+#define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
+
+UINT64 tstart;                                  // start of test in ms
+int sharing;
+int variant;                                    // variant of current run
+int lineSz;                                     // cache line size
+int maxThread;                                  // max # of threads
+
+THREADH *threadH;                               // thread handles
+UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+const char *variantName[NVARIANT] = {"cas", "rtm"};
+
+//
+// Node
+//
+// allocated with room for level next pointers. In the lock free variant the low bit of next[l]
+// marks the node as logically deleted at level l.
+//
+class Node {
+    public:
+        INT64 key;
+        int level;                              // # levels in tower
+        Node *retired;                          // retired list link
+        Node* volatile next[1];                 // [level]
+};
+
+inline Node *marked(Node *p) {return (Node*) ((size_t) p | 1);}
+inline Node *unmarked(Node *p) {return (Node*) ((size_t) p & ~(size_t) 1);}
+inline int isMarked(Node *p) {return (int) ((size_t) p & 1);}
+
+inline int cas(Node* volatile *addr, Node *oldv, Node *newv) {
+    return InterlockedCompareExchangePointer((void* volatile*) addr, newv, oldv) == oldv;
+}
+
+//
+// SkipStats
+//
+// per thread counts of the synchronisation each variant needed, own cache line
+//
+class SkipStats {
+    public:
+        ALIGN(64) UINT64 starts;                // _xbegin calls
+        UINT64 aborts;                          // aborted transactions
+        UINT64 locked;                          // ops run with the lock held
+        UINT64 casFail;                         // failed CASs (lock free variant)
+};
+
+SkipStats *skipStats;                           // [thread]
+thread_local SkipStats *stats;                  // this thread's counts
+thread_local Rng levelRng;                      // tower heights, separate from the op stream
+thread_local Node *retired;                     // nodes removed by this thread, freed after the run
+Node **retiredBy;                               // [thread] retired list handed over at the end of the run
+
+//
+// SkipList
+//
+// ordered set of keys between a head and a tail sentinel
+//
+// LOCKFREE - Herlihy and Shavit's lock free skip list: a node is deleted by marking its next
+//            pointers top down, the mark at level 0 is the linearisation point, and any find
+//            that meets a marked node snips it out with a CAS. Removed nodes are retired and
+//            only freed after the run as a racing find may still be reading them.
+// RTM      - a sequential skip list, each op in a transaction that reads lock, taking lock
+//            after MAXATTEMPTS aborts. Removed nodes are freed once the op has committed.
+//
+class SkipList {
+    public:
+        Node *head; // key below every key, MAXLEVEL high
+        Node *tail; // key above every key
+        ALIGN(64) volatile long lock;
+        SkipList();
+        int add(INT64 key); // returns 0 if key already present
+        int remove(INT64 key); // returns 0 if key not present
+        int contains(INT64 key);
+        int find(INT64 key, Node **preds, Node **succs); // lock free search, snips out marked nodes
+        int addLF(INT64 key);
+        int removeLF(INT64 key);
+        int containsLF(INT64 key);
+        int findCS(INT64 key, Node **preds); // sequential search, preds[l] is last node < key at level l
+        int addCS(INT64 key, Node *n);
+        Node *removeCS(INT64 key); // returns unlinked node or NULL
+        void acquire(); // TATAS
+        void clear(); // free every node, list must be quiescent
+        void prefill(UINT range);
+};
+
+SkipList *skipList;
+
+//
+// newNode
+//
+Node *newNode(INT64 key, int level)
+{
+    Node *n = (Node*) malloc(sizeof(Node) + (level - 1)*sizeof(Node*));
+    n->key = key;
+    n->level = level;
+    n->retired = NULL;
+    for (int l = 0; l < level; l++)
+        n->next[l] = NULL;
+    return n;
+}
+
+//
+// randomLevel
+//
+// level l with probability 2^-l
+//
+int randomLevel()
+{
+    UINT64 r = nextRng(levelRng);
+    int level = 1;
+    while (level < MAXLEVEL && (r & 1)) {
+        level++;
+        r >>= 1;
+    }
+    return level;
+}
+
+SkipList::SkipList()
+{
+    head = newNode(INT64_MIN, MAXLEVEL);
+    tail = newNode(INT64_MAX, MAXLEVEL);
+    for (int l = 0; l < MAXLEVEL; l++)
+        head->next[l] = tail;
+    lock = 0;
+}
+
+//
+// find
+//
+// fills preds and succs at every level and returns 1 if succs[0] holds key. Marked nodes met
+// on the way are unlinked, restarting from head if the predecessor changed under us.
+//
+int SkipList::find(INT64 key, Node **preds, Node **succs)
+{
+retry:
+    Node *pred = head;
+    Node *curr = NULL;
+    for (int l = MAXLEVEL - 1; l >= 0; l--) {
+        curr = unmarked(pred->next[l]);
+        while (1) {
+            Node *succ = curr->next[l];
+            while (isMarked(succ)) {
+                if (!cas(&pred->next[l], curr, unmarked(succ))) {
+                    stats->casFail++;
+                    goto retry;
+                }
+                curr = unmarked(succ);
+                succ = curr->next[l];
+            }
+            if (curr->key < key) {
+                pred = curr;
+                curr = succ;
+            } else {
+                break;
+            }
+        }
+        preds[l] = pred;
+        succs[l] = curr;
+    }
+    return curr->key == key;
+}
+
+//
+// addLF
+//
+// link in at level 0 (the linearisation point) then level by level up the tower. The tower
+// is abandoned if the node is removed while it is being built.
+//
+int SkipList::addLF(INT64 key)
+{
+    Node *preds[MAXLEVEL], *succs[MAXLEVEL];
+    int level = randomLevel();
+    Node *n = NULL;
+    while (1) {
+        if (find(key, preds, succs)) {
+            free(n);
+            return 0;
+        }
+        if (n == NULL)
+            n = newNode(key, level);
+        for (int l = 0; l < level; l++)
+            n->next[l] = succs[l];
+        if (cas(&preds[0]->next[0], succs[0], n))
+            break;
+        stats->casFail++;
+    }
+    for (int l = 1; l < level; l++) {
+        while (1) {
+            Node *old = n->next[l];
+            if (isMarked(old))
+                return 1;
+            if (old != succs[l] && !cas(&n->next[l], old, succs[l]))
+                return 1; // marked by a remove
+            if (cas(&preds[l]->next[l], succs[l], n))
+                break;
+            stats->casFail++;
+            find(key, preds, succs);
+            if (succs[0] != n)
+                return 1; // already removed
+        }
+    }
+    return 1;
+}
+
+//
+// removeLF
+//
+// mark the tower top down, whoever marks level 0 has removed the key
+//
+int SkipList::removeLF(INT64 key)
+{
+    Node *preds[MAXLEVEL], *succs[MAXLEVEL];
+    if (!find(key, preds, succs))
+        return 0;
+    Node *victim = succs[0];
+    for (int l = victim->level - 1; l >= 1; l--) {
+        Node *succ = victim->next[l];
+        while (!isMarked(succ)) {
+            cas(&victim->next[l], succ, marked(succ));
+            succ = victim->next[l];
+        }
+    }
+    Node *succ = victim->next[0];
+    while (1) {
+        if (isMarked(succ))
+            return 0; // another remove got there first
+        if (cas(&victim->next[0], succ, marked(succ))) {
+            find(key, preds, succs); // unlink
+            victim->retired = retired;
+            retired = victim;
+            return 1;
+        }
+        stats->casFail++;
+        succ = victim->next[0];
+    }
+}
+
+//
+// containsLF
+//
+// wait free, skips marked nodes without unlinking them
+//
+int SkipList::containsLF(INT64 key)
+{
+    Node *pred = head;
+    Node *curr = NULL;
+    for (int l = MAXLEVEL - 1; l >= 0; l--) {
+        curr = unmarked(pred->next[l]);
+        while (1) {
+            Node *succ = curr->next[l];
+            while (isMarked(succ)) {
+                curr = unmarked(succ);
+                succ = curr->next[l];
+            }
+            if (curr->key < key) {
+                pred = curr;
+                curr = succ;
+            } else {
+                break;
+            }
+        }
+    }
+    return curr->key == key;
+}
+
+//
+// findCS
+//
+int SkipList::findCS(INT64 key, Node **preds)
+{
+    Node *pred = head;
+    for (int l = MAXLEVEL - 1; l >= 0; l--) {
+        while (pred->next[l]->key < key)
+            pred = pred->next[l];
+        preds[l] = pred;
+    }
+    return pred->next[0]->key == key;
+}
+
+//
+// addCS
+//
+// n is allocated by the caller as a transaction can't allocate
+//
+int SkipList::addCS(INT64 key, Node *n)
+{
+    Node *preds[MAXLEVEL];
+    if (findCS(key, preds))
+        return 0;
+    for (int l = 0; l < n->level; l++) {
+        n->next[l] = preds[l]->next[l];
+        preds[l]->next[l] = n;
+    }
+    return 1;
+}
+
+//
+// removeCS
+//
+Node *SkipList::removeCS(INT64 key)
+{
+    Node *preds[MAXLEVEL];
+    if (!findCS(key, preds))
+        return NULL;
+    Node *victim = preds[0]->next[0];
+    for (int l = 0; l < victim->level; l++)
+        preds[l]->next[l] = victim->next[l];
+    return victim;
+}
+
+void SkipList::acquire()
+{
+    while (InterlockedExchange(&lock, 1) == 1) {
+        do {
+            _mm_pause();
+        } while (lock == 1);
+    }
+}
+
+//
+// add
+//
+int SkipList::add(INT64 key)
+{
+    if (variant == LOCKFREE)
+        return addLF(key);
+    Node *n = newNode(key, randomLevel());
+    int r;
+    int attempts = 0;
+    while (attempts++ < MAXATTEMPTS) {
+        stats->starts++;
+        UINT status = _xbegin();
+        if (status == _XBEGIN_STARTED) {
+            if (lock)
+                _xabort(0xA0);
+            r = addCS(key, n);
+            _xend();
+            goto done;
+        }
+        stats->aborts++;
+        while (lock)
+            _mm_pause();
+    }
+    stats->locked++;
+    acquire();
+    r = addCS(key, n);
+    lock = 0;
+done:
+    if (r == 0)
+        free(n);
+    return r;
+}
+
+//
+// remove
+//
+int SkipList::remove(INT64 key)
+{
+    if (variant == LOCKFREE)
+        return removeLF(key);
+    Node *victim;
+    int attempts = 0;
+    while (attempts++ < MAXATTEMPTS) {
+        stats->starts++;
+        UINT status = _xbegin();
+        if (status == _XBEGIN_STARTED) {
+            if (lock)
+                _xabort(0xA0);
+            victim = removeCS(key);
+            _xend();
+            goto done;
+        }
+        stats->aborts++;
+        while (lock)
+            _mm_pause();
+    }
+    stats->locked++;
+    acquire();
+    victim = removeCS(key);
+    lock = 0;
+done:
+    free(victim);
+    return victim != NULL;
+}
+
+//
+// contains
+//
+int SkipList::contains(INT64 key)
+{
+    if (variant == LOCKFREE)
+        return containsLF(key);
+    Node *preds[MAXLEVEL];
+    int found;
+    int attempts = 0;
+    while (attempts++ < MAXATTEMPTS) {
+        stats->starts++;
+        UINT status = _xbegin();
+        if (status == _XBEGIN_STARTED) {
+            if (lock)
+                _xabort(0xA0);
+            found = findCS(key, preds);
+            _xend();
+            return found;
+        }
+        stats->aborts++;
+        while (lock)
+            _mm_pause();
+    }
+    stats->locked++;
+    acquire();
+    found = findCS(key, preds);
+    lock = 0;
+    return found;
+}
+
+//
+// clear
+//
+void SkipList::clear()
+{
+    Node *p = unmarked(head->next[0]);
+    while (p != tail) {
+        Node *q = unmarked(p->next[0]);
+        free(p);
+        p = q;
+    }
+    for (int l = 0; l < MAXLEVEL; l++)
+        head->next[l] = tail;
+}
+
+//
+// prefill
+//
+// load PREFILL% of the keys in [0, range), evenly spaced, with tower heights drawn as for an add
+//
+void SkipList::prefill(UINT range)
+{
+    Node *last[MAXLEVEL];
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    for (int l = 0; l < MAXLEVEL; l++)
+        last[l] = head;
+    for (int i = 0; i < n; i++) {
+        Node *p = newNode((UINT64) i * range / n, randomLevel());
+        for (int l = 0; l < p->level; l++) {
+            p->next[l] = tail;
+            last[l]->next[l] = p;
+            last[l] = p;
+        }
+    }
+}
+
+typedef struct {
+    int variant;                                // variant
+    int sharing;                                // sharing
+    int nt;                                     // # threads
+    UINT64 rt;                                  // run time (ms)
+    UINT64 ops;                                 // ops
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+    UINT64 starts;                              // transactions started
+    UINT64 aborts;                              // transactions aborted
+    UINT64 locked;                              // ops run with the lock held
+    UINT64 casFail;                             // failed CASs
+} Result;
+
+Result *r;                                      // results
+UINT indx;                                      // results index
+
+//
+// OpStats
+//
+// per thread op counts by type, own cache line
+// an op is effective if it inserts, removes or finds a key, so op - eff counts duplicate adds,
+// removes of absent keys and lookup misses
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this thread's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "add/s", "get/s", "scan/s", "rdel/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s", "hit/s", "hit/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+void runOp(UINT randomValue, UINT randomBit) {
+    if (randomBit == LOOKUP)
+        countOp(LOOKUP, skipList->contains(randomValue));
+    else if (randomBit)
+        countOp(1, skipList->add(randomValue));
+    else
+        countOp(0, skipList->remove(randomValue));
+}
+
+//
+// worker
+//
+WORKER worker(void *vthread)
+{
+    int thread = (int)((size_t) vthread);
+
+    UINT64 n = 0;
+
+    runThreadOnCPU(thread % ncpu);
+
+    Rng rng;
+    seedRng(rng, SEED, thread);
+    seedRng(levelRng, SEED + 1, thread);
+    UINT randomValue;
+    UINT randomBit;
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+    stats = &skipStats[thread];
+    retired = NULL;
+
+    while (1) {
+        for(int y=0; y<NOPS; y++) {
+            UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+            randomBit = (UINT) (r >> 63);
+#if READPCT > 0
+            UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+            if (pct < READPCT)
+                randomBit = LOOKUP;
+#endif
+            randomValue = (UINT) r & keyMask;
+            runOp(randomValue, randomBit);
+#if GAPS
+            recordGap(*gap);
+#endif
+        }
+        n += NOPS;
+        recordSeries(series[thread], NOPS);
+        //
+        // check if runtime exceeded
+        //
+        if ((getWallClockMS() - tstart) > NSECONDS*1000)
+            break;
+    }
+    retiredBy[thread] = retired;
+    ops[thread] = n;
+    return 0;
+}
+
+//
+// freeRetired
+//
+// all threads have finished so no find can still be reading a retired node
+//
+void freeRetired(Node *p)
+{
+    while (p) {
+        Node *q = p->retired;
+        free(p);
+        p = q;
+    }
+}
+
+//
+// main
+//
+int main()
+{
+    ncpu = getNumberOfCPUs();   // number of logical CPUs
+    maxThread = 2 * ncpu;       // max number of threads
+    //
+    // get date
+    //
+    char dateAndTime[256];
+    getDateAndTime(dateAndTime, sizeof(dateAndTime));
+    //
+    // get cache info
+    //
+    lineSz = getCacheLineSz();
+    //
+    // allocate global variable
+    //
+    // NB: per thread counts are cache line aligned to stop false sharing
+    //
+    threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
+    ops = (UINT64*) ALIGNED_MALLOC(maxThread*sizeof(UINT64), lineSz);                   // for ops per thread
+
+    opStats = (OpStats*) ALIGNED_MALLOC(maxThread*sizeof(OpStats), 64);                 // op counts per thread
+    series = (Series*) ALIGNED_MALLOC(maxThread*sizeof(Series), 64);                    // time series per thread
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+    gaps = (Gap*) ALIGNED_MALLOC(maxThread*sizeof(Gap), 64);                            // op-free intervals per thread
+    skipStats = (SkipStats*) ALIGNED_MALLOC(maxThread*sizeof(SkipStats), 64);           // sync counts per thread
+    retiredBy = new Node*[maxThread];                                                   // retired list of each thread
+
+    r = (Result*) ALIGNED_MALLOC(NVARIANT*5*maxThread*sizeof(Result), lineSz);          // for results
+    memset(r, 0, NVARIANT*5*maxThread*sizeof(Result));                                 // zero
+
+    skipList = new SkipList;
+    seedRng(levelRng, SEED + 1, maxThread);     // prefill tower heights
+
+    indx = 0;
+    //
+    // use thousands comma separator
+    //
+    setCommaLocale();
+    //
+    // header
+    //
+    cout << setw(6) << "skip";
+    cout << setw(13) << "BST";
+    cout << setw(10) << "nt";
+    cout << setw(10) << "rt";
+    cout << setw(20) << "ops";
+    cout << setw(10) << "rel";
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+    cout << setw(8) << "abort%";
+    cout << setw(8) << "lock%";
+    cout << setw(9) << "casf/op";
+    cout << endl;
+
+    cout << setw(6) << "----";       // variant
+    cout << setw(13) << "---";       // random count
+    cout << setw(10) << "--";        // nt
+    cout << setw(10) << "--";        // rt
+    cout << setw(20) << "---";       // ops
+    cout << setw(10) << "---";       // rel
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+    cout << setw(8) << "------";     // abort%
+    cout << setw(8) << "-----";      // lock%
+    cout << setw(9) << "-------";    // casf/op
+    cout << endl;
+
+    //
+    // run tests
+    //
+    UINT64 ops1 = 1;
+
+    for (variant = 0; variant < NVARIANT; variant++) {
+        if ((VARIANTS & (1 << variant)) == 0 || (variant == RTM && !rtmSupported()))
+            continue;
+        for (sharing = 0; sharing < 5; sharing++) {
+            for (int nt = 1; nt <= maxThread; nt+=1, indx++) {
+                //
+                //  zero shared memory
+                //
+                memset(opStats, 0, nt*sizeof(OpStats));
+                memset(skipStats, 0, nt*sizeof(SkipStats));
+#if PREFILL > 0
+                skipList->prefill((UINT) pow(16, sharing+1));
+#endif
+                //
+                // get start time
+                //
+                resetSeries(series, nt, BUCKETMS);
+#if GAPS
+                resetGaps(gaps, nt);
+#endif
+                tstart = getWallClockMS();
+                //
+                // create worker threads
+                //
+                for (int thread = 0; thread < nt; thread++)
+                    createThread(&threadH[thread], worker, (void*)(size_t)thread);
+                //
+                // wait for ALL worker threads to finish
+                //
+                waitForThreadsToFinish(nt, threadH);
+                UINT64 rt = getWallClockMS() - tstart;
+                int nb = mergeSeries(series, nt, merged);
+                seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+                r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+                closeGaps(gaps, nt, NSECONDS*1000);
+                for (int thread = 0; thread < nt; thread++)
+                    r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+                skipList->clear();
+                for (int thread = 0; thread < nt; thread++)
+                    freeRetired(retiredBy[thread]);
+
+                //
+                // save results and output summary to console
+                //
+                for (int thread = 0; thread < nt; thread++) {
+                    r[indx].ops += ops[thread];
+                    for (int op = 0; op < NOPTYPE; op++) {
+                        r[indx].op[op] += opStats[thread].op[op];
+                        r[indx].eff[op] += opStats[thread].eff[op];
+                    }
+                    r[indx].starts += skipStats[thread].starts;
+                    r[indx].aborts += skipStats[thread].aborts;
+                    r[indx].locked += skipStats[thread].locked;
+                    r[indx].casFail += skipStats[thread].casFail;
+                }
+                if (indx == 0)
+                    ops1 = r[indx].ops;
+                r[indx].variant = variant;
+                r[indx].sharing = sharing;
+                r[indx].nt = nt;
+                r[indx].rt = rt;
+
+                cout << setw(6) << variantName[variant];
+                cout << setw(13) << (UINT64) pow(16,sharing+1);
+                cout << setw(10) << nt;
+                cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
+                cout << setw(20) << r[indx].ops;
+                cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+                UINT64 eff = 0;
+                for (int op = 0; op < NOPTYPE; op++)
+                    eff += r[indx].eff[op];
+                cout << setw(14) << r[indx].ops * 1000 / rt;
+                cout << setw(14) << eff * 1000 / rt;
+                cout << setw(14) << (UINT64) r[indx].steady;
+                cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+                cout << setw(12) << r[indx].minOps;
+                cout << setw(12) << r[indx].maxOps;
+                cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+                cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+                cout << setw(10) << r[indx].maxGap;
+#endif
+                for (int op = 0; op < NOPTYPE; op++) {
+                    if (OPCOLS & (1 << op)) {
+                        cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                        cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                    }
+                }
+                if (variant == RTM) {
+                    double starts = r[indx].starts ? (double) r[indx].starts : 1;
+                    cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].aborts / starts;
+                    cout << setw(8) << fixed << setprecision(2) << 100.0 * r[indx].locked / r[indx].ops;
+                    cout << setw(9) << "-";
+                } else {
+                    cout << setw(8) << "-" << setw(8) << "-";
+                    cout << setw(9) << fixed << setprecision(3) << (double) r[indx].casFail / r[indx].ops;
+                }
+                cout << endl;
+
+                ofstream metrics;
+                metrics.open("metricsSkipList.txt", ios_base::app);
+
+                metrics << variantName[variant] << ", ";
+                metrics << (UINT64) pow(16,sharing+1) << ", ";
+                metrics << nt << ", ";
+                metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
+                metrics << r[indx].ops << ", ";
+                metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1;
+                metrics << ", " << eff;
+                metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+                metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+                metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+                metrics << ", " << r[indx].maxGap;
+#endif
+                for (int op = 0; op < NOPTYPE; op++)
+                    metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+                metrics << ", " << r[indx].starts << ", " << r[indx].aborts;
+                metrics << ", " << r[indx].locked << ", " << r[indx].casFail;
+                metrics << endl;
+
+                metrics.close();
+
+                ofstream buckets;
+                buckets.open("seriesSkipList.txt", ios_base::app);
+                buckets << variantName[variant] << ", ";
+                buckets << (UINT64) pow(16,sharing+1) << ", ";
+                buckets << nt << ", " << BUCKETMS;
+                for (int b = 0; b < nb; b++)
+                    buckets << ", " << merged[b];
+                buckets << endl;
+                buckets.close();
+
+                ofstream fair;
+                fair.open("fairSkipList.txt", ios_base::app);
+                fair << variantName[variant] << ", ";
+                fair << (UINT64) pow(16,sharing+1) << ", ";
+                fair << nt;
+                for (int thread = 0; thread < nt; thread++) {
+                    fair << ", " << ops[thread];
+#if GAPS
+                    fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+                }
+                fair << endl;
+                fair.close();
+
+                if (r[indx].jain < MINJAIN) {
+                    cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                    quit(1);
+                }
+
+                //
+                // delete thread handles
+                //
+                for (int thread = 0; thread < nt; thread++) {
+                    closeThread(threadH[thread]);
+                }
+            }
+        }
+    }
+
+    cout << endl;
+    quit();
+
+    return 0;
+
+}
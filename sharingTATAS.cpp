@@ -43,6 +43,7 @@
 #include "helper.h"
 #include <math.h>
 #include <fstream> 
+#include <algorithm>                            // stable_sort
 
 using namespace std;
 
@@ -50,19 +51,42 @@ using namespace std;
 #define GB          (K*K*K)
 #define NOPS        1000
 #define NSECONDS    1                           // run each test for NSECONDS
+#define BUCKETMS    10                          // time series bucket width (ms)
+#define MINJAIN     0.0                         // quit if a run's Jain's fairness index is below MINJAIN (0 = never)
+#define GAPS        0                           // time stamp every op to find each thread's longest op-free interval, gap us (0 = off)
+#define SEED        1                           // master seed (thread t uses stream t of SEED)
+#define TRACE       0                           // 0 generate ops, 1 generate and record ops, 2 replay ops from trace files
+#define TRACEFILE   "trace%d.bin"               // trace file of thread %d
+#define PREFILL     0                           // % of key range bulk loaded before each run
+#define PAGES       PAGESTHP                    // node pool pages: PAGES4K, PAGESTHP or PAGESHUGE
+#define POOLMB      256                         // node pool size, nodes come from the heap once it is used up
+#define SAMPLE      0                           // probe search path of every SAMPLE-th op (0 = off)
+#define SHAPEMS     100                         // ms between tree shape samples when SAMPLE > 0
+#define MAXDEPTH    64                          // depth histogram buckets (last bucket counts deeper nodes)
+#define MAXREADATTEMPTS 4                       // optimistic lookup attempts before taking the lock
+#define READPCT     0                           // % of ops that are lookups
+#define SCANPCT     0                           // % of ops that are range scans
+#define RDELPCT     0                           // % of ops that are range removes
+#define SCANLEN     16                          // key range covered by a scan or range remove
+#define LOOKUP      2                           // runOp op: 0 remove, 1 add, 2 lookup, 3 scan, 4 range remove
+#define SCAN        3
+#define RDEL        4
+#define NOPTYPE     5                           // # op types, counts are indexed by op
+#define OPCOLS      ((1 << 0) | (1 << 1) | ((READPCT > 0 || TRACE == 2) << LOOKUP) | ((SCANPCT > 0 || TRACE == 2) << SCAN) | ((RDELPCT > 0 || TRACE == 2) << RDEL))
+#define BATCHSZ     1                           // ops per BST::applyBatch (1 = one critical section per op)
+#define SNAPMS      0                           // > 0: lookups read an Eytzinger snapshot of the tree republished every SNAPMS ms (stale reads)
+#define SNAPBATCH   8                           // lookups answered together from the snapshot (8 uses AVX2 when built with -mavx2)
+#define INTERLEAVE  0                           // > 1: queue lookups and adds, run INTERLEAVE traversals at a time interleaved (0 = off)
+#define IMAGE       0                           // PREFILL warm starts from a tree image file: 0 off, IMAGERO lookups read the mapped image, IMAGECOW the mapped image is the tree
+#define IMAGEFILE   "tree%u_%u.img"             // image of key range %u prefilled %u%%, written if not found
+#define IMAGERO     1
+#define IMAGECOW    2
 
-#define COUNTER64                               // comment for 32 bit counter
-
-#ifdef COUNTER64
-#define VINT    UINT64                          //  64 bit counter
-#else
-#define VINT    UINT                            //  32 bit counter
+#if IMAGE > 0 && PREFILL == 0
+#error "IMAGE needs PREFILL > 0"
 #endif
-
-#ifdef FALSESHARING
-#define GINDX(n)    (g+n)
-#else
-#define GINDX(n)    (g+n*lineSz/sizeof(VINT))
+#if IMAGE == IMAGERO && READPCT < 100
+#error "IMAGERO images are read only, set READPCT 100"
 #endif
 
 #define ALIGNED_MALLOC(sz, align) _aligned_malloc(sz, align)
@@ -74,87 +98,1140 @@ int maxThread;                                  // max # of threads
 
 THREADH *threadH;                               // thread handles
 UINT64 *ops;                                    // for ops per thread
+Series *series;                                 // time series per thread
+UINT64 *merged;                                 // merged time series
+Gap *gaps;                                      // op-free intervals per thread
+
+//
+// PathStats
+//
+// search path samples per thread, one cache line each
+//
+class PathStats {
+    public:
+        ALIGN(64) UINT64 n;                     // # ops sampled
+        UINT64 depth;                           // total nodes visited
+        UINT64 lines;                           // total distinct cache lines visited
+};
+
+//
+// ShapeStats
+//
+// tree shape, sampled out of band
+//
+typedef struct {
+    UINT64 nodes;                               // # nodes
+    int height;                                 // # levels
+    UINT64 hist[MAXDEPTH];                      // # nodes at each depth
+} ShapeStats;
+
+PathStats *pathStats;                           // search path samples per thread
+ShapeStats shape;                               // last tree shape sample of run
+
+//ALIGN(64) volatile long lock = 0;
+
+class Node {
+    public:
+        INT64 volatile key;
+        Node* volatile left;
+        Node* volatile right;
+        Node() {key = 0; right = left = NULL;} // default constructor
+        void* operator new(size_t sz) {return poolAlloc(sz);}
+        void operator delete(void *p) {poolFree(p);}
+};
+
+typedef struct {
+    INT64 key;                                  // key to add or remove
+    int add;                                    // 1 = add, 0 = remove
+    int result;                                 // set to 1 if op changed the tree
+    Node *n;                                    // node to link in if add
+} BatchOp;
+
+inline bool batchOpLess(const BatchOp &a, const BatchOp &b) {return a.key < b.key;}
+
+//
+// Walk
+//
+// state of one traversal of an interleaved group
+//
+typedef struct {
+    INT64 key;                                  // key to find or add
+    int op;                                     // LOOKUP or 1 (add)
+    int result;                                 // 1 if key found (lookup) or node linked (add)
+    Node *n;                                    // node to link in if add
+    Node* volatile *pp;                         // link followed to reach p
+    Node *p;                                    // next node to visit, NULL at the end of the path
+} Walk;
+
+struct Image;
+
+class BST {
+    public:
+        Node* volatile root; // root of BST, initially NULL
+        ALIGN(64) volatile long lock;
+        ALIGN(64) volatile UINT64 version; // seqlock, odd while a writer is changing the tree
+        Node *retired; // removed nodes, freed by reclaim()
+        Node *bulk; // node block of last bulkLoad
+        int nbulk;
+        void *bulkMap; // image mapping holding bulk if it came from adoptImage
+        size_t bulkMapSz;
+        BST() {root = NULL, lock = 0; version = 0; retired = NULL; bulk = NULL; nbulk = 0; bulkMap = NULL; bulkMapSz = 0;} // default constructor
+        void bulkLoad(INT64 *key, int n, int nt); // replace tree with balanced tree of sorted keys
+        void freeBulk(); // free or unmap bulk block
+        int saveImage(const char *fn, INT64 *buf, int nt); // write image of tree rebalanced, buf must hold every key
+        int adoptImage(Image &img, int nt); // replace tree with a copy on write mapped image, returns 0 if it has a bad link
+        int inBulk(Node *p) {return p >= bulk && p < bulk + nbulk;} // node in bulk block, not individually freed
+        int add(Node *nn); // add node to tree, returns 0 if key already present
+        void destroy(volatile Node *nextNode);
+        int remove(INT64 key); // remove key from tree, returns 0 if key not present
+        int addCS(Node *nn); // add with lock already held
+        int removeCS(INT64 key); // remove with lock already held
+        void applyBatch(BatchOp *op, int n); // apply n ops in one critical section
+        void interleave(Walk *w, int n); // run n lookups and adds with their traversals interleaved
+        int interleaveCS(Walk *w, int n, int locked, UINT64 v); // returns 0 if version moved off v
+        int contains(INT64 key); // optimistic lookup, falls back to the lock
+        int containsCS(INT64 key); // lookup with lock already held
+        int scan(INT64 lo, INT64 hi, INT64 *buf, int max); // copy keys in [lo, hi] to buf in order
+        int scanCS(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max);
+        int removeRange(INT64 lo, INT64 hi); // remove keys in [lo, hi]
+        int removeRangeCS(INT64 lo, INT64 hi);
+        void reclaim(); // free retired nodes, no thread may be in the tree
+        void releaseTATAS();  //HLE functionality added to BST class
+        void acquireTATAS();
+        void probe(INT64 key, int &depth, int &lines); // search path of key, no lock
+        int gatherCS(Node *p, INT64 *buf, int n); // append keys of sub tree p to buf in order, returns new n
+        int shapeCS(Node *p, int depth, ShapeStats *s); // add sub tree p to shape, returns height
+};
+
+BST *BinarySearchTree = new BST;
+
+//
+// BulkTask
+//
+// sub tree of a bulk load built by one thread
+//
+typedef struct {
+    INT64 *key;                                 // sorted keys
+    Node *node;                                 // node[i] holds key[i]
+    int lo;                                     // sub tree holds key[lo] .. key[hi-1]
+    int hi;
+    Node* volatile *pp;                         // where to link the sub tree's root
+} BulkTask;
+
+//
+// buildBalanced
+//
+// returns root of a perfectly balanced tree of key[lo] .. key[hi-1]
+//
+Node *buildBalanced(INT64 *key, Node *node, int lo, int hi)
+{
+    if (lo >= hi)
+        return NULL;
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    p->left = buildBalanced(key, node, lo, mid);
+    p->right = buildBalanced(key, node, mid + 1, hi);
+    return p;
+}
+
+//
+// splitBulk
+//
+// build the top levels of the tree and queue the sub trees below them as tasks
+//
+void splitBulk(INT64 *key, Node *node, int lo, int hi, Node* volatile *pp, int levels, BulkTask *task, int &ntask)
+{
+    if (lo >= hi) {
+        *pp = NULL;
+        return;
+    }
+    if (levels == 0) {
+        BulkTask *t = &task[ntask++];
+        t->key = key;
+        t->node = node;
+        t->lo = lo;
+        t->hi = hi;
+        t->pp = pp;
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    Node *p = &node[mid];
+    p->key = key[mid];
+    *pp = p;
+    splitBulk(key, node, lo, mid, &p->left, levels - 1, task, ntask);
+    splitBulk(key, node, mid + 1, hi, &p->right, levels - 1, task, ntask);
+}
+
+//
+// bulkWorker
+//
+WORKER bulkWorker(void *vtask)
+{
+    BulkTask *t = (BulkTask*) vtask;
+    *t->pp = buildBalanced(t->key, t->node, t->lo, t->hi);
+    return 0;
+}
+
+//
+// bulkLoad
+//
+// replace the tree with a perfectly balanced tree of n sorted distinct keys in O(n)
+// nodes come from one contiguous block (node i holds key i, so in order is memory order)
+// which is freed by the next bulkLoad, sub trees below the top levels are built by nt threads
+// no other thread may be using the tree
+//
+void BST::bulkLoad(INT64 *key, int n, int nt)
+{
+    freeBulk();
+    bulk = n ? (Node*) AMALLOC(n*sizeof(Node), 64) : NULL;
+    nbulk = n;
+    int levels = 0;
+    while ((1 << levels) < nt)
+        levels++;
+    BulkTask *task = new BulkTask[1 << levels];
+    THREADH *h = new THREADH[1 << levels];
+    int ntask = 0;
+    splitBulk(key, bulk, 0, n, &root, levels, task, ntask);
+    for (int i = 0; i < ntask; i++)
+        createThread(&h[i], bulkWorker, &task[i]);
+    waitForThreadsToFinish(ntask, h);
+    for (int i = 0; i < ntask; i++)
+        closeThread(h[i]);
+    delete[] h;
+    delete[] task;
+}
+
+//
+// freeBulk
+//
+void BST::freeBulk()
+{
+    if (bulkMap)
+        unmapImage(bulkMap, bulkMapSz);
+    else if (bulk)
+        AFREE(bulk);
+    bulk = NULL;
+    nbulk = 0;
+    bulkMap = NULL;
+    bulkMapSz = 0;
+}
+
+//
+// ImageNode
+//
+// node of a tree image, children are record index + 1 (0 = none) so an image can be mapped at
+// any address; the same size as Node so a copy on write map can be relinked in place
+//
+typedef struct {
+    INT64 key;
+    UINT64 left;
+    UINT64 right;
+} ImageNode;
+
+static_assert(sizeof(ImageNode) == sizeof(Node), "ImageNode and Node differ in size");
+
+#define IMAGEMAGIC  0x31474d4954534221ULL     // "!BSTIMG1"
+
+//
+// ImageHdr
+//
+// first page of an image, records follow at IMAGEPAGE
+//
+typedef struct {
+    UINT64 magic;                               // IMAGEMAGIC, written last so a partly written image is never used
+    UINT64 n;                                   // # records
+    UINT64 root;                                // record index + 1 of root, 0 if empty
+} ImageHdr;
+
+//
+// Image
+//
+// a mapped image
+//
+struct Image {
+    void *base;                                 // mapping
+    size_t sz;                                  // mapping bytes
+    ImageNode *node;                            // records
+    UINT64 n;                                   // # records
+    UINT64 root;                                // record index + 1 of root
+};
+
+Image image;                                    // image mapped by prefill
+double imageSaveMS;                             // time to write image (0 if it was already there)
+double imageLoadMS;                             // time to map image and, if copy on write, relink it
+
+//
+// ImageTask
+//
+// sub tree of an image filled in and written by one thread, its records are lo .. hi-1
+//
+typedef struct {
+    INT64 *key;                                 // sorted keys, record i holds key[i]
+    int lo;
+    int hi;
+    INT64 h;                                    // image file
+    int ok;                                     // 0 if write failed
+} ImageTask;
+
+//
+// imageRoot
+//
+// record index + 1 of the root of the balanced sub tree of key[lo] .. key[hi-1]
+//
+inline UINT64 imageRoot(int lo, int hi)
+{
+    return lo < hi ? lo + (hi - lo) / 2 + 1 : 0;
+}
+
+//
+// fillImage
+//
+// fill in the records of the balanced sub tree of key[lo] .. key[hi-1], node[0] is record base
+//
+void fillImage(INT64 *key, ImageNode *node, int base, int lo, int hi)
+{
+    if (lo >= hi)
+        return;
+    int mid = lo + (hi - lo) / 2;
+    ImageNode *p = &node[mid - base];
+    p->key = key[mid];
+    p->left = imageRoot(lo, mid);
+    p->right = imageRoot(mid + 1, hi);
+    fillImage(key, node, base, lo, mid);
+    fillImage(key, node, base, mid + 1, hi);
+}
+
+//
+// splitImage
+//
+// write the records of the top levels and queue the sub trees below them as tasks
+//
+void splitImage(INT64 *key, int lo, int hi, INT64 h, int levels, ImageTask *task, int &ntask, int &ok)
+{
+    if (lo >= hi)
+        return;
+    if (levels == 0) {
+        ImageTask *t = &task[ntask++];
+        t->key = key;
+        t->lo = lo;
+        t->hi = hi;
+        t->h = h;
+        return;
+    }
+    int mid = lo + (hi - lo) / 2;
+    ImageNode p;
+    p.key = key[mid];
+    p.left = imageRoot(lo, mid);
+    p.right = imageRoot(mid + 1, hi);
+    ok &= writeImage(h, &p, sizeof(p), IMAGEPAGE + (size_t) mid*sizeof(ImageNode));
+    splitImage(key, lo, mid, h, levels - 1, task, ntask, ok);
+    splitImage(key, mid + 1, hi, h, levels - 1, task, ntask, ok);
+}
+
+//
+// imageWorker
+//
+WORKER imageWorker(void *vtask)
+{
+    ImageTask *t = (ImageTask*) vtask;
+    ImageNode *node = new ImageNode[t->hi - t->lo];
+    fillImage(t->key, node, t->lo, t->lo, t->hi);
+    t->ok = writeImage(t->h, node, (size_t) (t->hi - t->lo)*sizeof(ImageNode), IMAGEPAGE + (size_t) t->lo*sizeof(ImageNode));
+    delete[] node;
+    return 0;
+}
+
+//
+// saveImage
+//
+// write an image of the tree with the same balanced shape as bulkLoad, the keys are gathered
+// with the lock held and the sub trees below the top levels are filled in and written by nt
+// threads; returns 0 if the image could not be written
+//
+int BST::saveImage(const char *fn, INT64 *buf, int nt)
+{
+    acquireTATAS();
+    int n = gatherCS(root, buf, 0);
+    releaseTATAS();
+    INT64 h = createImage(fn, IMAGEPAGE + (size_t) n*sizeof(ImageNode));
+    if (h < 0)
+        return 0;
+    int levels = 0;
+    while ((1 << levels) < nt)
+        levels++;
+    ImageTask *task = new ImageTask[1 << levels];
+    THREADH *th = new THREADH[1 << levels];
+    int ntask = 0;
+    int ok = 1;
+    splitImage(buf, 0, n, h, levels, task, ntask, ok);
+    for (int i = 0; i < ntask; i++)
+        createThread(&th[i], imageWorker, &task[i]);
+    waitForThreadsToFinish(ntask, th);
+    for (int i = 0; i < ntask; i++) {
+        closeThread(th[i]);
+        ok &= task[i].ok;
+    }
+    delete[] th;
+    delete[] task;
+    ImageHdr hdr;
+    hdr.magic = IMAGEMAGIC;
+    hdr.n = n;
+    hdr.root = imageRoot(0, n);
+    ok &= writeImage(h, &hdr, sizeof(hdr), 0);
+    closeImage(h);
+    return ok;
+}
+
+//
+// loadImage
+//
+// map an image read only or copy on write, nothing but the header is read until it is touched so
+// child indexes are bounds checked where they are used; returns 0 if there is no valid image
+//
+int loadImage(const char *fn, int cow, Image &img)
+{
+    img.base = mapImage(fn, cow, img.sz);
+    if (img.base == NULL)
+        return 0;
+    ImageHdr *hdr = (ImageHdr*) img.base;
+    if (img.sz < IMAGEPAGE || hdr->magic != IMAGEMAGIC || img.sz != IMAGEPAGE + hdr->n*sizeof(ImageNode) || hdr->root > hdr->n) {
+        unmapImage(img.base, img.sz);
+        img.base = NULL;
+        return 0;
+    }
+    img.node = (ImageNode*) ((char*) img.base + IMAGEPAGE);
+    img.n = hdr->n;
+    img.root = hdr->root;
+    return 1;
+}
+
+//
+// freeImage
+//
+void freeImage(Image &img)
+{
+    if (img.base)
+        unmapImage(img.base, img.sz);
+    img.base = NULL;
+}
+
+//
+// imageContains
+//
+// lookup straight from a mapped image, needs no lock as the image never changes
+// a link past the last record (a corrupt image) ends the search
+//
+int imageContains(Image &img, INT64 key)
+{
+    UINT64 i = img.root;
+    while (i && i <= img.n) {
+        ImageNode *p = &img.node[i - 1];
+        if (key == p->key)
+            return 1;
+        i = key < p->key ? p->left : p->right;
+    }
+    return 0;
+}
+
+//
+// RelinkTask
+//
+// records lo .. hi-1 of a copy on write image relinked by one thread
+//
+typedef struct {
+    Node *node;
+    UINT64 n;                                   // # records
+    UINT64 lo;
+    UINT64 hi;
+    int ok;                                     // 0 if a link is past the last record
+} RelinkTask;
+
+//
+// relinkWorker
+//
+// turn record indexes into pointers in place, each page written gets its private copy
+//
+WORKER relinkWorker(void *vtask)
+{
+    RelinkTask *t = (RelinkTask*) vtask;
+    t->ok = 1;
+    for (UINT64 i = t->lo; i < t->hi; i++) {
+        Node *p = &t->node[i];
+        UINT64 l = (UINT64) p->left;
+        UINT64 r = (UINT64) p->right;
+        if (l > t->n || r > t->n) {
+            t->ok = 0;
+            return 0;
+        }
+        p->left = l ? &t->node[l - 1] : NULL;
+        p->right = r ? &t->node[r - 1] : NULL;
+    }
+    return 0;
+}
+
+//
+// adoptImage
+//
+// replace the tree with a copy on write mapped image relinked in place by nt threads, its records
+// become the bulk block so its nodes are never freed individually and are unmapped by freeBulk
+// relinking writes every record, so every page of the image is faulted in and privately copied
+// returns 0, leaving the tree empty and the image unmapped, if a link is past the last record
+// no other thread may be using the tree
+//
+int BST::adoptImage(Image &img, int nt)
+{
+    freeBulk();
+    Node *node = (Node*) img.node;
+    RelinkTask *task = new RelinkTask[nt];
+    THREADH *h = new THREADH[nt];
+    for (int i = 0; i < nt; i++) {
+        task[i].node = node;
+        task[i].n = img.n;
+        task[i].lo = img.n * i / nt;
+        task[i].hi = img.n * (i + 1) / nt;
+        createThread(&h[i], relinkWorker, &task[i]);
+    }
+    waitForThreadsToFinish(nt, h);
+    int ok = 1;
+    for (int i = 0; i < nt; i++) {
+        closeThread(h[i]);
+        ok &= task[i].ok;
+    }
+    delete[] h;
+    delete[] task;
+    if (!ok) {
+        freeImage(img);
+        return 0;
+    }
+    bulk = node;
+    nbulk = (int) img.n;
+    bulkMap = img.base;
+    bulkMapSz = img.sz;
+    root = img.root ? &node[img.root - 1] : NULL;
+    img.base = NULL;
+    return 1;
+}
+
+//
+// addCS
+//
+// add critical section, caller must hold the lock
+// returns 1 if n was linked into the tree, 0 if key already present
+//
+int BST::addCS(Node *n)
+{
+    Node* volatile* volatile pp = &root;
+    Node* volatile p = root;
+    while (p) {
+        if (n->key < p->key) {
+            pp = &p->left;
+        } else if (n->key > p->key) {
+            pp = &p->right;
+        } else {
+            return 0;
+        }
+        p = *pp;
+    }
+    version++; // odd: writer active
+    *pp = n;
+    version++;
+    return 1;
+}
+
+//
+// removeCS
+//
+// remove critical section, caller must hold the lock
+// returns 1 if key was removed, 0 if key not present
+//
+int BST::removeCS(INT64 key)
+{
+    Node* volatile* volatile pp = &root;
+    Node* volatile p = root;
+    while (p) {
+        if (key < p->key) {
+            pp = &p->left;
+        } else if (key > p->key) {
+            pp = &p->right;
+        } else {
+            break;
+        }
+        p = *pp;
+    }
+    if (p == NULL)
+        return 0;
+    version++; // odd: writer active
+    if (p->left == NULL && p->right == NULL) {
+        *pp = NULL; // NO children
+    } else if (p->left == NULL) {
+        *pp = p->right; // ONE child
+    } else if (p->right == NULL) {
+        *pp = p->left; // ONE child
+    } else {
+        Node *r = p->right; // TWO children
+        Node* volatile* volatile ppr = &p->right; // find min key in right sub tree
+        while (r->left) {
+            ppr = &r->left;
+            r = r->left;
+        }
+        p->key = r->key; // could move...
+        p = r; // node instead
+        *ppr = r->right;
+    }
+    p->left = retired; // retire, a stale reader may still be looking at p
+    retired = p;
+    version++;
+    return 1;
+}
+
+int BST::add(Node *n)
+{
+    acquireTATAS();
+    int r = addCS(n);
+    releaseTATAS();
+    return r;
+}
+
+int BST::remove(INT64 key)
+{
+    acquireTATAS();
+    int r = removeCS(key);
+    releaseTATAS();
+    return r;
+}
+
+//
+// containsCS
+//
+// lookup, caller must hold the lock
+//
+int BST::containsCS(INT64 key)
+{
+    Node* volatile p = root;
+    while (p && p->key != key)
+        p = (key < p->key) ? p->left : p->right;
+    return p != NULL;
+}
+
+//
+// contains
+//
+// optimistic lookup that never writes shared memory: read an even version (no writer
+// active), search, then check version is unchanged. After MAXREADATTEMPTS failures take
+// the lock.
+//
+// removed nodes are retired rather than freed until reclaim() is called at a quiescent
+// point so a reader racing a writer only ever follows pointers to valid nodes, and it
+// rechecks version every 64 steps so a writer can't keep it going round a cycle
+//
+int BST::contains(INT64 key)
+{
+    for (int attempt = 0; attempt < MAXREADATTEMPTS; attempt++) {
+        UINT64 v = version;
+        if (v & 1) {
+            _mm_pause();
+            continue;
+        }
+        Node* volatile p = root;
+        int steps = 0;
+        while (p && p->key != key) {
+            p = (key < p->key) ? p->left : p->right;
+            if ((++steps & 63) == 0 && version != v)
+                break;
+        }
+        if (version == v)
+            return p != NULL;
+    }
+    acquireTATAS();
+    int found = containsCS(key);
+    releaseTATAS();
+    return found;
+}
+
+//
+// reclaim
+//
+void BST::reclaim()
+{
+    while (retired) {
+        Node *p = retired;
+        retired = p->left;
+        if (!inBulk(p))
+            delete p;
+    }
+}
+
+//
+// scanCS
+//
+// in order walk of the part of sub tree p that can hold keys in [lo, hi]
+// keys are appended to buf starting at buf[n], returns new n (at most max)
+//
+int BST::scanCS(Node *p, INT64 lo, INT64 hi, INT64 *buf, int n, int max)
+{
+    while (p && n < max) {
+        if (p->key > lo)
+            n = scanCS(p->left, lo, hi, buf, n, max);
+        if (p->key >= lo && p->key <= hi && n < max)
+            buf[n++] = p->key;
+        if (p->key >= hi)
+            break;
+        p = p->right;
+    }
+    return n;
+}
+
+//
+// removeRangeCS
+//
+// repeatedly find a node with a key in [lo, hi] and remove it
+// returns # keys removed
+//
+int BST::removeRangeCS(INT64 lo, INT64 hi)
+{
+    int n = 0;
+    while (1) {
+        Node* volatile p = root;
+        while (p && (p->key < lo || p->key > hi))
+            p = (p->key < lo) ? p->right : p->left;
+        if (p == NULL)
+            return n;
+        n += removeCS(p->key);
+    }
+}
+
+//
+// scan
+//
+// scans and range removes hold the lock for the whole range so they are atomic
+//
+int BST::scan(INT64 lo, INT64 hi, INT64 *buf, int max)
+{
+    acquireTATAS();
+    int n = scanCS(root, lo, hi, buf, 0, max);
+    releaseTATAS();
+    return n;
+}
+
+//
+// removeRange
+//
+int BST::removeRange(INT64 lo, INT64 hi)
+{
+    acquireTATAS();
+    int n = removeRangeCS(lo, hi);
+    releaseTATAS();
+    return n;
+}
+
+//
+// applyBatch
+//
+// sort a thread local batch of ops by key and apply them all in one critical section
+// ops on the same key keep their original order (stable sort)
+// op[i].result is set to 1 if op i changed the tree
+//
+void BST::applyBatch(BatchOp *op, int n)
+{
+    stable_sort(op, op + n, batchOpLess);
+    acquireTATAS();
+    for (int i = 0; i < n; i++)
+        op[i].result = op[i].add ? addCS(op[i].n) : removeCS(op[i].key);
+    releaseTATAS();
+}
+
+//
+// interleaveCS
+//
+// one step of each unfinished traversal in turn: compare at p, follow the child link and
+// prefetch the child, then switch to the next traversal. By the time a traversal is stepped
+// again its node should have arrived, so the cache misses of the n traversals overlap instead
+// of forming one serial chain per op.
+//
+// with the lock held (locked) an add links its node when it reaches a NULL link. The link is
+// re-read first as another add of the group may have just filled it, in which case the walk
+// carries on. Without the lock only lookups are run, and version is checked every 64 rounds
+// so a walk racing a writer gives up (retired nodes are never freed during a run).
+//
+int BST::interleaveCS(Walk *w, int n, int locked, UINT64 v)
+{
+    int active = n;
+    for (int i = 0; i < n; i++) {
+        w[i].pp = &root;
+        w[i].p = root;
+    }
+    for (int round = 1; active; round++) {
+        for (int i = 0; i < n; i++) {
+            Walk *x = &w[i];
+            if (x->pp == NULL)
+                continue; // finished
+            Node *p = x->p;
+            if (p == NULL && locked)
+                p = x->p = *x->pp;
+            if (p == NULL || p->key == x->key) {
+                if (x->op == LOOKUP) {
+                    x->result = p != NULL;
+                } else if (p) {
+                    x->result = 0; // key already present
+                } else {
+                    version++; // odd: writer active
+                    *x->pp = x->n;
+                    version++;
+                    x->result = 1;
+                }
+                x->pp = NULL;
+                active--;
+                continue;
+            }
+            x->pp = (x->key < p->key) ? &p->left : &p->right;
+            x->p = *x->pp;
+            if (x->p)
+                _mm_prefetch((const char*) x->p, _MM_HINT_T0);
+        }
+        if (!locked && (round & 63) == 0 && version != v)
+            return 0;
+    }
+    return 1;
+}
+
+//
+// interleave
+//
+// a group of lookups only is run optimistically like contains(), a group with an add takes
+// the lock. The ops of a group are concurrent with each other, so a lookup may or may not see
+// an add queued before it in the same group.
+//
+void BST::interleave(Walk *w, int n)
+{
+    int adds = 0;
+    for (int i = 0; i < n; i++)
+        adds += w[i].op != LOOKUP;
+    if (adds == 0) {
+        for (int attempt = 0; attempt < MAXREADATTEMPTS; attempt++) {
+            UINT64 v = version;
+            if (v & 1) {
+                _mm_pause();
+                continue;
+            }
+            if (interleaveCS(w, n, 0, v) && version == v)
+                return;
+        }
+    }
+    acquireTATAS();
+    interleaveCS(w, n, 1, 0);
+    releaseTATAS();
+}
+
+//
+// gatherCS
+//
+// caller must hold the lock
+//
+int BST::gatherCS(Node *p, INT64 *buf, int n)
+{
+    while (p) {
+        n = gatherCS(p->left, buf, n);
+        buf[n++] = p->key;
+        p = p->right;
+    }
+    return n;
+}
+
+//
+// Snapshot
+//
+// read only copy of the keys in Eytzinger (BFS) order: key[1] is the root and the children of
+// key[k] are key[2k] and key[2k+1]. The array is padded to a complete tree of levels levels with
+// INT64_MIN, so every lookup takes exactly levels steps and the last level needs no bounds test
+// (a lookup always goes right at a pad, which leaves its answer unchanged).
+//
+typedef struct {
+    INT64 *key;                                 // [1 << levels], 64 byte aligned
+    int n;                                      // # keys
+    int levels;                                 // # levels
+} Snapshot;
+
+Snapshot* volatile snap;                        // current snapshot, swapped atomically
+
+//
+// SnapHazard
+//
+// snapshot a thread is reading, own cache line. The publisher only frees an old snapshot once
+// no thread has it as its hazard.
+//
+class SnapHazard {
+    public:
+        ALIGN(64) Snapshot* volatile s;
+};
+
+SnapHazard *snapHazard;                         // [thread]
+int snapThreads;                                // # threads that may hold a hazard
+INT64 *snapSorted;                              // keys gathered for the next snapshot, [key range]
+UINT64 snapCount;                               // # snapshots published this run
+UINT64 snapUS;                                  // us spent publishing this run
+
+//
+// subtreeSize
+//
+// # keys in the sub tree of Eytzinger index k in an array of n keys
+//
+int subtreeSize(UINT64 k, int n)
+{
+    int size = 0;
+    for (UINT64 w = 1; k <= (UINT64) n; k <<= 1, w <<= 1)
+        size += (int) min(w, (UINT64) n - k + 1);
+    return size;
+}
+
+//
+// subtreeStart
+//
+// rank in sorted order of the smallest key in the sub tree of index k
+//
+int subtreeStart(UINT64 k, int n)
+{
+    int depth = 0;
+    while ((k >> depth) > 1)
+        depth++;
+    int start = 0;
+    for (int d = depth - 1; d >= 0; d--) {
+        if ((k >> d) & 1) // right child
+            start += subtreeSize((k >> d) - 1, n) + 1;
+    }
+    return start;
+}
+
+//
+// eytzinger
+//
+// lay out sorted[i ...] as the sub tree of index k
+//
+void eytzinger(INT64 *sorted, INT64 *key, int n, UINT64 k, int &i)
+{
+    if (k > (UINT64) n)
+        return;
+    eytzinger(sorted, key, n, 2*k, i);
+    key[k] = sorted[i++];
+    eytzinger(sorted, key, n, 2*k + 1, i);
+}
+
+typedef struct {
+    Snapshot *s;
+    INT64 *sorted;
+    UINT64 k;                                   // sub tree to lay out
+} SnapTask;
+
+WORKER snapWorker(void *vtask)
+{
+    SnapTask *t = (SnapTask*) vtask;
+    int i = subtreeStart(t->k, t->s->n);
+    eytzinger(t->sorted, t->s->key, t->s->n, t->k, i);
+    return 0;
+}
+
+//
+// buildSnapshot
+//
+// copy the keys out in order with the lock held, then lay them out without it: the top
+// levels directly and each sub tree below them by its own thread
+//
+Snapshot *buildSnapshot(INT64 *sorted, int nt)
+{
+    Snapshot *s = new Snapshot;
+    BinarySearchTree->acquireTATAS();
+    s->n = BinarySearchTree->gatherCS(BinarySearchTree->root, sorted, 0);
+    BinarySearchTree->releaseTATAS();
+    s->levels = 0;
+    while ((1 << s->levels) <= s->n)
+        s->levels++;
+    int sz = 1 << s->levels;
+    s->key = (INT64*) AMALLOC(sz*sizeof(INT64), 64);
+    s->key[0] = INT64_MIN;
+    for (int k = s->n + 1; k < sz; k++)
+        s->key[k] = INT64_MIN;
+    int split = 0;
+    while ((1 << split) < nt && split + 1 < s->levels)
+        split++;
+    for (UINT64 k = 1; k < ((UINT64) 1 << split); k++)
+        s->key[k] = sorted[subtreeStart(k, s->n) + subtreeSize(2*k, s->n)];
+    int ntask = 1 << split;
+    SnapTask *task = new SnapTask[ntask];
+    THREADH *h = new THREADH[ntask];
+    for (int i = 0; i < ntask; i++) {
+        task[i].s = s;
+        task[i].sorted = sorted;
+        task[i].k = ((UINT64) 1 << split) + i;
+        createThread(&h[i], snapWorker, &task[i]);
+    }
+    waitForThreadsToFinish(ntask, h);
+    for (int i = 0; i < ntask; i++)
+        closeThread(h[i]);
+    delete[] h;
+    delete[] task;
+    return s;
+}
+
+void freeSnapshot(Snapshot *s)
+{
+    if (s) {
+        AFREE(s->key);
+        delete s;
+    }
+}
 
-//ALIGN(64) volatile long lock = 0;
+//
+// snapAnswer
+//
+// after the walk the bits of k below the leading 1 are the path taken (1 = right), the
+// answer is the last node where the walk went left: strip the trailing 1s and that 0
+//
+inline UINT64 snapAnswer(UINT64 k)
+{
+#ifdef WIN32
+    unsigned long i;
+    _BitScanForward64(&i, ~k);
+    return k >> (i + 1);
+#else
+    return k >> __builtin_ffsll(~k);
+#endif
+}
 
-class Node {
-    public:
-        INT64 volatile key;
-        Node* volatile left;
-        Node* volatile right;
-        Node() {key = 0; right = left = NULL;} // default constructor
-};
+//
+// snapFind
+//
+// branch free: each step is k = 2k + (key > key[k]). The 8 keys starting at key[8k] (one cache
+// line) are k's descendants 3 levels down, so they are prefetched 3 steps ahead.
+//
+int snapFind(Snapshot *s, INT64 key)
+{
+    UINT64 k = 1;
+    for (int d = 0; d < s->levels; d++) {
+        _mm_prefetch((const char*) (s->key + 8*k), _MM_HINT_T0);
+        k = 2*k + (key > s->key[k]);
+    }
+    k = snapAnswer(k);
+    return k != 0 && s->key[k] == key;
+}
 
-class BST {
-    public:
-        Node* volatile root; // root of BST, initially NULL
-        ALIGN(64) volatile long lock;
-        BST() {root = NULL, lock = 0;} // default constructor
-        void add(Node *nn); // add node to tree
-        void destroy(volatile Node *nextNode);
-        void remove(INT64 key); // remove key from tree
-        void releaseTATAS();  //HLE functionality added to BST class
-        void acquireTATAS();
-};
+#ifdef __AVX2__
+//
+// snapFind8
+//
+// 8 lookups in lockstep, two vectors of 4 so two gathers are in flight each step
+//
+void snapFind8(Snapshot *s, INT64 *keys, int *found)
+{
+    __m256i x0 = _mm256_loadu_si256((const __m256i*) keys);
+    __m256i x1 = _mm256_loadu_si256((const __m256i*) (keys + 4));
+    __m256i k0 = _mm256_set1_epi64x(1);
+    __m256i k1 = k0;
+    for (int d = 0; d < s->levels; d++) {
+        __m256i v0 = _mm256_i64gather_epi64((const long long*) s->key, k0, 8);
+        __m256i v1 = _mm256_i64gather_epi64((const long long*) s->key, k1, 8);
+        k0 = _mm256_sub_epi64(_mm256_add_epi64(k0, k0), _mm256_cmpgt_epi64(x0, v0)); // cmpgt is -1 if key > key[k]
+        k1 = _mm256_sub_epi64(_mm256_add_epi64(k1, k1), _mm256_cmpgt_epi64(x1, v1));
+    }
+    UINT64 k[8];
+    _mm256_storeu_si256((__m256i*) k, k0);
+    _mm256_storeu_si256((__m256i*) (k + 4), k1);
+    for (int i = 0; i < 8; i++) {
+        UINT64 j = snapAnswer(k[i]);
+        found[i] = j != 0 && s->key[j] == keys[i];
+    }
+}
+#endif
 
-BST *BinarySearchTree = new BST;
+//
+// snapLookup
+//
+// answer n lookups from the current snapshot. The hazard is set with an exchange (a full fence)
+// and snap re-read, so once the publisher has swapped snap and seen no hazard on the old
+// snapshot, no thread can still pick the old one up.
+//
+void snapLookup(SnapHazard *h, INT64 *keys, int *found, int n)
+{
+    Snapshot *s;
+    do {
+        s = snap;
+        (void) InterlockedExchangePointer(&h->s, s);
+    } while (snap != s);
+#ifdef __AVX2__
+    if (n == 8) {
+        snapFind8(s, keys, found);
+        h->s = NULL;
+        return;
+    }
+#endif
+    for (int i = 0; i < n; i++)
+        found[i] = snapFind(s, keys[i]);
+    h->s = NULL;
+}
 
-void BST::add (Node *n)
+//
+// publishWorker
+//
+// republish the snapshot every SNAPMS ms, lookups never wait for the publisher or the lock
+//
+WORKER publishWorker(void *)
 {
-    acquireTATAS();
-    Node* volatile* volatile pp = &root;
-    Node* volatile p = root;
-    while (p) {
-        if (n->key < p->key) {
-        pp = &p->left;
-        } else if (n->key > p->key) {
-            pp = &p->right;
-            } else {
-                releaseTATAS();
-                return;
-            }
-        p = *pp;
+    while ((getWallClockMS() - tstart) + SNAPMS < NSECONDS*1000) {
+        Sleep(SNAPMS);
+        UINT64 t0 = getWallClockUS();
+        Snapshot *s = buildSnapshot(snapSorted, ncpu);
+        Snapshot *old = (Snapshot*) InterlockedExchangePointer(&snap, s);
+        for (int thread = 0; thread < snapThreads; thread++) {
+            while (snapHazard[thread].s == old)
+                _mm_pause();
+        }
+        freeSnapshot(old);
+        snapUS += getWallClockUS() - t0;
+        snapCount++;
     }
-    *pp = n;
-    releaseTATAS();
+    return 0;
 }
 
-void BST::remove(INT64 key)
+//
+// probe
+//
+// walk the search path of key without the lock recording # nodes and # distinct cache lines
+// visited (a node may straddle two lines). Racy but safe as removed nodes are retired rather
+// than freed during a run, and bounded in case it races a writer.
+//
+void BST::probe(INT64 key, int &depth, int &lines)
 {
-    acquireTATAS();
-    Node* volatile* volatile pp = &root;
+    size_t line[2*MAXDEPTH];
+    depth = lines = 0;
     Node* volatile p = root;
-    while (p) {
-        if (key < p->key) {
-            pp = &p->left;
-        } else if (key > p->key) {
-            pp = &p->right;
-            } else {
-                break;
-            }
-        p = *pp;
-    }
-    if (p == NULL)
-        releaseTATAS();
-        return;
-    if (p->left == NULL && p->right == NULL) {
-        *pp = NULL; // NO children
-    } else if (p->left == NULL) {
-        *pp = p->right; // ONE child
-    } else if (p->right == NULL) {
-        *pp = p->left; // ONE child
-    } else {
-        Node *r = p->right; // TWO children
-        Node* volatile* volatile ppr = &p->right; // find min key in right sub tree
-        while (r->left) {
-            ppr = &r->left;
-            r = r->left;
+    while (p && depth < MAXDEPTH) {
+        size_t l0 = (size_t) p / lineSz;
+        size_t l1 = ((size_t) p + sizeof(Node) - 1) / lineSz;
+        for (size_t l = l0; l <= l1; l++) {
+            int i = 0;
+            while (i < lines && line[i] != l)
+                i++;
+            if (i == lines)
+                line[lines++] = l;
         }
-        p->key = r->key; // could move...
-        p = r; // node instead
-        *ppr = r->right;
+        depth++;
+        if (p->key == key)
+            break;
+        p = (key < p->key) ? p->left : p->right;
     }
-    releaseTATAS();
+}
+
+//
+// shapeCS
+//
+// caller must hold the lock
+//
+int BST::shapeCS(Node *p, int depth, ShapeStats *s)
+{
+    if (p == NULL)
+        return depth;
+    s->nodes++;
+    s->hist[min(depth, MAXDEPTH - 1)]++;
+    return max(shapeCS(p->left, depth + 1, s), shapeCS(p->right, depth + 1, s));
 }
 
 void BST::destroy(volatile Node *nextNode)
@@ -178,31 +1255,306 @@ void BST::releaseTATAS() {
     lock = 0;
 }
 
+//
+// warmStart
+//
+// map the tree image, a copy on write image replaces the tree
+// returns 0 if there is no valid image
+//
+int warmStart(const char *fn)
+{
+    UINT64 t0 = getWallClockUS();
+    if (!loadImage(fn, IMAGE == IMAGECOW, image))
+        return 0;
+#if IMAGE == IMAGECOW
+    if (!BinarySearchTree->adoptImage(image, ncpu))
+        return 0;
+#endif
+    imageLoadMS = (double) (getWallClockUS() - t0) / 1000;
+    return 1;
+}
+
+//
+// prefill
+//
+// bulk load PREFILL% of the keys in [0, range), evenly spaced so the shape is the same every run
+// with IMAGE the tree is warm started from its image, which is bulk loaded and written first if
+// there isn't one yet
+//
+void prefill(UINT range)
+{
+#if IMAGE > 0
+    char fn[256];
+    sprintf(fn, IMAGEFILE, range, PREFILL);
+    imageSaveMS = 0;
+    if (warmStart(fn))
+        return;
+#endif
+    int n = (int) ((UINT64) range * PREFILL / 100);
+    INT64 *key = new INT64[n];
+    for (int i = 0; i < n; i++)
+        key[i] = (UINT64) i * range / n;
+    BinarySearchTree->bulkLoad(key, n, ncpu);
+#if IMAGE > 0
+    UINT64 t0 = getWallClockUS();
+    int ok = BinarySearchTree->saveImage(fn, key, ncpu);
+    imageSaveMS = (double) (getWallClockUS() - t0) / 1000;
+    if (!ok || !warmStart(fn)) {
+        cout << "unable to write " << fn << endl;
+        quit(1);
+    }
+#endif
+    delete[] key;
+}
+
+//
+// shapeWorker
+//
+// out of band tree shape sampling, every SHAPEMS ms take the lock and walk the whole tree
+// the last sample of the run is reported
+//
+WORKER shapeWorker(void *)
+{
+    ShapeStats s;
+    while ((getWallClockMS() - tstart) + SHAPEMS < NSECONDS*1000) {
+        Sleep(SHAPEMS);
+        memset(&s, 0, sizeof(s));
+        BinarySearchTree->acquireTATAS();
+        s.height = BinarySearchTree->shapeCS(BinarySearchTree->root, 0, &s);
+        BinarySearchTree->releaseTATAS();
+        shape = s;
+    }
+    return 0;
+}
+
 typedef struct {
     int sharing;                                // sharing
     int nt;                                     // # threads
     UINT64 rt;                                  // run time (ms)
     UINT64 ops;                                 // ops
-    UINT64 incs;                                // should be equal ops
+    UINT64 op[NOPTYPE];                         // ops by type
+    UINT64 eff[NOPTYPE];                        // effective ops by type
+    double steady;                              // steady state ops/s
+    double cv;                                  // cv % of steady state buckets
+    UINT64 minOps;                              // fewest ops by a thread
+    UINT64 maxOps;                              // most ops by a thread
+    double cvOps;                               // cv % of ops per thread
+    double jain;                                // Jain's fairness index of ops per thread
+    UINT64 maxGap;                              // longest op-free interval of any thread (us)
+    double depth;                               // mean search path length of sampled ops
+    double lines;                               // mean distinct cache lines of sampled ops
+    UINT64 nodes;                               // # nodes at last shape sample
+    int height;                                 // height at last shape sample
+    UINT64 faults;                              // page faults
+    UINT64 dtlb;                                // DTLB load misses
+    UINT64 snaps;                               // snapshots published
+    double snapUS;                              // mean us to build and publish a snapshot
+    double saveMS;                              // ms to write tree image (0 if already there)
+    double loadMS;                              // ms to warm start from tree image
 } Result;
 
 Result *r;                                      // results
 UINT indx;                                      // results index
 
-volatile VINT *g;                               // NB: position of volatile
+//
+// OpStats
+//
+// per thread op counts by type, own cache line
+// an op is effective if it inserts, removes or finds a key, or is a range op that hits at least
+// one key, so op - eff counts duplicate adds, removes of absent keys and lookup misses
+//
+class OpStats {
+    public:
+        ALIGN(64) UINT64 op[NOPTYPE];
+        UINT64 eff[NOPTYPE];
+};
+
+OpStats *opStats;                               // [thread]
+thread_local OpStats *opCount;                  // this thread's op counts
+
+const char *opName[NOPTYPE] = {"rem/s", "add/s", "get/s", "scan/s", "rdel/s"};
+const char *effName[NOPTYPE] = {"removed/s", "inserted/s", "found/s", "hit/s", "hit/s"};
+
+inline void countOp(UINT op, int result) {
+    opCount->op[op]++;
+    opCount->eff[op] += result > 0;
+}
+
+thread_local BatchOp *batch;                     // thread local batch of ops
+thread_local INT64 *scanBuf;                    // keys returned by scan
+thread_local PathStats *path;                   // search path samples
+thread_local int nsample;                       // ops since last sample
+thread_local int nbatch;                        // # ops in batch
+thread_local INT64 *snapKey;                    // lookups queued for the snapshot
+thread_local int *snapFound;                    // their results
+thread_local int nsnap;                         // # lookups queued
+thread_local SnapHazard *hazard;                // this thread's snapshot hazard
+thread_local Walk *walk;                        // queued lookups and adds
+thread_local int nwalk;                         // # ops in walk
+
+//
+// flushBatch
+//
+// apply the queued ops and free the nodes of adds that found their key already present
+//
+void flushBatch() {
+    if (nbatch == 0)
+        return;
+    BinarySearchTree->applyBatch(batch, nbatch);
+    for (int i = 0; i < nbatch; i++) {
+        if (batch[i].add && batch[i].result == 0)
+            delete batch[i].n;
+        countOp(batch[i].add, batch[i].result);
+    }
+    nbatch = 0;
+}
+
+//
+// flushWalk
+//
+// run the queued lookups and adds, free the nodes of adds that found their key already present
+//
+void flushWalk() {
+    if (nwalk == 0)
+        return;
+    BinarySearchTree->interleave(walk, nwalk);
+    for (int i = 0; i < nwalk; i++) {
+        if (walk[i].op != LOOKUP && walk[i].result == 0)
+            delete walk[i].n;
+        countOp(walk[i].op, walk[i].result);
+    }
+    nwalk = 0;
+}
+
+//
+// flushSnap
+//
+void flushSnap() {
+    if (nsnap == 0)
+        return;
+    snapLookup(hazard, snapKey, snapFound, nsnap);
+    for (int i = 0; i < nsnap; i++)
+        countOp(LOOKUP, snapFound[i]);
+    nsnap = 0;
+}
 
 void runOp(UINT randomValue, UINT randomBit) {
+#if SAMPLE > 0
+    if (++nsample == SAMPLE) {
+        int depth, lines;
+        nsample = 0;
+        BinarySearchTree->probe(randomValue, depth, lines);
+        path->n++;
+        path->depth += depth;
+        path->lines += lines;
+    }
+#endif
+#if IMAGE == IMAGERO
+    if (randomBit == LOOKUP) {
+        countOp(LOOKUP, imageContains(image, randomValue));
+        return;
+    }
+#endif
+#if SNAPMS > 0
+    if (randomBit == LOOKUP) {
+        snapKey[nsnap] = randomValue;
+        if (++nsnap == SNAPBATCH)
+            flushSnap();
+        return;
+    }
+#endif
+#if INTERLEAVE > 1
+    if (randomBit == LOOKUP || randomBit == 1) {
+        flushBatch(); // apply this thread's batched removes before any later op of the same key
+        Walk *x = &walk[nwalk];
+        x->key = randomValue;
+        x->op = randomBit;
+        x->n = NULL;
+        if (randomBit) {
+            x->n = new Node;
+            x->n->key = randomValue;
+        }
+        if (++nwalk == INTERLEAVE)
+            flushWalk();
+        return;
+    }
+    flushWalk(); // keep this thread's removes and range ops in order with its queued ops
+#endif
+    if (randomBit == LOOKUP) {
+        flushBatch(); // this thread's queued adds and removes take effect before its lookup
+        countOp(LOOKUP, BinarySearchTree->contains(randomValue));
+        return;
+    }
+    if (randomBit == SCAN || randomBit == RDEL)
+        flushBatch(); // range ops see, and aren't undone by, this thread's earlier queued ops
+    if (randomBit == SCAN) {
+        countOp(SCAN, BinarySearchTree->scan(randomValue, randomValue + SCANLEN - 1, scanBuf, SCANLEN));
+        return;
+    }
+    if (randomBit == RDEL) {
+        countOp(RDEL, BinarySearchTree->removeRange(randomValue, randomValue + SCANLEN - 1));
+        return;
+    }
+#if BATCHSZ > 1
+    BatchOp *op = &batch[nbatch];
+    op->key = randomValue;
+    op->add = randomBit;
+    op->n = NULL;
+    if (randomBit) {
+        op->n = new Node;
+        op->n->key = randomValue;
+    }
+    if (++nbatch == BATCHSZ)
+        flushBatch();
+#else
     if (randomBit) {
         Node *addNode = new Node;
         addNode->key = randomValue;
         addNode->left = NULL;
         addNode->right = NULL;
-        BinarySearchTree->add(addNode);
+        int r = BinarySearchTree->add(addNode);
+        if (r == 0)
+            delete addNode;
+        countOp(1, r);
     }
     else {
-        BinarySearchTree->remove(randomValue);
+        countOp(0, BinarySearchTree->remove(randomValue));
+    }
+#endif
+}
+#if TRACE == 2
+TraceOp **trace;                                // mapped trace files, thread t replays trace[t % ntrace]
+size_t *ntraceOp;                               // # records in each trace
+int ntrace;                                     // # trace files
+
+//
+// loadTrace
+//
+// map trace files 0, 1, 2, ... up to the first missing one
+//
+void loadTrace()
+{
+    char fn[64];
+    trace = new TraceOp*[maxThread];
+    ntraceOp = new size_t[maxThread];
+    for (ntrace = 0; ntrace < maxThread; ntrace++) {
+        sprintf(fn, TRACEFILE, ntrace);
+        if ((trace[ntrace] = mapTrace(fn, ntraceOp[ntrace])) == NULL)
+            break;
+        for (size_t i = 0; i < ntraceOp[ntrace]; i++) {
+            if (trace[ntrace][i].op >= NOPTYPE) {
+                cout << fn << ": bad op " << trace[ntrace][i].op << " in record " << i << endl;
+                quit(1);
+            }
+        }
+    }
+    if (ntrace == 0) {
+        cout << "no trace file " << fn << endl;
+        quit(1);
     }
 }
+#endif
+
 //
 // worker
 //
@@ -214,44 +1566,86 @@ WORKER worker(void *vthread)
 
     runThreadOnCPU(thread % ncpu);
 
-    UINT *chooseRandom  = new UINT;
+    Rng rng;
+    seedRng(rng, SEED, thread);
     UINT randomValue;
     UINT randomBit;
+    UINT keyMask = (UINT) pow(16, sharing+1) - 1;  // key range is a power of 2
+    opCount = &opStats[thread];
+#if GAPS
+    Gap *gap = &gaps[thread];
+#endif
+#if TRACE == 1
+    char fn[64];
+    sprintf(fn, TRACEFILE, thread);
+    TraceWriter *tw = new TraceWriter;
+    openTrace(*tw, fn);
+#elif TRACE == 2
+    TraceOp *tp = trace[thread % ntrace];
+    TraceOp *te = tp + ntraceOp[thread % ntrace];
+#endif
+
+    batch = new BatchOp[BATCHSZ];
+    walk = new Walk[INTERLEAVE > 1 ? INTERLEAVE : 1];
+    nwalk = 0;
+    snapKey = new INT64[SNAPBATCH];
+    snapFound = new int[SNAPBATCH];
+    nsnap = 0;
+    hazard = &snapHazard[thread];
+    nbatch = 0;
+    scanBuf = new INT64[SCANLEN];
+    path = &pathStats[thread];
+    nsample = 0;
 
     while (1) {
         for(int y=0; y<NOPS; y++) {
-            randomBit = 0;
-            *chooseRandom = rand(*chooseRandom);
-            randomBit = *chooseRandom % 2;
-            switch (sharing) {
-                case 0:
-                    runOp(*chooseRandom % 16, randomBit);
-                    break;
-                case 1:
-                    randomValue = *chooseRandom % 256;
-                    runOp(randomValue, randomBit);
-                    break;
-                case 2:
-                    randomValue = *chooseRandom % 4096;
-                    runOp(randomValue, randomBit);
-                    break;
-                case 3:
-                    randomValue = *chooseRandom % 65536;
-                    runOp(randomValue, randomBit);
-                    break;
-                case 4:
-                    randomValue = *chooseRandom % 1048576;
-                    runOp(randomValue, randomBit);
-                    break;
-            }
+#if TRACE == 2
+            randomValue = tp->key & keyMask;            // fold recorded key into key range
+            randomBit = tp->op;
+            if (++tp == te)
+                tp = trace[thread % ntrace];            // wrap
+#else
+            UINT64 r = nextRng(rng);                    // key from low bits, op from high bits
+            randomBit = (UINT) (r >> 63);
+#if READPCT + SCANPCT + RDELPCT > 0
+            UINT pct = (UINT) ((r >> 32) & 0x7fffffff) % 100;
+            if (pct < READPCT)
+                randomBit = LOOKUP;
+            else if (pct < READPCT + SCANPCT)
+                randomBit = SCAN;
+            else if (pct < READPCT + SCANPCT + RDELPCT)
+                randomBit = RDEL;
+#endif
+            randomValue = (UINT) r & keyMask;
+#if TRACE == 1
+            recordOp(*tw, randomValue, randomBit);
+#endif
+#endif
+            runOp(randomValue, randomBit);
+#if GAPS
+            recordGap(*gap);
+#endif
         }
         n += NOPS;
+        recordSeries(series[thread], NOPS);
         //
         // check if runtime exceeded
         //
         if ((getWallClockMS() - tstart) > NSECONDS*1000)
             break;
     }
+    flushSnap();
+    flushWalk();
+    flushBatch();
+    delete[] snapKey;
+    delete[] snapFound;
+    delete[] walk;
+    delete[] batch;
+    delete[] scanBuf;
+#if TRACE == 1
+    closeTrace(*tw);
+    delete tw;
+#endif
     ops[thread] = n;
     BinarySearchTree->destroy(BinarySearchTree->root); //Recursively destroy BST
     BinarySearchTree->root = NULL;
@@ -264,6 +1658,9 @@ int main()
 {
     ncpu = getNumberOfCPUs();   // number of logical CPUs
     maxThread = 2 * ncpu;       // max number of threads
+#if TRACE == 2
+    loadTrace();                // replay traces
+#endif
     //
     // get date
     //
@@ -276,21 +1673,45 @@ int main()
     //
     // allocate global variable
     //
-    // NB: each element in g is stored in a different cache line to stop false sharing
+    // NB: per thread counts are cache line aligned to stop false sharing
     //
     threadH = (THREADH*) ALIGNED_MALLOC(maxThread*sizeof(THREADH), lineSz);             // thread handles
     ops = (UINT64*) ALIGNED_MALLOC(maxThread*sizeof(UINT64), lineSz);                   // for ops per thread
+    pathStats = (PathStats*) ALIGNED_MALLOC(maxThread*sizeof(PathStats), 64);           // search path samples per thread
+    snapHazard = (SnapHazard*) ALIGNED_MALLOC(maxThread*sizeof(SnapHazard), 64);        // snapshot hazard per thread
 
-    g = (VINT*) ALIGNED_MALLOC((maxThread + 1)*lineSz, lineSz);                         // local and shared global variables
+    opStats = (OpStats*) ALIGNED_MALLOC(maxThread*sizeof(OpStats), 64);                 // op counts per thread
+    series = (Series*) ALIGNED_MALLOC(maxThread*sizeof(Series), 64);                    // time series per thread
+    merged = new UINT64[MAXBUCKET];                                                     // merged time series
+    gaps = (Gap*) ALIGNED_MALLOC(maxThread*sizeof(Gap), 64);                            // op-free intervals per thread
 
     r = (Result*) ALIGNED_MALLOC(5*maxThread*sizeof(Result), lineSz);                   // for results
     memset(r, 0, 5*maxThread*sizeof(Result));                                        // zero
 
     indx = 0;
     //
+    // node pool, pre-faulted here so runs don't take first touch faults
+    //
+    int pages = poolInit(sizeof(Node), (size_t) POOLMB*K*K, PAGES);
+    int dtlbFd = openDTLBMissCounter();
+    //
     // use thousands comma separator
     //
     setCommaLocale();
+    cout << "node pool " << POOLMB << "MB " << (pages < 0 ? "unavailable" : pagesName[pages]) << " pages";
+    cout << (dtlbFd < 0 ? ", DTLB miss counter unavailable" : "") << endl;
+    if (INTERLEAVE > 1)
+        cout << "lookups and adds run " << INTERLEAVE << " traversals at a time interleaved" << endl;
+    if (SNAPMS > 0) {
+        cout << "lookups read a snapshot republished every " << SNAPMS << "ms, " << SNAPBATCH << " at a time";
+#ifdef __AVX2__
+        cout << (SNAPBATCH == 8 ? " (AVX2)" : "");
+#endif
+        cout << endl;
+    }
+    if (IMAGE > 0)
+        cout << "prefill warm starts from a tree image mapped " << (IMAGE == IMAGERO ? "read only, lookups read the image" : "copy on write") << endl;
+    cout << endl;
     //
     // header
     //
@@ -299,6 +1720,39 @@ int main()
     cout << setw(10) << "rt";
     cout << setw(20) << "ops";
     cout << setw(10) << "rel";
+    cout << setw(10) << "faults";
+    cout << setw(10) << "dtlb/op";
+    cout << setw(14) << "ops/s";
+    cout << setw(14) << "eff/s";
+    cout << setw(14) << "steady/s";
+    cout << setw(8) << "cv%";
+    cout << setw(12) << "min ops";
+    cout << setw(12) << "max ops";
+    cout << setw(8) << "ops cv%";
+    cout << setw(7) << "jain";
+#if GAPS
+    cout << setw(10) << "gap us";
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << opName[op];
+            cout << setw(12) << effName[op];
+        }
+    }
+#if IMAGE > 0
+    cout << setw(10) << "save ms";
+    cout << setw(10) << "load ms";
+#endif
+#if SNAPMS > 0
+    cout << setw(8) << "snaps";
+    cout << setw(10) << "pub us";
+#endif
+#if SAMPLE > 0
+    cout << setw(8) << "depth";
+    cout << setw(8) << "lines";
+    cout << setw(12) << "nodes";
+    cout << setw(8) << "height";
+#endif
     cout << endl;
 
     cout << setw(13) << "---";       // random count
@@ -306,6 +1760,39 @@ int main()
     cout << setw(10) << "--";        // rt
     cout << setw(20) << "---";       // ops
     cout << setw(10) << "---";       // rel
+    cout << setw(10) << "------";    // faults
+    cout << setw(10) << "-------";   // dtlb/op
+    cout << setw(14) << "-----";     // ops/s
+    cout << setw(14) << "-----";     // eff/s
+    cout << setw(14) << "--------";  // steady/s
+    cout << setw(8) << "---";        // cv%
+    cout << setw(12) << "-------";   // min ops
+    cout << setw(12) << "-------";   // max ops
+    cout << setw(8) << "-------";    // ops cv%
+    cout << setw(7) << "----";       // jain
+#if GAPS
+    cout << setw(10) << "------";    // gap us
+#endif
+    for (int op = 0; op < NOPTYPE; op++) {
+        if (OPCOLS & (1 << op)) {
+            cout << setw(12) << "-----";
+            cout << setw(12) << "-----";
+        }
+    }
+#if IMAGE > 0
+    cout << setw(10) << "-------";   // save ms
+    cout << setw(10) << "-------";   // load ms
+#endif
+#if SNAPMS > 0
+    cout << setw(8) << "-----";      // snaps
+    cout << setw(10) << "------";    // pub us
+#endif
+#if SAMPLE > 0
+    cout << setw(8) << "-----";      // depth
+    cout << setw(8) << "-----";      // lines
+    cout << setw(12) << "-----";     // nodes
+    cout << setw(8) << "------";     // height
+#endif
     cout << endl;
 
     //
@@ -318,43 +1805,153 @@ int main()
             //
             //  zero shared memory
             //
-            for (int thread = 0; thread < nt; thread++)
-                *(GINDX(thread)) = 0;   // thread local
-            *(GINDX(maxThread)) = 0;    // shared
+            memset(opStats, 0, nt*sizeof(OpStats));
+#if PREFILL > 0
+            prefill((UINT) pow(16, sharing+1));
+#endif
             //
             // get start time
             //
+            memset(pathStats, 0, nt*sizeof(PathStats));
+            memset(&shape, 0, sizeof(shape));
+#if SNAPMS > 0
+            memset(snapHazard, 0, nt*sizeof(SnapHazard));
+            snapThreads = nt;
+            snapSorted = new INT64[(UINT) pow(16, sharing+1)];
+            snap = buildSnapshot(snapSorted, ncpu);
+            snapCount = snapUS = 0;
+#endif
+            UINT64 faults = getPageFaults();
+            startCounter(dtlbFd);
+            resetSeries(series, nt, BUCKETMS);
+#if GAPS
+            resetGaps(gaps, nt);
+#endif
             tstart = getWallClockMS();
             //
             // create worker threads
             //
             for (int thread = 0; thread < nt; thread++)
                 createThread(&threadH[thread], worker, (void*)(size_t)thread);
+#if SAMPLE > 0
+            THREADH shapeH;
+            createThread(&shapeH, shapeWorker, NULL);
+#endif
+#if SNAPMS > 0
+            THREADH publishH;
+            createThread(&publishH, publishWorker, NULL);
+#endif
             //
             // wait for ALL worker threads to finish
             //
             waitForThreadsToFinish(nt, threadH);
             UINT64 rt = getWallClockMS() - tstart;
+            int nb = mergeSeries(series, nt, merged);
+            seriesStats(merged, nb, BUCKETMS, r[indx].steady, r[indx].cv);
+            r[indx].jain = fairStats(ops, nt, r[indx].minOps, r[indx].maxOps, r[indx].cvOps);
+#if GAPS
+            closeGaps(gaps, nt, NSECONDS*1000);
+            for (int thread = 0; thread < nt; thread++)
+                r[indx].maxGap = max(r[indx].maxGap, ticksToUS(gaps[thread].max));
+#endif
+            r[indx].dtlb = stopCounter(dtlbFd);
+            r[indx].faults = getPageFaults() - faults;
+#if IMAGE > 0
+            r[indx].saveMS = imageSaveMS;
+            r[indx].loadMS = imageLoadMS;
+#endif
+#if SAMPLE > 0
+            waitForThreadsToFinish(1, &shapeH);
+            closeThread(shapeH);
+#endif
+#if SNAPMS > 0
+            waitForThreadsToFinish(1, &publishH);
+            closeThread(publishH);
+            freeSnapshot(snap);
+            snap = NULL;
+            delete[] snapSorted;
+            r[indx].snaps = snapCount;
+            r[indx].snapUS = snapCount ? (double) snapUS / snapCount : 0;
+#endif
+#if IMAGE == IMAGERO
+            freeImage(image);
+#endif
+            BinarySearchTree->reclaim();    // quiescent, free nodes retired by remove
+            BinarySearchTree->root = NULL;  // every node back to the pool
+            poolReset();
 
             //
             // save results and output summary to console
             //
             for (int thread = 0; thread < nt; thread++) {
                 r[indx].ops += ops[thread];
-                r[indx].incs += *(GINDX(thread));
+                for (int op = 0; op < NOPTYPE; op++) {
+                    r[indx].op[op] += opStats[thread].op[op];
+                    r[indx].eff[op] += opStats[thread].eff[op];
+                }
             }
-            r[indx].incs += *(GINDX(maxThread));
             if ((sharing == 0) && (nt == 1))
                 ops1 = r[indx].ops;
             r[indx].sharing = sharing;
             r[indx].nt = nt;
             r[indx].rt = rt;
+            UINT64 nsampled = 0;
+            for (int thread = 0; thread < nt; thread++) {
+                nsampled += pathStats[thread].n;
+                r[indx].depth += pathStats[thread].depth;
+                r[indx].lines += pathStats[thread].lines;
+            }
+            if (nsampled) {
+                r[indx].depth /= nsampled;
+                r[indx].lines /= nsampled;
+            }
+            r[indx].nodes = shape.nodes;
+            r[indx].height = shape.height;
 
             cout << setw(13) << pow(16,sharing+1);
             cout << setw(10) << nt;
             cout << setw(10) << fixed << setprecision(2) << (double) rt / 1000;
             cout << setw(20) << r[indx].ops;
             cout << setw(10) << fixed << setprecision(2) << (double) r[indx].ops / ops1;
+            cout << setw(10) << r[indx].faults;
+            if (dtlbFd < 0)
+                cout << setw(10) << "-";
+            else
+                cout << setw(10) << fixed << setprecision(2) << (double) r[indx].dtlb / r[indx].ops;
+            UINT64 eff = 0;
+            for (int op = 0; op < NOPTYPE; op++)
+                eff += r[indx].eff[op];
+            cout << setw(14) << r[indx].ops * 1000 / rt;
+            cout << setw(14) << eff * 1000 / rt;
+            cout << setw(14) << (UINT64) r[indx].steady;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cv;
+            cout << setw(12) << r[indx].minOps;
+            cout << setw(12) << r[indx].maxOps;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].cvOps;
+            cout << setw(7) << fixed << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            cout << setw(10) << r[indx].maxGap;
+#endif
+            for (int op = 0; op < NOPTYPE; op++) {
+                if (OPCOLS & (1 << op)) {
+                    cout << setw(12) << r[indx].op[op] * 1000 / rt;
+                    cout << setw(12) << r[indx].eff[op] * 1000 / rt;
+                }
+            }
+#if IMAGE > 0
+            cout << setw(10) << fixed << setprecision(2) << r[indx].saveMS;
+            cout << setw(10) << fixed << setprecision(2) << r[indx].loadMS;
+#endif
+#if SNAPMS > 0
+            cout << setw(8) << r[indx].snaps;
+            cout << setw(10) << fixed << setprecision(0) << r[indx].snapUS;
+#endif
+#if SAMPLE > 0
+            cout << setw(8) << fixed << setprecision(2) << r[indx].depth;
+            cout << setw(8) << fixed << setprecision(2) << r[indx].lines;
+            cout << setw(12) << r[indx].nodes;
+            cout << setw(8) << r[indx].height;
+#endif
             cout << endl;
 
             ofstream metrics;
@@ -365,10 +1962,72 @@ int main()
             metrics << fixed << setprecision(2) << (double)rt / 1000 << ", ";
             metrics << r[indx].ops << ", ";
             metrics << fixed << setprecision(2) << (double)r[indx].ops / ops1;
+            metrics << ", " << eff;
+            metrics << ", " << (UINT64) r[indx].steady << ", " << fixed << setprecision(2) << r[indx].cv;
+            metrics << ", " << r[indx].minOps << ", " << r[indx].maxOps << ", " << r[indx].cvOps;
+            metrics << ", " << setprecision(3) << r[indx].jain << setprecision(2);
+#if GAPS
+            metrics << ", " << r[indx].maxGap;
+#endif
+            metrics << ", " << r[indx].faults << ", " << r[indx].dtlb;
+            for (int op = 0; op < NOPTYPE; op++)
+                metrics << ", " << r[indx].op[op] << ", " << r[indx].eff[op];
+#if IMAGE > 0
+            metrics << ", " << fixed << setprecision(2) << r[indx].saveMS << ", " << r[indx].loadMS;
+#endif
+#if SNAPMS > 0
+            metrics << ", " << r[indx].snaps << ", " << fixed << setprecision(0) << r[indx].snapUS;
+#endif
+#if SAMPLE > 0
+            metrics << ", " << fixed << setprecision(2) << r[indx].depth;
+            metrics << ", " << fixed << setprecision(2) << r[indx].lines;
+            metrics << ", " << r[indx].nodes;
+            metrics << ", " << r[indx].height;
+#endif
             metrics << endl;
 
             metrics.close();
 
+            ofstream buckets;
+            buckets.open("seriesTATAS.txt", ios_base::app);
+            buckets << pow(16,sharing+1) << ", ";
+            buckets << nt << ", " << BUCKETMS;
+            for (int b = 0; b < nb; b++)
+                buckets << ", " << merged[b];
+            buckets << endl;
+            buckets.close();
+
+            ofstream fair;
+            fair.open("fairTATAS.txt", ios_base::app);
+            fair << pow(16,sharing+1) << ", ";
+            fair << nt;
+            for (int thread = 0; thread < nt; thread++) {
+                fair << ", " << ops[thread];
+#if GAPS
+                fair << ", " << ticksToUS(gaps[thread].max);
+#endif
+            }
+            fair << endl;
+            fair.close();
+
+            if (r[indx].jain < MINJAIN) {
+                cout << endl << "Jain's index " << setprecision(3) << r[indx].jain << " below MINJAIN " << MINJAIN << endl;
+                quit(1);
+            }
+
+#if SAMPLE > 0
+            //
+            // depth histogram: # nodes at depth 0, 1, ...
+            //
+            ofstream hist;
+            hist.open("shapeTATAS.txt", ios_base::app);
+            hist << (UINT) pow(16,sharing+1) << ", " << nt;
+            for (int d = 0; d < min(shape.height, MAXDEPTH); d++)
+                hist << ", " << shape.hist[d];
+            hist << endl;
+            hist.close();
+#endif
+
             //
             // delete thread handles
             //